@@ -0,0 +1,381 @@
+/**
+ * planet_bench: microbenchmarks of the startup phases, shader loading and
+ * compiling, pipeline creation and the CPU cost of recording and submitting
+ * a headless frame. Needs no window so it runs on lavapipe in CI. Every
+ * benchmark runs once to warm up and then --repetitions times, the results
+ * are logged and optionally written as JSON to track regressions.
+ **/
+#include "../frametiming/frametiming.h"
+#include "../fwatcher/fwatcher.h"
+#include "../options/options.h"
+#include "../quality/quality.h"
+#include "../shadercompiler/shadercompiler.h"
+#include "../vkcommon/vkcommon.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct BenchOptions {
+  uint32_t repetitions = 10;
+  // Frames recorded per repetition of the frame benchmark
+  uint32_t frames = 100;
+  uint32_t width = 800;
+  uint32_t height = 600;
+  // Written when not empty
+  std::string jsonPath;
+  // Keep the log output of the benchmarked functions, it is part of their
+  // cost in Planet but adds terminal noise to the measurements
+  bool log = false;
+};
+
+struct BenchResult {
+  std::string name;
+  StatsSummary stats;
+};
+
+void printUsage(const char *program) {
+  spdlog::info("Usage: {} [options]", program);
+  spdlog::info("  --repetitions <n> Timed runs per benchmark (default 10)");
+  spdlog::info("  --frames <n>      Frames per run of the frame benchmark "
+               "(default 100)");
+  spdlog::info("  --width <px>      Frame width (default 800)");
+  spdlog::info("  --height <px>     Frame height (default 600)");
+  spdlog::info("  --json <file>     Write the results to file");
+  spdlog::info("  --log             Keep the benchmarked functions' log "
+               "output");
+}
+
+BenchOptions parseBenchOptions(int argc, char **argv) {
+  BenchOptions options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (arg == "--repetitions") {
+      options.repetitions = parseUint(arg, value);
+      i++;
+    } else if (arg == "--frames") {
+      options.frames = parseUint(arg, value);
+      i++;
+    } else if (arg == "--width") {
+      options.width = parseUint(arg, value);
+      i++;
+    } else if (arg == "--height") {
+      options.height = parseUint(arg, value);
+      i++;
+    } else if (arg == "--json") {
+      if (value == nullptr)
+        throw std::runtime_error("Missing value for --json");
+      options.jsonPath = value;
+      i++;
+    } else if (arg == "--log") {
+      options.log = true;
+    } else if (arg == "--help" || arg == "-h") {
+      printUsage(argv[0]);
+      std::exit(0);
+    } else {
+      printUsage(argv[0]);
+      throw std::runtime_error(fmt::format("Unknown option {}", arg));
+    }
+  }
+  return options;
+}
+
+using Clock = std::chrono::high_resolution_clock;
+
+double elapsedMs(const Clock::time_point &start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                              start)
+             .count() *
+         1e-6;
+}
+
+class Bench {
+private:
+  const BenchOptions &options;
+  std::vector<BenchResult> results;
+
+public:
+  explicit Bench(const BenchOptions &options) : options{options} {}
+
+  // sample runs the benchmarked code once and returns its time in ms, so
+  // setup and teardown around it stay out of the measurement
+  void run(const std::string &name, const std::function<double()> &sample) {
+    spdlog::level::level_enum level = spdlog::get_level();
+    if (!options.log)
+      spdlog::set_level(spdlog::level::warn);
+    RollingStats stats(options.repetitions);
+    sample();
+    for (uint32_t i = 0; i < options.repetitions; i++)
+      stats.push(sample());
+    spdlog::set_level(level);
+    report(name, stats.summary());
+  }
+
+  // For benchmarks that take several samples per run
+  void report(const std::string &name, const StatsSummary &stats) {
+    spdlog::info("{:<28} median {:.3f} stddev {:.3f} {} (n={})", name,
+                 stats.median, stats.stddev, formatStats(stats), stats.count);
+    results.push_back({name, stats});
+  }
+
+  void writeJson(const std::string &path) const {
+    std::ofstream file(path);
+    if (!file)
+      throw std::runtime_error(fmt::format("Failed to open {}", path));
+    file << fmt::format("{{\"unit\":\"ms\",\"repetitions\":{},\"frames\":{},"
+                        "\"width\":{},\"height\":{},\"benchmarks\":[",
+                        options.repetitions, options.frames, options.width,
+                        options.height);
+    for (size_t i = 0; i < results.size(); i++) {
+      const StatsSummary &stats = results[i].stats;
+      file << fmt::format(
+          "{}\n{{\"name\":\"{}\",\"count\":{},\"min\":{:.6f},\"mean\":{:.6f},"
+          "\"median\":{:.6f},\"stddev\":{:.6f},\"p95\":{:.6f},"
+          "\"p99\":{:.6f}}}",
+          i == 0 ? "" : ",", results[i].name, stats.count, stats.min,
+          stats.avg, stats.median, stats.stddev, stats.p95, stats.p99);
+    }
+    file << "\n]}\n";
+    if (!file)
+      throw std::runtime_error(fmt::format("Failed to write {}", path));
+    spdlog::info("Wrote results to {}", path);
+  }
+};
+
+/**
+ * The CPU side of a headless fragment path frame as runHeadless records it,
+ * without the start distance prepass: from after the fence wait to the
+ * return of vkQueueSubmit. Every frame is a sample.
+ **/
+void benchFrames(Bench &bench, const BenchOptions &options,
+                 const VkPhysicalDevice &physicalDevice,
+                 const VkDevice &device, const uint32_t &queueIndex,
+                 const VkPipeline &pipeline,
+                 const VkPipelineLayout &pipelineLayout,
+                 const VkDescriptorSetLayout &sceneSetLayout,
+                 const VkDescriptorSetLayout &frameSetLayout) {
+  static constexpr VkFormat offscreenFormat = VK_FORMAT_R8G8B8A8_SRGB;
+  static constexpr uint32_t framesInFlight = 2;
+  VkExtent2D extent{options.width, options.height};
+  VkQueue queue;
+  vkGetDeviceQueue(device, queueIndex, 0, &queue);
+
+  VkCommandPool commandPool = createCommandPool(device, queueIndex);
+  std::vector<VkCommandBuffer> commandBuffers =
+      createCommandBuffers(device, commandPool, framesInFlight);
+  std::vector<VkFence> fences = createFences(device, framesInFlight);
+  VkDescriptorPool sceneDescriptorPool;
+  std::vector<VkDescriptorSet> sceneDescriptorSets = createDescriptorSets(
+      device, sceneSetLayout, {{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1}},
+      framesInFlight, sceneDescriptorPool);
+  VkSampler nearestSampler = createNearestSampler(device);
+  std::vector<OffscreenImage> prepassTargets =
+      createPrepassTargets(physicalDevice, device, extent, framesInFlight);
+  UniformRing uniformRing = createUniformRing(
+      physicalDevice, device, sizeof(ShaderToyUniforms), framesInFlight);
+  VkDescriptorPool frameDescriptorPool;
+  VkDescriptorSet frameDescriptorSet =
+      createDescriptorSets(device, frameSetLayout,
+                           {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1}}, 1,
+                           frameDescriptorPool)[0];
+  writeUniformRingDescriptor(device, frameDescriptorSet, uniformRing);
+  std::vector<OffscreenImage> offscreenImages(framesInFlight);
+  for (auto &offscreenImage : offscreenImages) {
+    offscreenImage = createOffscreenImage(
+        physicalDevice, device, extent, offscreenFormat,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+  }
+
+  ShaderToyUniforms uniforms{
+      .iResolution = glm::vec3{extent.width, extent.height, 1.0f},
+  };
+  PushConstants pushConstants{};
+  auto frame = [&](const uint32_t &index) {
+    uint32_t slot = index % framesInFlight;
+    VK_CHECK(
+        vkWaitForFences(device, 1, &fences[slot], VK_TRUE, UINT64_MAX));
+    VK_CHECK(vkResetFences(device, 1, &fences[slot]));
+    auto start = Clock::now();
+    VkCommandBuffer commandBuffer = commandBuffers[slot];
+    VK_CHECK(vkResetCommandBuffer(commandBuffer, 0));
+    VkCommandBufferBeginInfo commandBufferBeginInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    VK_CHECK(vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo));
+    // A fixed step, the shading cost is not what is measured here
+    uniforms.iTime = index / 60.0f;
+    uniforms.iFrame = index;
+    FrameUniforms frameUniforms{
+        .descriptorSet = frameDescriptorSet,
+        .offset = writeUniformRing(uniformRing, slot, uniforms),
+    };
+    recordPrepass(commandBuffer, prepassTargets[slot], extent,
+                  VK_NULL_HANDLE, pipelineLayout, frameUniforms,
+                  pushConstants, false);
+    writeStartDistance(device, sceneDescriptorSets[slot], 0, nearestSampler,
+                       prepassTargets[slot]);
+    renderScene(offscreenImages[slot].image, offscreenImages[slot].view,
+                extent, commandBuffer, pipeline, pipelineLayout,
+                sceneDescriptorSets[slot], frameUniforms, pushConstants,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    VK_CHECK(vkEndCommandBuffer(commandBuffer));
+    VkSubmitInfo submitInfo{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &commandBuffer,
+    };
+    VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, fences[slot]));
+    return elapsedMs(start);
+  };
+
+  // One warmup run, then every frame of the timed runs is a sample
+  RollingStats stats(static_cast<size_t>(options.repetitions) *
+                     options.frames);
+  uint32_t index = 0;
+  for (uint32_t i = 0; i < options.frames; i++)
+    frame(index++);
+  for (uint32_t run = 0; run < options.repetitions; run++) {
+    for (uint32_t i = 0; i < options.frames; i++)
+      stats.push(frame(index++));
+  }
+  VK_CHECK(vkDeviceWaitIdle(device));
+  bench.report("recordSubmitFrame", stats.summary());
+
+  for (auto &offscreenImage : offscreenImages)
+    destroyOffscreenImage(device, offscreenImage);
+  for (auto &target : prepassTargets)
+    destroyOffscreenImage(device, target);
+  destroyUniformRing(device, uniformRing);
+  vkDestroyDescriptorPool(device, frameDescriptorPool, nullptr);
+  vkDestroyDescriptorPool(device, sceneDescriptorPool, nullptr);
+  vkDestroySampler(device, nearestSampler, nullptr);
+  for (auto &fence : fences)
+    vkDestroyFence(device, fence, nullptr);
+  vkDestroyCommandPool(device, commandPool, nullptr);
+}
+
+int runBenchmarks(const BenchOptions &options) {
+  Bench bench(options);
+
+  bench.run("setupVulkanInstance", []() {
+    auto start = Clock::now();
+    VkInstance instance = setupVulkanInstance(true);
+    double ms = elapsedMs(start);
+    vkDestroyInstance(instance, nullptr);
+    return ms;
+  });
+
+  // The remaining benchmarks share one instance and device
+  VkInstance instance = setupVulkanInstance(true);
+  VkPhysicalDevice physicalDevice = findGPU(instance);
+  bench.run("findGPU", [&]() {
+    auto start = Clock::now();
+    findGPU(instance);
+    return elapsedMs(start);
+  });
+
+  uint32_t queueIndex =
+      getVulkanGraphicsQueueIndex(physicalDevice, VK_NULL_HANDLE);
+  bench.run("createVulkanLogicalDevice", [&]() {
+    auto start = Clock::now();
+    VkDevice device =
+        createVulkanLogicalDevice(physicalDevice, queueIndex, true);
+    double ms = elapsedMs(start);
+    vkDestroyDevice(device, nullptr);
+    return ms;
+  });
+
+  VkDevice device = createVulkanLogicalDevice(physicalDevice, queueIndex, true);
+  loadDeviceFunctions(device);
+
+  bench.run("loadShaderModule", [&]() {
+    auto start = Clock::now();
+    VkShaderModule module = loadShaderModule(device, "shaders/planet.spv");
+    double ms = elapsedMs(start);
+    vkDestroyShaderModule(device, module, nullptr);
+    return ms;
+  });
+
+  ShaderCompiler shaderCompiler;
+  bench.run("processFile", [&]() {
+    auto start = Clock::now();
+    if (!processFile(shaderCompiler, "shaders/planet.frag"))
+      throw std::runtime_error("shaders/planet.frag did not compile");
+    return elapsedMs(start);
+  });
+
+  VkDescriptorSetLayout sceneSetLayout = createSceneSetLayout(device);
+  VkDescriptorSetLayout frameSetLayout = createFrameSetLayout(device);
+  VkPipelineLayout pipelineLayout =
+      createPipelineLayout(device, sceneSetLayout, frameSetLayout);
+  VkSpecializationInfo specialization = qualitySpecialization(Quality::High);
+  auto createScenePipeline = [&](const VkPipelineCache &pipelineCache) {
+    return createPipeline(device, pipelineLayout, VK_FORMAT_R8G8B8A8_SRGB,
+                          pipelineCache, shaderCompiler,
+                          "shaders/planet.frag", &specialization);
+  };
+  // Without a pipeline cache, and with the drivers' own disk caches off (see
+  // main), every run compiles from scratch like a first launch. Drivers
+  // that also cache in memory per device (eg. RADV) still serve repeats.
+  bench.run("createPipeline", [&]() {
+    auto start = Clock::now();
+    VkPipeline pipeline = createScenePipeline(VK_NULL_HANDLE);
+    double ms = elapsedMs(start);
+    vkDestroyPipeline(device, pipeline, nullptr);
+    return ms;
+  });
+  // With a cache the warmup run filled, like a launch with a cache file
+  VkPipelineCacheCreateInfo pipelineCacheCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+  };
+  VkPipelineCache pipelineCache;
+  VK_CHECK(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr,
+                                 &pipelineCache));
+  bench.run("createPipelineCached", [&]() {
+    auto start = Clock::now();
+    VkPipeline pipeline = createScenePipeline(pipelineCache);
+    double ms = elapsedMs(start);
+    vkDestroyPipeline(device, pipeline, nullptr);
+    return ms;
+  });
+
+  VkPipeline pipeline = createScenePipeline(pipelineCache);
+  benchFrames(bench, options, physicalDevice, device, queueIndex, pipeline,
+              pipelineLayout, sceneSetLayout, frameSetLayout);
+
+  if (!options.jsonPath.empty())
+    bench.writeJson(options.jsonPath);
+
+  vkDestroyPipeline(device, pipeline, nullptr);
+  vkDestroyPipelineCache(device, pipelineCache, nullptr);
+  vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+  vkDestroyDescriptorSetLayout(device, frameSetLayout, nullptr);
+  vkDestroyDescriptorSetLayout(device, sceneSetLayout, nullptr);
+  vkDestroyDevice(device, nullptr);
+  vkDestroyInstance(instance, nullptr);
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  // The drivers' on-disk shader caches would serve every createPipeline run
+  // after the warmup, they are read when the device is created. Set either
+  // variable beforehand to keep the cache.
+  setenv("MESA_SHADER_CACHE_DISABLE", "true", 0);
+  setenv("__GL_SHADER_DISK_CACHE", "0", 0);
+  try {
+    return runBenchmarks(parseBenchOptions(argc, argv));
+  } catch (const std::exception &e) {
+    spdlog::error("{}", e.what());
+    return 1;
+  }
+}
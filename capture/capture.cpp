@@ -0,0 +1,156 @@
+#include "capture.h"
+#include <cstring>
+#include <iterator>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+namespace {
+
+// Bumped whenever the frame record changes
+constexpr char magic[8] = {'P', 'L', 'C', 'A', 'P', 'T', '0', '1'};
+
+// f64 wall time, f32 iTime, f32 cursor x and y, u16 framebuffer width and
+// height, u8 flags, u8 quality. Native byte order.
+constexpr size_t recordSize = 8 + 4 + 4 + 4 + 2 + 2 + 1 + 1;
+
+enum : uint8_t {
+  mouseDownFlag = 1,
+  checkerboardFlag = 2,
+  prepassFlag = 4,
+};
+
+template <typename T> void put(uint8_t *&out, const T &value) {
+  std::memcpy(out, &value, sizeof(T));
+  out += sizeof(T);
+}
+
+template <typename T> T get(const uint8_t *&in) {
+  T value;
+  std::memcpy(&value, in, sizeof(T));
+  in += sizeof(T);
+  return value;
+}
+
+void encode(const CapturedFrame &frame, uint8_t *out) {
+  put(out, frame.wallTime);
+  put(out, frame.iTime);
+  put(out, frame.cursorX);
+  put(out, frame.cursorY);
+  put(out, static_cast<uint16_t>(frame.framebufferWidth));
+  put(out, static_cast<uint16_t>(frame.framebufferHeight));
+  uint8_t flags = (frame.mouseDown ? mouseDownFlag : 0) |
+                  (frame.checkerboard ? checkerboardFlag : 0) |
+                  (frame.prepass ? prepassFlag : 0);
+  put(out, flags);
+  put(out, static_cast<uint8_t>(frame.quality));
+}
+
+CapturedFrame decode(const uint8_t *in) {
+  CapturedFrame frame;
+  frame.wallTime = get<double>(in);
+  frame.iTime = get<float>(in);
+  frame.cursorX = get<float>(in);
+  frame.cursorY = get<float>(in);
+  frame.framebufferWidth = get<uint16_t>(in);
+  frame.framebufferHeight = get<uint16_t>(in);
+  uint8_t flags = get<uint8_t>(in);
+  frame.mouseDown = flags & mouseDownFlag;
+  frame.checkerboard = flags & checkerboardFlag;
+  frame.prepass = flags & prepassFlag;
+  uint8_t quality = get<uint8_t>(in);
+  if (quality >= qualityTierCount)
+    throw std::runtime_error("Capture has an unknown quality tier");
+  frame.quality = static_cast<Quality>(quality);
+  return frame;
+}
+
+} // namespace
+
+CaptureWriter::CaptureWriter(const std::string &path)
+    : file{path, std::ios::binary | std::ios::trunc} {
+  if (!file)
+    throw std::runtime_error(fmt::format("Failed to open {}", path));
+  file.write(magic, sizeof(magic));
+  spdlog::info("Capturing input to {}", path);
+  writer = std::thread([this]() { run(); });
+}
+
+CaptureWriter::~CaptureWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  changed.notify_all();
+  if (writer.joinable())
+    writer.join();
+}
+
+void CaptureWriter::push(const CapturedFrame &frame) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(frame);
+  }
+  changed.notify_all();
+}
+
+void CaptureWriter::finish() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  changed.notify_all();
+  if (writer.joinable())
+    writer.join();
+  file.flush();
+  if (!file)
+    throw std::runtime_error("Writing the capture failed");
+}
+
+uint64_t CaptureWriter::framesCaptured() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return frameCount;
+}
+
+void CaptureWriter::run() {
+  std::vector<CapturedFrame> frames;
+  std::vector<uint8_t> bytes;
+  while (true) {
+    bool stop;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [this]() { return !pending.empty() || stopping; });
+      // Takes everything pushed since the last batch in one go
+      std::swap(frames, pending);
+      stop = stopping;
+    }
+    bytes.resize(frames.size() * recordSize);
+    for (size_t i = 0; i < frames.size(); i++)
+      encode(frames[i], bytes.data() + i * recordSize);
+    file.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      frameCount += frames.size();
+    }
+    frames.clear();
+    if (stop)
+      return;
+  }
+}
+
+std::vector<CapturedFrame> readCapture(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    throw std::runtime_error(fmt::format("Failed to open {}", path));
+  char header[sizeof(magic)];
+  file.read(header, sizeof(header));
+  if (!file || std::memcmp(header, magic, sizeof(magic)) != 0)
+    throw std::runtime_error(fmt::format("{} is not a capture", path));
+  std::vector<uint8_t> bytes{std::istreambuf_iterator<char>(file),
+                             std::istreambuf_iterator<char>()};
+  if (bytes.size() % recordSize != 0)
+    spdlog::warn("{} ends in a partial frame, ignoring it", path);
+  std::vector<CapturedFrame> frames(bytes.size() / recordSize);
+  for (size_t i = 0; i < frames.size(); i++)
+    frames[i] = decode(bytes.data() + i * recordSize);
+  return frames;
+}
@@ -0,0 +1,60 @@
+/**
+ * Capture and replay of interactive sessions. Everything from the window
+ * that shapes a frame (the iTime the shaders saw, the cursor and left
+ * button, the C/D/Q toggles and the framebuffer size after resizes) is
+ * recorded per frame into a compact binary file by a background thread, so
+ * a session can be replayed to profile it or compare builds.
+ **/
+#pragma once
+#include "../quality/quality.h"
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct CapturedFrame {
+  // Seconds from the start of the capture to the start of the frame, a
+  // replay at the recorded pace waits for it
+  double wallTime;
+  float iTime;
+  // Cursor position in window coordinates
+  float cursorX;
+  float cursorY;
+  bool mouseDown;
+  // The toggles the push constants and pipelines are picked from
+  bool checkerboard;
+  bool prepass;
+  Quality quality;
+  uint32_t framebufferWidth;
+  uint32_t framebufferHeight;
+};
+
+class CaptureWriter {
+private:
+  std::ofstream file;
+  std::mutex mutex;
+  std::condition_variable changed;
+  // Pushed by the render loop and not written yet
+  std::vector<CapturedFrame> pending;
+  bool stopping = false;
+  uint64_t frameCount = 0;
+  std::thread writer;
+
+  void run();
+
+public:
+  explicit CaptureWriter(const std::string &path);
+  ~CaptureWriter();
+  // Never waits for the disk
+  void push(const CapturedFrame &frame);
+  // Writes everything pushed and joins the writer, throws if writing
+  // failed
+  void finish();
+  uint64_t framesCaptured();
+};
+
+// Throws if path is not a capture written by this version
+std::vector<CapturedFrame> readCapture(const std::string &path);
@@ -0,0 +1,234 @@
+#include "cpurender.h"
+#include "packet.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+using packet::Floats;
+using packet::Mask;
+
+struct Vec3 {
+  Floats x, y, z;
+};
+
+Vec3 operator+(const Vec3 &a, const Vec3 &b) {
+  return {a.x + b.x, a.y + b.y, a.z + b.z};
+}
+Vec3 operator-(const Vec3 &a, const Vec3 &b) {
+  return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+Vec3 operator+(const Vec3 &a, const Floats &s) {
+  return {a.x + s, a.y + s, a.z + s};
+}
+Vec3 operator*(const Vec3 &a, const Floats &s) {
+  return {a.x * s, a.y * s, a.z * s};
+}
+Floats dot(const Vec3 &a, const Vec3 &b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+Floats length(const Vec3 &a) { return packet::sqrt(dot(a, a)); }
+Vec3 normalize(const Vec3 &a) { return a * (Floats(1.0f) / length(a)); }
+Vec3 reflect(const Vec3 &i, const Vec3 &n) {
+  return i - n * (dot(n, i) * 2.0f);
+}
+Vec3 select(const Mask &m, const Vec3 &a, const Vec3 &b) {
+  return {packet::select(m, a.x, b.x), packet::select(m, a.y, b.y),
+          packet::select(m, a.z, b.z)};
+}
+
+// What planet.glsl gets from the specialization constants and uniforms
+struct Scene {
+  // The shader's time macro, iTime * .25
+  Floats time;
+  int32_t maxSteps;
+  float eps;
+  float far;
+  bool reflections;
+};
+
+// Triangle function
+Floats tri(const Floats &x) {
+  return packet::abs(x - packet::floor(x) - 0.5f);
+}
+
+Floats distort(const Vec3 &p, const Scene &scene) {
+  Vec3 t{tri(p.x + scene.time), tri(p.y + scene.time), tri(p.z + scene.time)};
+  return (t.x + packet::sin(t.x) + t.y + packet::sin(t.y) + t.z +
+          packet::sin(t.z)) *
+         0.966f;
+}
+
+// The shader keeps trap in a global written by every map(), here it is
+// returned instead
+Floats map(Vec3 p, const Scene &scene, Floats &trap) {
+  p.z = p.z + 0.2f;
+  p = p + distort(p * distort(p, scene), scene) * 0.1f;
+  trap = (packet::sin(p.x) * (Floats(1.0f) - packet::abs(p.x)) +
+          packet::sin(p.y) * (Floats(1.0f) - packet::abs(p.y)) +
+          packet::sin(p.z) * (Floats(1.0f) - packet::abs(p.z))) *
+         1.2f;
+  // sdTorus(p, vec2(1., .7))
+  Floats ring = packet::sqrt(p.x * p.x + p.z * p.z) - 1.0f;
+  Floats torus = packet::sqrt(ring * ring + p.y * p.y) - 0.7f;
+  return -torus + distort(p, scene) * 0.05f;
+}
+
+// trap is left at the last map() like in the shader, where shade() reads it.
+// The operands of - are evaluated in no particular order in C++, so every
+// map() gets its own statement in the shader's left to right order.
+Vec3 calcNormal(const Vec3 &p, const Scene &scene, Floats &trap) {
+  Floats e = scene.eps;
+  Vec3 dx{e, 0.0f, 0.0f}, dy{0.0f, e, 0.0f}, dz{0.0f, 0.0f, e};
+  Floats xPlus = map(p + dx, scene, trap);
+  Floats xMinus = map(p - dx, scene, trap);
+  Floats yPlus = map(p + dy, scene, trap);
+  Floats yMinus = map(p - dy, scene, trap);
+  Floats zPlus = map(p + dz, scene, trap);
+  Floats zMinus = map(p - dz, scene, trap);
+  return normalize(Vec3{xPlus - xMinus, yPlus - yMinus, zPlus - zMinus});
+}
+
+// Lanes stop marching on their own, the packet until every lane stopped
+Floats trace(const Vec3 &r, const Vec3 &d, const Floats &start,
+             const Scene &scene) {
+  Floats t = start;
+  Mask active = packet::allLanes();
+  Floats trap;
+  for (int32_t i = 0; i < scene.maxSteps; i++) {
+    Floats m = map(r + d * t, scene, trap);
+    t = packet::select(active, t + m, t);
+    active = active & !((m < scene.eps) | (t > scene.far));
+    if (!packet::any(active))
+      break;
+  }
+  return t;
+}
+
+Vec3 shade(const Floats &u, const Floats &v, const Scene &scene) {
+  // normalize to [-1, 1]
+  Vec3 uvw{(u * 2.0f - 1.0f) * 1.4f, v * 2.0f - 1.0f, -1.0f};
+  Vec3 r{0.0f, 0.0f, 1.0f};
+  Vec3 d = normalize(uvw);
+  Floats t = trace(r, d, 0.0f, scene);
+  Vec3 p = r + d * t;
+  Floats trap;
+  Vec3 n = calcNormal(p, scene, trap);
+
+  Mask hit = t < scene.far;
+  Vec3 black{0.0f, 0.0f, 0.0f};
+  if (!packet::any(hit))
+    return black;
+  Vec3 objcol{trap / packet::abs(Floats(1.0f) - trap), trap * trap,
+              Floats(1.0f) - trap};
+  Vec3 lp{1.0f, 3.0f, 3.0f};
+  Vec3 ld = lp - p;
+  Floats len = length(ld);
+  Floats atten = packet::max(0.0f, Floats(1.0f) / (len * len));
+  ld = ld * (Floats(1.0f) / len);
+  Floats amb = 0.25f;
+  Floats diff = packet::max(0.0f, dot(ld, n));
+  Floats specBase =
+      packet::max(0.0f, dot(reflect(Vec3{-ld.x, -ld.y, -ld.z}, n), r));
+  Floats spec2 = specBase * specBase;
+  Floats spec4 = spec2 * spec2;
+  Floats spec = spec4 * spec4;
+  Floats ref = scene.reflections
+                   ? trace(r, reflect(d, n), scene.eps * 5.0f, scene)
+                   : Floats(1.0f);
+  Floats light =
+      ((diff * 0.8f + amb * 0.8f) + spec * 0.1f + atten * 0.1f) * ref;
+  return select(hit, objcol * light, black);
+}
+
+// Linear to an 8 bit sRGB value like a store to R8G8B8A8_SRGB, which
+// clamps first. NaN ends up 0.
+uint8_t encodeSrgb(const float &linear) {
+  if (!(linear > 0.0f))
+    return 0;
+  if (linear >= 1.0f)
+    return 255;
+  float encoded = linear <= 0.0031308f
+                      ? linear * 12.92f
+                      : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+  return static_cast<uint8_t>(encoded * 255.0f + 0.5f);
+}
+
+void renderTile(const Scene &scene, const uint32_t &x0, const uint32_t &y0,
+                const uint32_t &width, const uint32_t &height,
+                uint8_t *rgba) {
+  uint32_t x1 = std::min(x0 + CpuRenderer::tileWidth, width);
+  uint32_t y1 = std::min(y0 + CpuRenderer::tileHeight, height);
+  alignas(32) float us[packet::width];
+  alignas(32) float red[packet::width];
+  alignas(32) float green[packet::width];
+  alignas(32) float blue[packet::width];
+  for (uint32_t y = y0; y < y1; y++) {
+    // Pixel centres, the row is a packet wide and the last one may overhang
+    Floats v = (static_cast<float>(y) + 0.5f) / static_cast<float>(height);
+    for (uint32_t x = x0; x < x1; x += packet::width) {
+      for (uint32_t lane = 0; lane < packet::width; lane++)
+        us[lane] = (static_cast<float>(x + lane) + 0.5f) / width;
+      Vec3 color = shade(packet::load(us), v, scene);
+      packet::store(red, color.x);
+      packet::store(green, color.y);
+      packet::store(blue, color.z);
+      uint32_t lanes = std::min(packet::width, x1 - x);
+      for (uint32_t lane = 0; lane < lanes; lane++) {
+        uint8_t *pixel = rgba + (size_t{y} * width + x + lane) * 4;
+        pixel[0] = encodeSrgb(red[lane]);
+        pixel[1] = encodeSrgb(green[lane]);
+        pixel[2] = encodeSrgb(blue[lane]);
+        pixel[3] = 255;
+      }
+    }
+  }
+}
+
+} // namespace
+
+CpuRenderer::CpuRenderer(const uint32_t &threadCount)
+    : jobs{threadCount}, ranges{new TileRange[threadCount]} {}
+
+uint32_t CpuRenderer::threadCount() const { return jobs.workerCount(); }
+
+uint32_t CpuRenderer::packetWidth() { return packet::width; }
+
+void CpuRenderer::render(const Quality &quality, const float &iTime,
+                         const uint32_t &width, const uint32_t &height,
+                         uint8_t *rgba) {
+  const QualityConstants &constants = qualityConstants(quality);
+  Scene scene{
+      .time = iTime * 0.25f,
+      .maxSteps = constants.maxSteps,
+      .eps = constants.eps,
+      .far = constants.far,
+      .reflections = constants.reflections != VK_FALSE,
+  };
+  const uint32_t tilesX = (width + tileWidth - 1) / tileWidth;
+  const uint32_t tilesY = (height + tileHeight - 1) / tileHeight;
+  const uint32_t tileCount = tilesX * tilesY;
+  const uint32_t workers = threadCount();
+  // Submitting the jobs publishes the ranges to the workers
+  for (uint32_t w = 0; w < workers; w++) {
+    ranges[w].next.store(tileCount * w / workers, std::memory_order_relaxed);
+    ranges[w].end = tileCount * (w + 1) / workers;
+  }
+  for (uint32_t w = 0; w < workers; w++) {
+    jobs.submit([=, this, &scene]() {
+      // Own range first, then steal from the ranges after it
+      for (uint32_t i = 0; i < workers; i++) {
+        TileRange &range = ranges[(w + i) % workers];
+        while (true) {
+          uint32_t tile =
+              range.next.fetch_add(1, std::memory_order_relaxed);
+          if (tile >= range.end)
+            break;
+          renderTile(scene, (tile % tilesX) * tileWidth,
+                     (tile / tilesX) * tileHeight, width, height, rgba);
+        }
+      }
+    });
+  }
+  jobs.wait();
+}
@@ -0,0 +1,44 @@
+/**
+ * CPU port of planet.frag (map, distort, trace, calcNormal and the shading)
+ * that renders without any Vulkan device. Rays are traced in packets of
+ * packet::width with per lane masks for the ones that are done, and the
+ * image is split into tiles spread over a thread pool with work stealing.
+ * The result is encoded like the R8G8B8A8_SRGB headless target, so it can
+ * be checked against the GPU's golden images, and the frame time is a
+ * baseline that scales with the core count.
+ **/
+#pragma once
+#include "../jobs/jobs.h"
+#include "../quality/quality.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+class CpuRenderer {
+public:
+  // A tile is a few packets wide so rays next to each other share a core
+  static constexpr uint32_t tileWidth = 32;
+  static constexpr uint32_t tileHeight = 8;
+
+private:
+  // Every worker starts on its own range of tiles. Tiles are taken from the
+  // front with one atomic add, by the owner and, once their own range is
+  // empty, by the other workers, so no locks are needed.
+  struct alignas(64) TileRange {
+    std::atomic<uint32_t> next;
+    uint32_t end;
+  };
+
+  JobSystem jobs;
+  std::unique_ptr<TileRange[]> ranges;
+
+public:
+  explicit CpuRenderer(const uint32_t &threadCount);
+  uint32_t threadCount() const;
+  // Rays per packet of this build
+  static uint32_t packetWidth();
+  // Renders one frame at iTime into rgba, width * height RGBA8 pixels.
+  // The start distance prepass and checkerboard rendering do not apply.
+  void render(const Quality &quality, const float &iTime,
+              const uint32_t &width, const uint32_t &height, uint8_t *rgba);
+};
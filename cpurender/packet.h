@@ -0,0 +1,207 @@
+/**
+ * One float per ray of a packet for the CPU reference renderer: 8 lanes
+ * with AVX2, 4 with SSE2 and a single lane elsewhere. Only the operations
+ * planet.glsl needs, everything past the backend specific primitives is
+ * written once on top of them.
+ **/
+#pragma once
+#include <cmath>
+#include <cstdint>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace packet {
+
+#if defined(__AVX2__)
+
+constexpr uint32_t width = 8;
+
+struct Floats {
+  __m256 v;
+  Floats() = default;
+  Floats(const __m256 &v) : v{v} {}
+  Floats(const float &s) : v{_mm256_set1_ps(s)} {}
+};
+
+// All bits set in the lanes where the condition holds
+struct Mask {
+  __m256 v;
+};
+
+inline Floats load(const float *p) { return _mm256_loadu_ps(p); }
+inline void store(float *p, const Floats &a) { _mm256_storeu_ps(p, a.v); }
+inline Floats operator+(const Floats &a, const Floats &b) {
+  return _mm256_add_ps(a.v, b.v);
+}
+inline Floats operator-(const Floats &a, const Floats &b) {
+  return _mm256_sub_ps(a.v, b.v);
+}
+inline Floats operator*(const Floats &a, const Floats &b) {
+  return _mm256_mul_ps(a.v, b.v);
+}
+inline Floats operator/(const Floats &a, const Floats &b) {
+  return _mm256_div_ps(a.v, b.v);
+}
+inline Floats min(const Floats &a, const Floats &b) {
+  return _mm256_min_ps(a.v, b.v);
+}
+inline Floats max(const Floats &a, const Floats &b) {
+  return _mm256_max_ps(a.v, b.v);
+}
+inline Floats sqrt(const Floats &a) { return _mm256_sqrt_ps(a.v); }
+inline Floats floor(const Floats &a) { return _mm256_floor_ps(a.v); }
+inline Mask operator<(const Floats &a, const Floats &b) {
+  return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)};
+}
+inline Mask operator>(const Floats &a, const Floats &b) {
+  return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)};
+}
+inline Mask operator&(const Mask &a, const Mask &b) {
+  return {_mm256_and_ps(a.v, b.v)};
+}
+inline Mask operator|(const Mask &a, const Mask &b) {
+  return {_mm256_or_ps(a.v, b.v)};
+}
+inline Mask operator!(const Mask &a) {
+  return {_mm256_xor_ps(a.v, _mm256_castsi256_ps(_mm256_set1_epi32(-1)))};
+}
+inline bool any(const Mask &m) { return _mm256_movemask_ps(m.v) != 0; }
+// a in the lanes of m, b in the others
+inline Floats select(const Mask &m, const Floats &a, const Floats &b) {
+  return _mm256_blendv_ps(b.v, a.v, m.v);
+}
+
+#elif defined(__SSE2__)
+
+constexpr uint32_t width = 4;
+
+struct Floats {
+  __m128 v;
+  Floats() = default;
+  Floats(const __m128 &v) : v{v} {}
+  Floats(const float &s) : v{_mm_set1_ps(s)} {}
+};
+
+// All bits set in the lanes where the condition holds
+struct Mask {
+  __m128 v;
+};
+
+inline Floats load(const float *p) { return _mm_loadu_ps(p); }
+inline void store(float *p, const Floats &a) { _mm_storeu_ps(p, a.v); }
+inline Floats operator+(const Floats &a, const Floats &b) {
+  return _mm_add_ps(a.v, b.v);
+}
+inline Floats operator-(const Floats &a, const Floats &b) {
+  return _mm_sub_ps(a.v, b.v);
+}
+inline Floats operator*(const Floats &a, const Floats &b) {
+  return _mm_mul_ps(a.v, b.v);
+}
+inline Floats operator/(const Floats &a, const Floats &b) {
+  return _mm_div_ps(a.v, b.v);
+}
+inline Floats min(const Floats &a, const Floats &b) {
+  return _mm_min_ps(a.v, b.v);
+}
+inline Floats max(const Floats &a, const Floats &b) {
+  return _mm_max_ps(a.v, b.v);
+}
+inline Floats sqrt(const Floats &a) { return _mm_sqrt_ps(a.v); }
+// SSE2 has no floor, truncate and step down where that rounded up. Only
+// valid within the int32 range, far beyond anything the scene produces.
+inline Floats floor(const Floats &a) {
+  __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+  __m128 roundedUp = _mm_cmpgt_ps(truncated, a.v);
+  return _mm_sub_ps(truncated, _mm_and_ps(roundedUp, _mm_set1_ps(1.0f)));
+}
+inline Mask operator<(const Floats &a, const Floats &b) {
+  return {_mm_cmplt_ps(a.v, b.v)};
+}
+inline Mask operator>(const Floats &a, const Floats &b) {
+  return {_mm_cmpgt_ps(a.v, b.v)};
+}
+inline Mask operator&(const Mask &a, const Mask &b) {
+  return {_mm_and_ps(a.v, b.v)};
+}
+inline Mask operator|(const Mask &a, const Mask &b) {
+  return {_mm_or_ps(a.v, b.v)};
+}
+inline Mask operator!(const Mask &a) {
+  return {_mm_xor_ps(a.v, _mm_castsi128_ps(_mm_set1_epi32(-1)))};
+}
+inline bool any(const Mask &m) { return _mm_movemask_ps(m.v) != 0; }
+// a in the lanes of m, b in the others
+inline Floats select(const Mask &m, const Floats &a, const Floats &b) {
+  return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v));
+}
+
+#else
+
+constexpr uint32_t width = 1;
+
+struct Floats {
+  float v;
+  Floats() = default;
+  Floats(const float &v) : v{v} {}
+};
+
+struct Mask {
+  bool v;
+};
+
+inline Floats load(const float *p) { return *p; }
+inline void store(float *p, const Floats &a) { *p = a.v; }
+inline Floats operator+(const Floats &a, const Floats &b) { return a.v + b.v; }
+inline Floats operator-(const Floats &a, const Floats &b) { return a.v - b.v; }
+inline Floats operator*(const Floats &a, const Floats &b) { return a.v * b.v; }
+inline Floats operator/(const Floats &a, const Floats &b) { return a.v / b.v; }
+inline Floats min(const Floats &a, const Floats &b) {
+  return b.v < a.v ? b.v : a.v;
+}
+inline Floats max(const Floats &a, const Floats &b) {
+  return a.v < b.v ? b.v : a.v;
+}
+inline Floats sqrt(const Floats &a) { return std::sqrt(a.v); }
+inline Floats floor(const Floats &a) { return std::floor(a.v); }
+inline Mask operator<(const Floats &a, const Floats &b) { return {a.v < b.v}; }
+inline Mask operator>(const Floats &a, const Floats &b) { return {a.v > b.v}; }
+inline Mask operator&(const Mask &a, const Mask &b) { return {a.v && b.v}; }
+inline Mask operator|(const Mask &a, const Mask &b) { return {a.v || b.v}; }
+inline Mask operator!(const Mask &a) { return {!a.v}; }
+inline bool any(const Mask &m) { return m.v; }
+inline Floats select(const Mask &m, const Floats &a, const Floats &b) {
+  return m.v ? a : b;
+}
+
+#endif
+
+inline Floats operator-(const Floats &a) { return Floats(0.0f) - a; }
+inline Floats abs(const Floats &a) { return max(a, -a); }
+
+// Every lane set
+inline Mask allLanes() { return Floats(0.0f) < Floats(1.0f); }
+
+// sin to about 1e-7 for the arguments the scene produces: reduced to
+// [-pi, pi], folded into [-pi/2, pi/2] and a degree 11 Taylor polynomial
+inline Floats sin(const Floats &x) {
+  constexpr float twoPi = 6.28318530717958647692f;
+  constexpr float pi = 3.14159265358979323846f;
+  constexpr float halfPi = 1.57079632679489661923f;
+  Floats turns = floor(x * (1.0f / twoPi) + 0.5f);
+  Floats r = x - turns * twoPi;
+  r = select(r > halfPi, Floats(pi) - r, r);
+  r = select(r < -halfPi, Floats(-pi) - r, r);
+  Floats r2 = r * r;
+  Floats poly = Floats(-1.0f / 39916800.0f);
+  poly = poly * r2 + 1.0f / 362880.0f;
+  poly = poly * r2 - 1.0f / 5040.0f;
+  poly = poly * r2 + 1.0f / 120.0f;
+  poly = poly * r2 - 1.0f / 6.0f;
+  return r + r * r2 * poly;
+}
+
+} // namespace packet
@@ -0,0 +1,20 @@
+#include "deletionqueue.h"
+
+void DeletionQueue::push(int64_t lastFrame, std::function<void()> destroy) {
+  entries.push_back({lastFrame, std::move(destroy)});
+}
+
+void DeletionQueue::flush(int64_t completedFrame) {
+  // Entries are pushed in frame order so only the front needs checking
+  while (!entries.empty() && entries.front().lastFrame <= completedFrame) {
+    entries.front().destroy();
+    entries.pop_front();
+  }
+}
+
+void DeletionQueue::flushAll() {
+  for (auto &entry : entries) {
+    entry.destroy();
+  }
+  entries.clear();
+}
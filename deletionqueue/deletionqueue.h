@@ -0,0 +1,25 @@
+/**
+ * Defers destruction of Vulkan objects until the GPU has finished the
+ * frames that still reference them, so nothing needs vkDeviceWaitIdle
+ **/
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+class DeletionQueue {
+private:
+  struct Entry {
+    // Last frame that may still use the object
+    int64_t lastFrame;
+    std::function<void()> destroy;
+  };
+  std::deque<Entry> entries;
+
+public:
+  void push(int64_t lastFrame, std::function<void()> destroy);
+  // Destroys everything whose last frame has completed on the GPU
+  void flush(int64_t completedFrame);
+  // Only call once the device is idle
+  void flushAll();
+};
@@ -0,0 +1,65 @@
+#include "dynres.h"
+#include <algorithm>
+#include <cmath>
+#include <spdlog/spdlog.h>
+
+namespace {
+// Weight of the newest sample in the moving average
+constexpr double smoothing = 0.1;
+// Timestamps lag a few frames behind and the average needs time to settle
+// on the new scale, so wait this many samples between changes
+constexpr uint32_t settleSamples = 16;
+// Only scale back up once there is this much headroom, avoids oscillating
+// around the budget
+constexpr double headroom = 0.85;
+// Largest change per step, a sudden jump is more visible than a slow drift
+constexpr float maxStep = 0.1f;
+} // namespace
+
+ResolutionController::ResolutionController(const double &targetMs,
+                                           const float &minScale,
+                                           const float &maxScale)
+    : targetMs{targetMs}, minScale{minScale}, maxScale{maxScale},
+      currentScale{maxScale} {}
+
+bool ResolutionController::enabled() const { return targetMs > 0.0; }
+
+bool ResolutionController::update(const double &gpuMs) {
+  if (!enabled())
+    return false;
+
+  smoothedMs =
+      samples == 0 ? gpuMs : smoothedMs + smoothing * (gpuMs - smoothedMs);
+  samples++;
+  if (samples < settleSamples)
+    return false;
+  if (smoothedMs <= targetMs && smoothedMs >= headroom * targetMs)
+    return false;
+
+  // Cost is roughly proportional to the pixel count, ie. scale squared
+  float ideal =
+      currentScale * static_cast<float>(std::sqrt(targetMs / smoothedMs));
+  float next =
+      std::clamp(ideal, currentScale - maxStep, currentScale + maxStep);
+  // Rounded to a 1/32 grid so the render size does not change every time
+  next = std::clamp(std::round(next * 32.0f) / 32.0f, minScale, maxScale);
+  if (next == currentScale)
+    return false;
+
+  spdlog::info("Render scale {:.3f} -> {:.3f} (GPU {:.3f}ms, budget {:.3f}ms)",
+               currentScale, next, smoothedMs, targetMs);
+  currentScale = next;
+  samples = 0;
+  return true;
+}
+
+float ResolutionController::scale() const { return currentScale; }
+
+VkExtent2D ResolutionController::apply(const VkExtent2D &extent) const {
+  return VkExtent2D{
+      .width = std::max(
+          1u, static_cast<uint32_t>(std::lround(extent.width * currentScale))),
+      .height = std::max(
+          1u, static_cast<uint32_t>(std::lround(extent.height * currentScale))),
+  };
+}
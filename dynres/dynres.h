@@ -0,0 +1,31 @@
+/**
+ * Dynamic resolution: picks the fraction of the window the scene is rendered
+ * at from measured GPU frame time, so large windows stay inside a budget.
+ * The scene is upscaled to the swapchain afterwards.
+ **/
+#pragma once
+#include <cstdint>
+#include <vulkan/vulkan.h>
+
+class ResolutionController {
+private:
+  double targetMs;
+  float minScale;
+  float maxScale;
+  float currentScale;
+  // Exponential moving average of the GPU time at the current scale
+  double smoothedMs = 0.0;
+  uint32_t samples = 0;
+
+public:
+  // targetMs <= 0 disables the controller, the scale stays at maxScale
+  ResolutionController(const double &targetMs, const float &minScale,
+                       const float &maxScale);
+  bool enabled() const;
+  // Feed the GPU time of one frame, returns true when the scale changed
+  bool update(const double &gpuMs);
+  // Fraction of the window width/height that is rendered
+  float scale() const;
+  // Scaled extent, at least 1x1
+  VkExtent2D apply(const VkExtent2D &extent) const;
+};
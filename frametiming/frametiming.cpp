@@ -0,0 +1,92 @@
+#include "frametiming.h"
+#include <algorithm>
+#include <cmath>
+#include <spdlog/spdlog.h>
+
+RollingStats::RollingStats(size_t window) : samples(window), scratch(window) {}
+
+void RollingStats::push(const double &sample) {
+  samples[next] = sample;
+  next = (next + 1) % samples.size();
+  count = std::min(count + 1, samples.size());
+}
+
+StatsSummary RollingStats::summary() const {
+  StatsSummary summary{0.0, 0.0, 0.0, 0.0, 0.0, 0.0, count};
+  if (count == 0)
+    return summary;
+
+  // Before the ring wraps only the first count samples are valid
+  std::copy(samples.begin(), samples.begin() + count, scratch.begin());
+  auto first = scratch.begin();
+  auto last = scratch.begin() + count;
+
+  double sum = 0.0;
+  for (auto it = first; it != last; ++it)
+    sum += *it;
+  summary.avg = sum / count;
+  summary.min = *std::min_element(first, last);
+  double squares = 0.0;
+  for (auto it = first; it != last; ++it)
+    squares += (*it - summary.avg) * (*it - summary.avg);
+  summary.stddev = std::sqrt(squares / count);
+
+  auto percentile = [&](double p) {
+    auto nth = first + static_cast<size_t>(std::ceil(p * count)) - 1;
+    std::nth_element(first, nth, last);
+    return *nth;
+  };
+  summary.median = percentile(0.5);
+  summary.p95 = percentile(0.95);
+  summary.p99 = percentile(0.99);
+  return summary;
+}
+
+std::string formatStats(const StatsSummary &summary) {
+  return fmt::format("min {:.3f} avg {:.3f} p95 {:.3f} p99 {:.3f}ms",
+                     summary.min, summary.avg, summary.p95, summary.p99);
+}
+
+TimestampReadback::TimestampReadback(
+    const VkDevice &device, const VkQueryPool &queryPool,
+    const VkPhysicalDeviceProperties &deviceProperties,
+    const uint32_t &slotCount)
+    : device{device}, queryPool{queryPool},
+      timestampPeriodMs{deviceProperties.limits.timestampPeriod * 1e-6},
+      pending(slotCount, false) {}
+
+void TimestampReadback::begin(const VkCommandBuffer &commandBuffer,
+                              const uint32_t &slot) {
+  vkCmdResetQueryPool(commandBuffer, queryPool, slot * 2, 2);
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      queryPool, slot * 2);
+}
+
+void TimestampReadback::end(const VkCommandBuffer &commandBuffer,
+                            const uint32_t &slot) {
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      queryPool, slot * 2 + 1);
+  pending[slot] = true;
+}
+
+void TimestampReadback::resubmit(const uint32_t &slot) {
+  pending[slot] = true;
+}
+
+std::optional<double> TimestampReadback::collect(const uint32_t &slot) {
+  if (!pending[slot])
+    return std::nullopt;
+  // Pairs of (timestamp, availability)
+  uint64_t results[4] = {};
+  VkResult result = vkGetQueryPoolResults(
+      device, queryPool, slot * 2, 2, sizeof(results), results,
+      sizeof(uint64_t) * 2,
+      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+  // Either way the slot is about to be reset, a late result is dropped
+  pending[slot] = false;
+  if ((result != VK_SUCCESS && result != VK_NOT_READY) || results[1] == 0 ||
+      results[3] == 0) {
+    return std::nullopt;
+  }
+  return (results[2] - results[0]) * timestampPeriodMs;
+}
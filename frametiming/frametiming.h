@@ -0,0 +1,63 @@
+/**
+ * Frame time measurement that never stalls the CPU on the GPU.
+ * Timestamp queries are read back N frames after they were written, once
+ * the GPU reports them available, and fed into rolling statistics.
+ **/
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+struct StatsSummary {
+  double min;
+  double avg;
+  double median;
+  double p95;
+  double p99;
+  // Population standard deviation
+  double stddev;
+  size_t count;
+};
+
+// Keeps the last window samples in a ring
+class RollingStats {
+private:
+  std::vector<double> samples;
+  // Preallocated so summary() does not allocate every frame
+  mutable std::vector<double> scratch;
+  size_t next = 0;
+  size_t count = 0;
+
+public:
+  explicit RollingStats(size_t window);
+  void push(const double &sample);
+  StatsSummary summary() const;
+};
+
+// "min 1.000 avg 1.000 p95 1.000 p99 1.000ms"
+std::string formatStats(const StatsSummary &summary);
+
+// One begin/end timestamp pair per slot of a query pool
+class TimestampReadback {
+private:
+  VkDevice device;
+  VkQueryPool queryPool;
+  double timestampPeriodMs;
+  // Slot was written and its result has not been read back yet
+  std::vector<bool> pending;
+
+public:
+  TimestampReadback(const VkDevice &device, const VkQueryPool &queryPool,
+                    const VkPhysicalDeviceProperties &deviceProperties,
+                    const uint32_t &slotCount);
+  void begin(const VkCommandBuffer &commandBuffer, const uint32_t &slot);
+  void end(const VkCommandBuffer &commandBuffer, const uint32_t &slot);
+  // For command buffers recorded with begin() / end() once and submitted
+  // again, marks slot as written by this submission
+  void resubmit(const uint32_t &slot);
+  // GPU time in ms of the work last recorded in slot, if the GPU has
+  // finished it. Never waits, call before the slot is recorded again.
+  std::optional<double> collect(const uint32_t &slot);
+};
@@ -0,0 +1,256 @@
+#include "framewriter.h"
+#include "../trace/trace.h"
+#include "../vkcommon/vkcommon.h"
+#include <algorithm>
+#include <cmath>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <tuple>
+
+const char *frameFormatName(const FrameFormat &format) {
+  switch (format) {
+  case FrameFormat::Raw:
+    return "raw";
+  case FrameFormat::Y4m:
+    return "y4m";
+  case FrameFormat::Ppm:
+    return "ppm";
+  }
+  return "unknown";
+}
+
+FrameFormat frameFormatFromPath(const std::string &path) {
+  auto endsWith = [&](const std::string &suffix) {
+    return path.size() >= suffix.size() &&
+           path.compare(path.size() - suffix.size(), suffix.size(), suffix) ==
+               0;
+  };
+  if (endsWith(".y4m"))
+    return FrameFormat::Y4m;
+  if (endsWith(".ppm"))
+    return FrameFormat::Ppm;
+  return FrameFormat::Raw;
+}
+
+FrameWriter::FrameWriter(const VkPhysicalDevice &physicalDevice,
+                         const VkDevice &device, const std::string &path,
+                         const FrameFormat &format, const VkExtent2D &extent,
+                         const double &timeStep,
+                         const uint32_t &ringSize, Inspector inspector)
+    : device{device}, extent{extent}, format{format},
+      inspector{std::move(inspector)} {
+  if (!path.empty()) {
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+      throw std::runtime_error(fmt::format("Failed to open {}", path));
+  }
+  if (writing() && format == FrameFormat::Y4m) {
+    // The rate is a ratio, frames per 10^6 s keeps steps like 1/29.97 exact
+    // to the microsecond
+    long long frameUs = std::max(1LL, std::llround(timeStep * 1e6));
+    file << fmt::format("YUV4MPEG2 W{} H{} F1000000:{} Ip A1:1 C444\n",
+                        extent.width, extent.height, frameUs);
+  }
+
+  VkDeviceSize frameSize = VkDeviceSize{extent.width} * extent.height * 4;
+  ring.resize(ringSize);
+  for (uint32_t i = 0; i < ringSize; i++) {
+    Staging &staging = ring[i];
+    VkBufferCreateInfo bufferCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = frameSize,
+        .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VK_CHECK(vkCreateBuffer(device, &bufferCreateInfo, nullptr,
+                            &staging.buffer));
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device, staging.buffer, &requirements);
+    // The CPU reads every byte back, cached memory makes that a lot faster
+    uint32_t typeIndex = findMemoryType(physicalDevice,
+                                        requirements.memoryTypeBits,
+                                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                                        VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+    // Non coherent memory is invalidated before every read
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+    coherent = (memoryProperties.memoryTypes[typeIndex].propertyFlags &
+                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+    VkMemoryAllocateInfo allocateInfo{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = requirements.size,
+        .memoryTypeIndex = typeIndex,
+    };
+    VK_CHECK(vkAllocateMemory(device, &allocateInfo, nullptr, &staging.memory));
+    VK_CHECK(vkBindBufferMemory(device, staging.buffer, staging.memory, 0));
+    void *mapped;
+    VK_CHECK(vkMapMemory(device, staging.memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+    staging.mapped = static_cast<const uint8_t *>(mapped);
+    available.push_back(i);
+  }
+  if (writing()) {
+    spdlog::info("Writing {} frames to {}, {} staging buffers ({:.1f}MB)",
+                 frameFormatName(format), path, ringSize,
+                 frameSize * ringSize / (1024.0 * 1024.0));
+  }
+  writer = std::thread([this]() { run(); });
+}
+
+FrameWriter::~FrameWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  changed.notify_all();
+  if (writer.joinable())
+    writer.join();
+}
+
+uint32_t FrameWriter::acquire() {
+  TRACE_SCOPE("FrameWriter::acquire");
+  std::unique_lock<std::mutex> lock(mutex);
+  changed.wait(lock, [this]() { return !available.empty() || failed; });
+  if (failed)
+    throw std::runtime_error("Writing frames failed");
+  uint32_t index = available.front();
+  available.pop_front();
+  return index;
+}
+
+VkBuffer FrameWriter::buffer(const uint32_t &index) const {
+  return ring[index].buffer;
+}
+
+void FrameWriter::submit(const uint32_t &index, const uint32_t &frame) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queued.emplace_back(index, frame);
+  }
+  changed.notify_all();
+}
+
+void FrameWriter::finish() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  changed.notify_all();
+  if (writer.joinable())
+    writer.join();
+  if (writing())
+    file.flush();
+  if (failed || (writing() && !file))
+    throw std::runtime_error("Writing frames failed");
+}
+
+uint64_t FrameWriter::framesWritten() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return written;
+}
+
+void FrameWriter::run() {
+  while (true) {
+    uint32_t index;
+    uint32_t frame;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      // Drains the queue before stopping so finish() loses no frames
+      changed.wait(lock, [this]() { return !queued.empty() || stopping; });
+      if (queued.empty() || failed)
+        return;
+      std::tie(index, frame) = queued.front();
+      queued.pop_front();
+    }
+
+    const Staging &staging = ring[index];
+    if (!coherent) {
+      VkMappedMemoryRange range{
+          .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+          .memory = staging.memory,
+          .offset = 0,
+          .size = VK_WHOLE_SIZE,
+      };
+      // Throwing here would terminate, acquire() and finish() report it
+      VkResult result = vkInvalidateMappedMemoryRanges(device, 1, &range);
+      if (result != VK_SUCCESS) {
+        spdlog::error("vkInvalidateMappedMemoryRanges failed: {}",
+                      static_cast<int>(result));
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          failed = true;
+        }
+        changed.notify_all();
+        return;
+      }
+    }
+    if (inspector)
+      inspector(frame, staging.mapped);
+    if (writing())
+      write(staging);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      available.push_back(index);
+      written++;
+      if (writing() && !file) {
+        spdlog::error("Writing frame {} failed", written);
+        failed = true;
+      }
+    }
+    changed.notify_all();
+  }
+}
+
+bool FrameWriter::writing() const { return file.is_open(); }
+
+void FrameWriter::write(const Staging &staging) {
+  TRACE_SCOPE("FrameWriter::write");
+  const size_t pixels = size_t{extent.width} * extent.height;
+  const uint8_t *rgba = staging.mapped;
+  switch (format) {
+  case FrameFormat::Raw:
+    file.write(reinterpret_cast<const char *>(rgba), pixels * 4);
+    break;
+  case FrameFormat::Ppm: {
+    scratch.resize(pixels * 3);
+    for (size_t i = 0; i < pixels; i++) {
+      scratch[i * 3 + 0] = rgba[i * 4 + 0];
+      scratch[i * 3 + 1] = rgba[i * 4 + 1];
+      scratch[i * 3 + 2] = rgba[i * 4 + 2];
+    }
+    file << fmt::format("P6\n{} {}\n255\n", extent.width, extent.height);
+    file.write(reinterpret_cast<const char *>(scratch.data()), scratch.size());
+    break;
+  }
+  case FrameFormat::Y4m: {
+    // BT.601 limited range from the sRGB encoded values, planar Y, U, V
+    scratch.resize(pixels * 3);
+    uint8_t *y = scratch.data();
+    uint8_t *u = y + pixels;
+    uint8_t *v = u + pixels;
+    for (size_t i = 0; i < pixels; i++) {
+      int r = rgba[i * 4 + 0];
+      int g = rgba[i * 4 + 1];
+      int b = rgba[i * 4 + 2];
+      y[i] = static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) +
+                                  16);
+      u[i] = static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) +
+                                  128);
+      v[i] = static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) +
+                                  128);
+    }
+    file << "FRAME\n";
+    file.write(reinterpret_cast<const char *>(scratch.data()), scratch.size());
+    break;
+  }
+  }
+}
+
+void FrameWriter::destroy() {
+  for (auto &staging : ring) {
+    vkUnmapMemory(device, staging.memory);
+    vkDestroyBuffer(device, staging.buffer, nullptr);
+    vkFreeMemory(device, staging.memory, nullptr);
+  }
+  ring.clear();
+}
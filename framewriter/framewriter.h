@@ -0,0 +1,99 @@
+/**
+ * Streams rendered frames to a file without the render loop waiting for
+ * the disk. The GPU copies every frame into one of a ring of persistently
+ * mapped host visible staging buffers. The render loop hands the buffer to
+ * the writer thread once the fence of that frame has signaled, and the
+ * writer returns it to the ring after writing. Memory stays bounded by the
+ * ring size. Frames can also be passed to an inspector on the writer thread,
+ * eg. to compare them against golden images.
+ **/
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+enum class FrameFormat {
+  // RGBA8 frames back to back
+  Raw,
+  // YUV4MPEG2 4:4:4, plays in ffplay / mpv and imports into ffmpeg
+  Y4m,
+  // Binary PPM (P6) images back to back, eg. ffmpeg -f image2pipe
+  Ppm,
+};
+
+const char *frameFormatName(const FrameFormat &format);
+// From the file extension, raw for anything unknown
+FrameFormat frameFormatFromPath(const std::string &path);
+
+class FrameWriter {
+public:
+  // Called on the writer thread with every frame's RGBA8 pixels
+  using Inspector =
+      std::function<void(const uint32_t &frame, const uint8_t *rgba)>;
+
+private:
+  struct Staging {
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    const uint8_t *mapped;
+  };
+
+  VkDevice device;
+  VkExtent2D extent;
+  FrameFormat format;
+  // Needs vkInvalidateMappedMemoryRanges before reading
+  bool coherent;
+  // Not open when there is no path, frames are only inspected
+  std::ofstream file;
+  Inspector inspector;
+  std::vector<Staging> ring;
+  std::mutex mutex;
+  // Signaled when a buffer is queued, freed or the writer should stop
+  std::condition_variable changed;
+  // Indices into ring, the GPU is done with every queued buffer
+  std::deque<uint32_t> available;
+  // Ring index and frame number
+  std::deque<std::pair<uint32_t, uint32_t>> queued;
+  bool stopping = false;
+  bool failed = false;
+  uint64_t written = 0;
+  // Planes or RGB rows, reused between frames
+  std::vector<uint8_t> scratch;
+  std::thread writer;
+
+  void run();
+  void write(const Staging &staging);
+  bool writing() const;
+
+public:
+  // ringSize buffers of extent RGBA8 pixels, at least the frames in
+  // flight plus the frames the writer may fall behind by. An empty path
+  // writes nothing and only runs inspector. timeStep is the seconds per
+  // frame, y4m files get its inverse as their frame rate.
+  FrameWriter(const VkPhysicalDevice &physicalDevice, const VkDevice &device,
+              const std::string &path, const FrameFormat &format,
+              const VkExtent2D &extent, const double &timeStep,
+              const uint32_t &ringSize, Inspector inspector = {});
+  ~FrameWriter();
+  // A free staging buffer to copy the next frame into. Only blocks while
+  // every buffer is queued, ie. the disk is the bottleneck.
+  uint32_t acquire();
+  VkBuffer buffer(const uint32_t &index) const;
+  // Queues a buffer holding frame for writing, the GPU has to have finished
+  // the copy. Frames are written in the order they are submitted.
+  void submit(const uint32_t &index, const uint32_t &frame);
+  // Writes everything queued and joins the writer. Throws if writing
+  // failed.
+  void finish();
+  uint64_t framesWritten();
+  // Only call once the device is idle and after finish()
+  void destroy();
+};
@@ -1,10 +1,19 @@
 #include "fwatcher.h"
 #include <boost/filesystem.hpp>
+#include <boost/functional/hash.hpp>
+#include <cerrno>
 #include <fstream>
 #include <map>
+#include <set>
 #include <spdlog/spdlog.h>
 #include <thread>
 #include <unordered_map>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 
 namespace fs = boost ::filesystem;
 
@@ -24,25 +33,45 @@ struct PathHash {
 
 std::unordered_map<fs::path, std::time_t, PathHash> lastWriteMap;
 
-void processFile(const fs::path &path) {
+bool isShaderStage(const fs::path &path) {
   std::string ext = path.extension().string();
-  spdlog::debug("Processing file {}\n", path.string());
-  spdlog::debug("File ext: {}\n", ext);
-
-  fs::path spvPath = path;
-  spvPath.replace_extension(".spv");
+  return ext == ".frag" || ext == ".vert" || ext == ".geom" || ext == ".comp";
+}
 
-  std::string command = fmt::format("glslangValidator -V {} -o {}",
-                                    path.string(), spvPath.string());
+// Shared code #included by the stages, never compiled on its own
+bool isShaderInclude(const fs::path &path) {
+  return path.extension() == ".glsl";
+}
 
-  int result = system(command.c_str());
-  spdlog::debug("Result: {}\n", result);
+bool isShaderSource(const fs::path &path) {
+  return isShaderStage(path) || isShaderInclude(path);
 }
 
-bool checkChanges(const fs::path &path) {
+bool processFile(ShaderCompiler &compiler, const fs::path &path) {
+  if (isShaderInclude(path)) {
+    // Any stage next to it may include it
+    bool allCompiled = true;
+    for (const auto &entry : fs::directory_iterator(path.parent_path())) {
+      if (isShaderStage(entry.path()))
+        allCompiled &= processFile(compiler, entry.path());
+    }
+    return allCompiled;
+  }
   std::string ext = path.extension().string();
+  spdlog::debug("Processing file {}\n", path.string());
+  spdlog::debug("File ext: {}\n", ext);
+
+  ShaderCompileResult result = compiler.compile(path.string());
+  spdlog::debug("Result: {}\n", result.success);
+  if (!result.success) {
+    spdlog::error("Failed to compile {}", path.string());
+    return false;
+  }
+  return true;
+}
 
-  if (!(ext == ".frag" || ext == ".vert" || ext == ".geom")) {
+bool checkChanges(ShaderCompiler &compiler, const fs::path &path) {
+  if (!isShaderSource(path)) {
     return false;
   }
   std::time_t lastWriteTime = fs::last_write_time(path);
@@ -52,18 +81,17 @@ bool checkChanges(const fs::path &path) {
   auto it = lastWriteMap.find(path);
   if (it == lastWriteMap.end() || it->second != lastWriteTime) {
     spdlog::debug("File {} changed\n", path.string());
-    processFile(path);
     lastWriteMap[path] = lastWriteTime;
-    return true;
+    return processFile(compiler, path);
   }
   return false;
 }
 
-bool watchChanges(const fs::path &path) {
+bool watchChanges(ShaderCompiler &compiler, const fs::path &path) {
   bool changesDetected = false;
   if (fs::is_directory(path)) {
     for (const auto &entry : fs::directory_iterator(path)) {
-      changesDetected |= checkChanges(entry.path());
+      changesDetected |= checkChanges(compiler, entry.path());
     }
   }
   return changesDetected;
@@ -71,17 +99,129 @@ bool watchChanges(const fs::path &path) {
 
 FWatcher::FWatcher(std::string pathToWatch,
                    std::chrono::duration<int, std::milli> interval,
-                   std::function<void()> callback)
-    : pathToWatch{pathToWatch}, interval{interval}, callback{callback} {}
+                   ShaderCompiler &compiler, std::function<void()> callback)
+    : pathToWatch{pathToWatch}, interval{interval}, compiler{compiler},
+      callback{callback} {}
+
+FWatcher::~FWatcher() { stop(); }
 
 void FWatcher::start() {
   spdlog::debug("Watching files in {}", pathToWatch);
+  running = true;
+  thread = std::thread([this]() {
+    if (!inotifyLoop())
+      pollLoop();
+  });
+}
+
+void FWatcher::stop() {
+  running = false;
+  condition.notify_one();
+#ifdef __linux__
+  if (wakeFd != -1) {
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof(one)) < 0)
+      spdlog::warn("Failed to wake the file watcher");
+  }
+#endif
+  if (thread.joinable())
+    thread.join();
+#ifdef __linux__
+  if (wakeFd != -1) {
+    close(wakeFd);
+    wakeFd = -1;
+  }
+#endif
+}
 
-  std::thread([this]() {
-    while (true) {
-      std::this_thread::sleep_for(interval);
-      if (watchChanges(fs::path{pathToWatch}))
+void FWatcher::pollLoop() {
+  spdlog::info("Polling {} every {}ms", pathToWatch, interval.count());
+  std::unique_lock<std::mutex> lock(mutex);
+  while (running) {
+    condition.wait_for(lock, interval, [this]() { return !running; });
+    if (!running)
+      break;
+    if (watchChanges(compiler, fs::path{pathToWatch}))
+      callback();
+  }
+}
+
+#ifdef __linux__
+
+bool FWatcher::inotifyLoop() {
+  // Editors save in bursts (write temp, rename over, chmod...) so wait for
+  // the directory to be quiet this long before compiling
+  static constexpr int debounceMs = 30;
+
+  int inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotifyFd == -1) {
+    spdlog::warn("inotify unavailable, falling back to polling");
+    return false;
+  }
+  // IN_MOVED_TO catches write-temp-then-rename saves
+  if (inotify_add_watch(inotifyFd, pathToWatch.c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+    spdlog::warn("Failed to watch {}, falling back to polling", pathToWatch);
+    close(inotifyFd);
+    return false;
+  }
+  wakeFd = eventfd(0, EFD_CLOEXEC);
+  if (wakeFd == -1) {
+    close(inotifyFd);
+    return false;
+  }
+  spdlog::info("Watching {} with inotify", pathToWatch);
+
+  std::set<std::string> pending;
+  alignas(inotify_event) char buffer[4096];
+  while (running) {
+    pollfd fds[2] = {
+        {.fd = inotifyFd, .events = POLLIN},
+        {.fd = wakeFd, .events = POLLIN},
+    };
+    // Block until something happens, then keep draining until quiet
+    int ready = poll(fds, 2, pending.empty() ? -1 : debounceMs);
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+      spdlog::error("File watcher poll failed");
+      break;
+    }
+    if (fds[1].revents & POLLIN)
+      break;
+
+    if (ready == 0) {
+      // Quiet for the debounce window, compile everything that changed once
+      bool changesDetected = false;
+      for (const auto &name : pending) {
+        fs::path path = fs::path{pathToWatch} / name;
+        if (fs::exists(path))
+          changesDetected |= processFile(compiler, path);
+      }
+      pending.clear();
+      if (changesDetected)
         callback();
+      continue;
     }
-  }).detach();
+
+    ssize_t length;
+    while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+      for (char *ptr = buffer; ptr < buffer + length;) {
+        auto *event = reinterpret_cast<inotify_event *>(ptr);
+        if (event->len > 0 && isShaderSource(event->name)) {
+          spdlog::debug("File {} changed\n", event->name);
+          pending.insert(event->name);
+        }
+        ptr += sizeof(inotify_event) + event->len;
+      }
+    }
+  }
+  close(inotifyFd);
+  return true;
 }
+
+#else
+
+bool FWatcher::inotifyLoop() { return false; }
+
+#endif
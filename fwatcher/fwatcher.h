@@ -1,18 +1,50 @@
 /**
  * Used to watch and live recompile shaders
- * Very simple file watching implementation
+ * Uses inotify on linux and falls back to polling the directory every
+ * interval everywhere else (or if inotify is unavailable)
  **/
+#pragma once
+#include "../shadercompiler/shadercompiler.h"
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
 
 class FWatcher {
 private:
   std::string pathToWatch;
   std::chrono::duration<int, std::milli> interval;
+  ShaderCompiler &compiler;
+  // Only called when the changed shaders compiled successfully
   std::function<void()> callback;
 
+  std::thread thread;
+  std::atomic<bool> running{false};
+  // Wakes the polling loop early on stop
+  std::mutex mutex;
+  std::condition_variable condition;
+  // Wakes the inotify loop on stop, -1 when not in use
+  std::atomic<int> wakeFd{-1};
+
+  void pollLoop();
+  // Returns false if inotify could not be set up
+  bool inotifyLoop();
+
 public:
   FWatcher(std::string pathToWatch,
            std::chrono::duration<int, std::milli> interval,
-           std::function<void()> callback);
+           ShaderCompiler &compiler, std::function<void()> callback);
+  ~FWatcher();
   void start();
+  // Stops and joins the watcher thread, safe to call more than once
+  void stop();
 };
+
+// Compiles a stage, or every stage next to a .glsl include. Returns whether
+// everything compiled so broken edits never trigger a reload.
+bool processFile(ShaderCompiler &compiler,
+                 const boost::filesystem::path &path);
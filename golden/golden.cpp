@@ -0,0 +1,161 @@
+#include "golden.h"
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace fs = boost::filesystem;
+
+ImageDiff diffImages(const uint8_t *a, const uint8_t *b, const size_t &size) {
+  uint64_t squaredSum = 0;
+  uint32_t maxError = 0;
+  size_t i = 0;
+#if defined(__SSE2__)
+  // 16 channels per step: |a - b| from two saturating subtracts, squares
+  // summed pairwise into 32 bit lanes by madd
+  const __m128i zero = _mm_setzero_si128();
+  __m128i maxDiff = zero;
+  while (i + 16 <= size) {
+    // Each step adds at most 4 * 255^2 per lane, flush well before the
+    // 32 bit lanes can overflow
+    size_t end = std::min(size - (size - i) % 16, i + 16 * 2048);
+    __m128i sums = zero;
+    for (; i < end; i += 16) {
+      __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+      __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+      __m128i diff =
+          _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+      maxDiff = _mm_max_epu8(maxDiff, diff);
+      __m128i low = _mm_unpacklo_epi8(diff, zero);
+      __m128i high = _mm_unpackhi_epi8(diff, zero);
+      sums = _mm_add_epi32(sums, _mm_madd_epi16(low, low));
+      sums = _mm_add_epi32(sums, _mm_madd_epi16(high, high));
+    }
+    alignas(16) uint32_t lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), sums);
+    squaredSum += uint64_t{lanes[0]} + lanes[1] + lanes[2] + lanes[3];
+  }
+  alignas(16) uint8_t maxLanes[16];
+  _mm_store_si128(reinterpret_cast<__m128i *>(maxLanes), maxDiff);
+  maxError = *std::max_element(maxLanes, maxLanes + 16);
+#endif
+  // The tail, or everything without SSE2 where compilers vectorize this
+  for (; i < size; i++) {
+    uint32_t diff = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    maxError = std::max(maxError, diff);
+    squaredSum += diff * diff;
+  }
+
+  ImageDiff result{
+      .psnr = std::numeric_limits<double>::infinity(),
+      .maxError = maxError,
+  };
+  if (squaredSum > 0 && size > 0) {
+    double mse = static_cast<double>(squaredSum) / size;
+    result.psnr = 10.0 * std::log10(255.0 * 255.0 / mse);
+  }
+  return result;
+}
+
+void writePpm(const std::string &path, const uint32_t &width,
+              const uint32_t &height, const std::vector<uint8_t> &rgb) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file << fmt::format("P6\n{} {}\n255\n", width, height);
+  file.write(reinterpret_cast<const char *>(rgb.data()), rgb.size());
+  if (!file)
+    throw std::runtime_error(fmt::format("Failed to write {}", path));
+}
+
+std::vector<uint8_t> readPpm(const std::string &path, uint32_t &width,
+                             uint32_t &height) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    throw std::runtime_error(fmt::format("Failed to open {}", path));
+  std::string magic;
+  uint32_t maxValue = 0;
+  file >> magic >> width >> height >> maxValue;
+  // Exactly one whitespace character separates the header from the pixels
+  file.get();
+  if (!file || magic != "P6" || maxValue != 255)
+    throw std::runtime_error(fmt::format("{} is not a binary 8 bit PPM", path));
+  std::vector<uint8_t> rgb(size_t{width} * height * 3);
+  file.read(reinterpret_cast<char *>(rgb.data()), rgb.size());
+  if (!file)
+    throw std::runtime_error(fmt::format("{} is truncated", path));
+  return rgb;
+}
+
+GoldenCheck::GoldenCheck(const std::string &directory,
+                         const std::set<uint32_t> &frames, const bool &update,
+                         const double &minPsnr, const uint32_t &maxError)
+    : directory{directory}, frames{frames}, update{update}, minPsnr{minPsnr},
+      maxError{maxError} {
+  if (update)
+    fs::create_directories(directory);
+}
+
+std::string GoldenCheck::path(const uint32_t &frame) const {
+  return (fs::path(directory) / fmt::format("frame_{}.ppm", frame)).string();
+}
+
+bool GoldenCheck::wants(const uint32_t &frame) const {
+  return frames.count(frame) != 0;
+}
+
+void GoldenCheck::check(const uint32_t &frame, const uint8_t *rgba,
+                        const uint32_t &width, const uint32_t &height) {
+  const size_t pixels = size_t{width} * height;
+  std::vector<uint8_t> rgb(pixels * 3);
+  for (size_t i = 0; i < pixels; i++) {
+    rgb[i * 3 + 0] = rgba[i * 4 + 0];
+    rgb[i * 3 + 1] = rgba[i * 4 + 1];
+    rgb[i * 3 + 2] = rgba[i * 4 + 2];
+  }
+
+  bool failed = false;
+  try {
+    if (update) {
+      writePpm(path(frame), width, height, rgb);
+      spdlog::info("Golden frame {} written to {}", frame, path(frame));
+    } else {
+      uint32_t goldenWidth, goldenHeight;
+      std::vector<uint8_t> golden =
+          readPpm(path(frame), goldenWidth, goldenHeight);
+      if (goldenWidth != width || goldenHeight != height) {
+        spdlog::error("Golden frame {} is {}x{}, rendered {}x{}", frame,
+                      goldenWidth, goldenHeight, width, height);
+        failed = true;
+      } else {
+        ImageDiff diff = diffImages(rgb.data(), golden.data(), rgb.size());
+        failed = diff.psnr < minPsnr || diff.maxError > maxError;
+        auto log = failed ? spdlog::level::err : spdlog::level::info;
+        spdlog::log(log, "Golden frame {}: PSNR {:.2f}dB, max error {}{}",
+                    frame, diff.psnr, diff.maxError, failed ? " FAILED" : "");
+      }
+    }
+  } catch (const std::exception &e) {
+    spdlog::error("Golden frame {}: {}", frame, e.what());
+    failed = true;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  checked++;
+  if (failed)
+    failures++;
+}
+
+bool GoldenCheck::passed() {
+  std::lock_guard<std::mutex> lock(mutex);
+  uint32_t missing = static_cast<uint32_t>(frames.size()) - checked;
+  if (missing > 0)
+    spdlog::error("{} golden frames were never rendered", missing);
+  spdlog::info("Golden frames: {} checked, {} failed{}", checked, failures,
+               update ? " (updated)" : "");
+  return failures == 0 && missing == 0;
+}
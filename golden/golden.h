@@ -0,0 +1,58 @@
+/**
+ * Golden image regression checks for deterministic (fixed time step) runs.
+ * Selected frames are compared against PPM images stored by an earlier run
+ * so shader and pipeline optimizations that change the image are caught.
+ **/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+struct ImageDiff {
+  // Peak signal to noise ratio in dB, infinity for identical images
+  double psnr;
+  // Largest difference of any channel, 0-255
+  uint32_t maxError;
+};
+
+// Compares two buffers of size bytes (eg. packed RGB pixels)
+ImageDiff diffImages(const uint8_t *a, const uint8_t *b, const size_t &size);
+
+// Binary PPM (P6, maxval 255) as packed RGB
+void writePpm(const std::string &path, const uint32_t &width,
+              const uint32_t &height, const std::vector<uint8_t> &rgb);
+// Throws if path is not a binary PPM with maxval 255
+std::vector<uint8_t> readPpm(const std::string &path, uint32_t &width,
+                             uint32_t &height);
+
+class GoldenCheck {
+private:
+  std::string directory;
+  std::set<uint32_t> frames;
+  bool update;
+  double minPsnr;
+  uint32_t maxError;
+  std::mutex mutex;
+  uint32_t checked = 0;
+  uint32_t failures = 0;
+
+  std::string path(const uint32_t &frame) const;
+
+public:
+  // Compares frames against <directory>/frame_<n>.ppm, or writes them there
+  // when update is set. A frame fails below minPsnr or above maxError.
+  GoldenCheck(const std::string &directory, const std::set<uint32_t> &frames,
+              const bool &update, const double &minPsnr,
+              const uint32_t &maxError);
+  bool wants(const uint32_t &frame) const;
+  // Checks one RGBA8 frame, may be called from any thread. Missing or
+  // unreadable goldens count as failures.
+  void check(const uint32_t &frame, const uint8_t *rgba, const uint32_t &width,
+             const uint32_t &height);
+  // Logs a summary, false if any frame failed or a wanted frame was never
+  // checked
+  bool passed();
+};
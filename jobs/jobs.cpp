@@ -0,0 +1,67 @@
+#include "jobs.h"
+#include <utility>
+
+JobSystem::JobSystem(const uint32_t &workerCount) {
+  workers.reserve(workerCount);
+  for (uint32_t i = 0; i < workerCount; i++)
+    workers.emplace_back([this]() { run(); });
+}
+
+JobSystem::~JobSystem() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  queued.notify_all();
+  for (auto &worker : workers)
+    worker.join();
+}
+
+uint32_t JobSystem::workerCount() const { return workers.size(); }
+
+void JobSystem::submit(Job job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(std::move(job));
+    outstanding++;
+  }
+  queued.notify_one();
+}
+
+void JobSystem::wait() {
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [this]() { return outstanding == 0; });
+  if (failure)
+    std::rethrow_exception(std::exchange(failure, nullptr));
+}
+
+void JobSystem::run() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      queued.wait(lock, [this]() { return !jobs.empty() || stopping; });
+      if (stopping)
+        return;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+
+    std::exception_ptr thrown;
+    try {
+      job();
+    } catch (...) {
+      thrown = std::current_exception();
+    }
+
+    bool last;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (thrown && !failure)
+        failure = thrown;
+      last = --outstanding == 0;
+    }
+    if (last)
+      finished.notify_all();
+  }
+}
@@ -0,0 +1,44 @@
+/**
+ * Fixed pool of worker threads for short jobs the render loop fans out
+ * within a frame, eg. recording command buffers. wait() joins them again
+ * before the frame is submitted.
+ **/
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem {
+public:
+  using Job = std::function<void()>;
+
+private:
+  std::mutex mutex;
+  // Signaled when jobs are queued or the workers should stop
+  std::condition_variable queued;
+  // Signaled when the last outstanding job has finished
+  std::condition_variable finished;
+  std::deque<Job> jobs;
+  // Queued plus running jobs
+  uint32_t outstanding = 0;
+  bool stopping = false;
+  // First exception thrown by a job since the last wait()
+  std::exception_ptr failure;
+  std::vector<std::thread> workers;
+
+  void run();
+
+public:
+  explicit JobSystem(const uint32_t &workerCount);
+  ~JobSystem();
+  uint32_t workerCount() const;
+  void submit(Job job);
+  // Blocks until every submitted job has finished, rethrows the first
+  // exception one of them threw
+  void wait();
+};
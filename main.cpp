@@ -1,4 +1,3 @@
-#include <_types/_uint64_t.h>
 #include <chrono>
 #include <fstream>
 #include <stdexcept>
@@ -6,28 +5,48 @@
 #include <vector>
 #include <vulkan/vulkan_core.h>
 #define GLFW_INCLUDE_VULKAN
+#include "capture/capture.h"
+#include "cpurender/cpurender.h"
+#include "deletionqueue/deletionqueue.h"
+#include "dynres/dynres.h"
+#include "frametiming/frametiming.h"
+#include "framewriter/framewriter.h"
 #include "fwatcher/fwatcher.h"
+#include "golden/golden.h"
+#include "jobs/jobs.h"
+#include "options/options.h"
+#include "passgraph/passgraph.h"
+#include "pipelinebuilder/pipelinebuilder.h"
+#include "pipelinecache/pipelinecache.h"
+#include "quality/quality.h"
+#include "shadercompiler/shadercompiler.h"
+#include "taskgraph/taskgraph.h"
+#include "tilerecorder/tilerecorder.h"
+#include "trace/trace.h"
+#include "vkcommon/vkcommon.h"
+#include "wall/wall.h"
 #include <GLFW/glfw3.h>
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <optional>
+#include <set>
 #include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <memory>
 #include <spdlog/spdlog.h>
+#include <thread>
 #include <vulkan/vulkan.h>
 
-#define VK_CHECK(x)                                                            \
-  do {                                                                         \
-    VkResult err = x;                                                          \
-    /*spdlog::info("VkResult: {}", static_cast<int>(err));*/                   \
-    if (err) {                                                                 \
-      spdlog::error("Detected Vulkan error: {}", static_cast<int>(err));       \
-      throw std::runtime_error("Got a runtime_error");                         \
-    }                                                                          \
-  } while (0);
-
-struct PushConstants {
-  float iTime;
+// Matches the push constants of shaders/checkerresolve.frag
+struct ResolveConstants {
   int iFrame;
-  glm::vec2 iResolution;
-  glm::vec2 iMouse;
+  int historyValid;
+  glm::ivec2 size;
 };
 
 void initGLFW() {
@@ -48,32 +67,6 @@ GLFWwindow *createGLFWwindow() {
   return window;
 }
 
-std::vector<char> readFile(const std::string &filename) {
-  std::ifstream file(filename, std::ios::ate | std::ios::binary);
-  size_t fileSize = (size_t)file.tellg();
-  std::vector<char> buffer(fileSize);
-  file.seekg(0);
-  file.read(buffer.data(), fileSize);
-  file.close();
-  return buffer;
-}
-
-VkShaderModule loadShaderModule(const VkDevice &device, const char *path) {
-  spdlog::info("Loading shader module {}", path);
-  VkShaderModule shaderModule;
-  std::vector<char> code = readFile(path);
-  VkShaderModuleCreateInfo createInfo = {
-      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-      .pNext = nullptr,
-      .flags = 0,
-      .codeSize = code.size(),
-      .pCode = reinterpret_cast<const uint32_t *>(code.data()),
-  };
-  spdlog::info("Creating shader module");
-  VK_CHECK(vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule));
-  return shaderModule;
-}
-
 void enumerateExtensions(const VkPhysicalDevice &physicalDevice) {
   // enumerate all extension properties
   uint32_t deviceExtensionCount;
@@ -84,105 +77,10 @@ void enumerateExtensions(const VkPhysicalDevice &physicalDevice) {
       physicalDevice, nullptr, &deviceExtensionCount, deviceExtensions.data());
 
   spdlog::info("Device has {} extensions", deviceExtensionCount);
+  // Debug only, logging every extension adds to the time to first present
   for (const auto &extension : deviceExtensions) {
-    spdlog::info("{}", extension.extensionName);
-  }
-}
-
-VkInstance setupVulkanInstance() {
-  VkApplicationInfo appInfo = {
-      .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
-      .pNext = nullptr,
-      .pApplicationName = "Planet",
-      .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
-      .pEngineName = "Planet Engine",
-      .engineVersion = VK_MAKE_VERSION(1, 0, 0),
-      .apiVersion = VK_API_VERSION_1_2,
-  };
-  uint32_t extensionCount;
-  const char **reqExtensions =
-      glfwGetRequiredInstanceExtensions(&extensionCount);
-  spdlog::info("Required extensions count: {}", extensionCount);
-  for (uint32_t i = 0; i < extensionCount; i++) {
-    spdlog::info("{}", reqExtensions[i]);
-  }
-
-  // Create an array of extensions which include
-  // VK_KHR_portability_enumeration and VK_MVK_MACOS_SURFACE_EXTENSION_NAME
-  std::vector<const char *> extensions;
-  for (uint32_t i = 0; i < extensionCount; i++) {
-    extensions.emplace_back(reqExtensions[i]);
-  }
-  extensions.emplace_back("VK_KHR_portability_enumeration");
-
-  spdlog::info("Using the following extensions");
-  for (const auto &extension : extensions) {
-    spdlog::info("{}", extension);
-  }
-
-  spdlog::info("Creating vk instance");
-
-  // Enable validation layers
-  // as a c++ std::array with the basic validation layer
-  static constexpr std::array<const char *, 0> validationLayers = {
-      // VK_LAYER_KHRONOS_validation seems to have a bug in dynamic rendering
-      // (at least through moltenvk) so can't seem to enable it
-      // "VK_LAYER_KHRONOS_validation",
-      // api dump
-      // "VK_LAYER_LUNARG_api_dump",
-      // "VK_LAYER_LUNARG_parameter_validation",
-      // "VK_LAYER_LUNARG_screenshot",
-      // "VK_LAYER_LUNARG_core_validation",
-      // "VK_LAYER_LUNARG_device_limits",
-      // "VK_LAYER_LUNARG_object_tracker",
-  };
-
-  VkInstanceCreateInfo createInfo = {
-      .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
-      .pNext = nullptr,
-      .flags = VkInstanceCreateFlagBits::
-          VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR,
-      .pApplicationInfo = &appInfo,
-      .enabledLayerCount = static_cast<uint32_t>(validationLayers.size()),
-      .ppEnabledLayerNames = validationLayers.data(),
-      .enabledExtensionCount = static_cast<uint32_t>(extensions.size()),
-      .ppEnabledExtensionNames = extensions.data(),
-  };
-
-  VkInstance instance;
-  VK_CHECK(vkCreateInstance(&createInfo, nullptr, &instance));
-  return instance;
-}
-
-VkPhysicalDevice findGPU(const VkInstance &instance) {
-  // Find all GPU Devices
-  uint32_t deviceCount = 0;
-  spdlog::info("Enumerating devices...");
-  vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
-  spdlog::info("Found {} devices", deviceCount);
-
-  // Save devices to vector
-  std::vector<VkPhysicalDevice> devices{deviceCount};
-  vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
-
-  // Print all devices
-  for (uint32_t i = 0; i < deviceCount; i++) {
-    VkPhysicalDeviceProperties deviceProperties;
-    vkGetPhysicalDeviceProperties(devices[i], &deviceProperties);
-    spdlog::info("Device {} has Vulkan version {}", i,
-                 deviceProperties.apiVersion);
-    spdlog::info("Device {} has driver version {}", i,
-                 deviceProperties.driverVersion);
-    spdlog::info("Device {} has vendor ID {}", i, deviceProperties.vendorID);
-    spdlog::info("Device {} has device ID {}", i, deviceProperties.deviceID);
-    spdlog::info("Device {} has device type {}", i,
-                 static_cast<uint32_t>(deviceProperties.deviceType));
-    spdlog::info("Device {} has device name {}", i,
-                 deviceProperties.deviceName);
+    spdlog::debug("{}", extension.extensionName);
   }
-
-  // just return 1st device (assume 1 GPU and use 1 GPU)
-  return devices[0];
 }
 
 VkSurfaceKHR createVulkanSurface(const VkInstance &instance,
@@ -200,98 +98,6 @@ VkSurfaceKHR createVulkanSurface(const VkInstance &instance,
   return surface;
 }
 
-uint32_t getVulkanGraphicsQueueIndex(const VkPhysicalDevice &physicalDevice,
-                                     const VkSurfaceKHR &surface) {
-  int32_t graphicsQueueIndex = -1;
-
-  // https://github.com/KhronosGroup/Vulkan-Samples/blob/cc7b29696011e7499379695947b9e634ed61ea10/samples/api/hello_triangle/hello_triangle.cpp#L293
-  // Just use GPU 0 for now
-
-  uint32_t queueFamilyCount;
-  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
-                                           nullptr);
-
-  spdlog::info("Found {} queue families", queueFamilyCount);
-
-  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
-                                           queueFamilies.data());
-
-  // Print debug info for all queue families
-  for (uint32_t i = 0; i < queueFamilyCount; i++) {
-    spdlog::info("Queue family {} has {} queues", i,
-                 queueFamilies[i].queueCount);
-    spdlog::info("Queue family {} supports graphics: {} ", i,
-                 queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT);
-    spdlog::info("Queue family {} supports compute: {} ", i,
-                 queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT);
-    spdlog::info("Queue family {} supports transfer: {} ", i,
-                 queueFamilies[i].queueFlags & VK_QUEUE_TRANSFER_BIT);
-    spdlog::info("Queue family {} supports sparse binding: {} ", i,
-                 queueFamilies[i].queueFlags & VK_QUEUE_SPARSE_BINDING_BIT);
-    spdlog::info("Queue family {} supports protected: {} ", i,
-                 queueFamilies[i].queueFlags & VK_QUEUE_PROTECTED_BIT);
-
-    VkBool32 supportsPresent;
-    vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface,
-                                         &supportsPresent);
-    spdlog::info("Queue family {} supports present: {} ", i, supportsPresent);
-
-    if (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT &&
-        supportsPresent) {
-      graphicsQueueIndex = i;
-    }
-  }
-
-  if (graphicsQueueIndex == -1) {
-    throw std::runtime_error("Failed to find graphics queue");
-  }
-  return static_cast<uint32_t>(graphicsQueueIndex);
-}
-
-VkDevice createVulkanLogicalDevice(const VkPhysicalDevice &physicalDevice,
-                                   const uint32_t &graphicsQueueIndex) {
-  float queuePriority = 1.0f;
-  // Create one queue
-  VkDeviceQueueCreateInfo queueInfo = {
-      .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-      .queueFamilyIndex = static_cast<uint32_t>(graphicsQueueIndex),
-      .queueCount = 1,
-      .pQueuePriorities = &queuePriority,
-  };
-
-  std::array<const char *const, 3> requiredExtensions = {
-      "VK_KHR_swapchain", "VK_KHR_portability_subset",
-      "VK_KHR_dynamic_rendering"};
-
-  // Create a logical device
-  spdlog::info("Create a logical device...");
-  VkDevice device;
-
-  VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{
-      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
-      .dynamicRendering = VK_TRUE,
-  };
-
-  VkDeviceCreateInfo deviceCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-      .pNext = &dynamicRenderingFeatures,
-      .queueCreateInfoCount = 1,
-      .pQueueCreateInfos = &queueInfo,
-      .enabledExtensionCount = requiredExtensions.size(),
-      .ppEnabledExtensionNames = requiredExtensions.data(),
-  };
-
-  VK_CHECK(vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device));
-  spdlog::info("Created logical device");
-
-  // auto &requested_dynamic_rendering            =
-  // gpu.request_extension_features<VkPhysicalDeviceDynamicRenderingFeaturesKHR>(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR);
-  // requested_dynamic_rendering.dynamicRendering = VK_TRUE;
-
-  return device;
-}
-
 void logSurfaceCapabilities(
     const VkSurfaceCapabilitiesKHR &surfaceCapabilities) {
   // Print the surface capabilities
@@ -369,23 +175,73 @@ VkSurfaceFormatKHR selectSwapchainFormat(const VkPhysicalDevice &physicalDevice,
   return surfaceFormat;
 }
 
+VkPresentModeKHR selectPresentMode(const VkPhysicalDevice &physicalDevice,
+                                   const VkSurfaceKHR &surface,
+                                   const PresentMode &requested) {
+  VkPresentModeKHR wanted;
+  switch (requested) {
+  case PresentMode::FifoRelaxed:
+    wanted = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+    break;
+  case PresentMode::Mailbox:
+    wanted = VK_PRESENT_MODE_MAILBOX_KHR;
+    break;
+  case PresentMode::Immediate:
+    wanted = VK_PRESENT_MODE_IMMEDIATE_KHR;
+    break;
+  default:
+    wanted = VK_PRESENT_MODE_FIFO_KHR;
+    break;
+  }
+
+  uint32_t presentModeCount;
+  VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(
+      physicalDevice, surface, &presentModeCount, nullptr));
+  std::vector<VkPresentModeKHR> presentModes(presentModeCount);
+  VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(
+      physicalDevice, surface, &presentModeCount, presentModes.data()));
+
+  if (std::find(presentModes.begin(), presentModes.end(), wanted) !=
+      presentModes.end()) {
+    spdlog::info("Present mode: {}", static_cast<int>(wanted));
+    return wanted;
+  }
+  // FIFO must be supported by all implementations.
+  spdlog::warn("Present mode {} unsupported, falling back to FIFO",
+               static_cast<int>(wanted));
+  return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+// The surface either dictates the extent or reports 0xFFFFFFFF and lets the
+// swapchain pick it, in which case the window framebuffer size is used
+VkExtent2D
+selectSwapchainExtent(const VkSurfaceCapabilitiesKHR &surfaceCapabilities,
+                      GLFWwindow *window) {
+  if (surfaceCapabilities.currentExtent.width != 0xFFFFFFFF)
+    return surfaceCapabilities.currentExtent;
+
+  int width, height;
+  glfwGetFramebufferSize(window, &width, &height);
+  VkExtent2D extent{
+      .width = std::clamp(static_cast<uint32_t>(width),
+                          surfaceCapabilities.minImageExtent.width,
+                          surfaceCapabilities.maxImageExtent.width),
+      .height = std::clamp(static_cast<uint32_t>(height),
+                           surfaceCapabilities.minImageExtent.height,
+                           surfaceCapabilities.maxImageExtent.height),
+  };
+  return extent;
+}
+
 VkSwapchainKHR
 createSwapchain(const VkDevice &device, const VkSurfaceKHR &surface,
                 const VkSurfaceCapabilitiesKHR &surfaceCapabilities,
-                const VkSurfaceFormatKHR &surfaceFormat) {
-  VkExtent2D swapchainSize;
-  if (surfaceCapabilities.currentExtent.width == 0xFFFFFFFF) {
-    // TODO: Get swapchain_size.width from the window
-    throw std::runtime_error(
-        "Untested code... "
-        "surfaceCapabilities.currentExtent.width == 0xFFFFFFFF");
-  } else {
-    spdlog::info("Surface capabilities current extent width is not 0xFFFFFFFF");
-    swapchainSize = surfaceCapabilities.currentExtent;
-    spdlog::info("Swapchain size: {}x{}", swapchainSize.width,
-                 swapchainSize.height);
-    // Tested on mac with molten vk and got sample value 1600x1200
-  }
+                const VkSurfaceFormatKHR &surfaceFormat,
+                const VkPresentModeKHR &presentMode,
+                const VkExtent2D &swapchainSize,
+                const VkSwapchainKHR &oldSwapchain) {
+  spdlog::info("Swapchain size: {}x{}", swapchainSize.width,
+               swapchainSize.height);
 
   // Determine the number of VkImage's to use in the swapchain.
   // Ideally, we desire to own 1 image at a time, the rest of the images can
@@ -401,8 +257,7 @@ createSwapchain(const VkDevice &device, const VkSurfaceKHR &surface,
   // Just set identity bit transform
   VkSurfaceTransformFlagBitsKHR preTransform =
       VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
-  // FIFO must be supported by all implementations.
-  VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+  VkPresentModeKHR swapchainPresentMode = presentMode;
 
   // Find a supported composite type.
   VkCompositeAlphaFlagBitsKHR composite = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
@@ -437,14 +292,19 @@ createSwapchain(const VkDevice &device, const VkSurfaceKHR &surface,
       .imageExtent.width = swapchainSize.width,
       .imageExtent.height = swapchainSize.height,
       .imageArrayLayers = 1,
-      .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+      // Transfer dst when available so a lower resolution render can be
+      // blitted up to the swapchain image
+      .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                    (surfaceCapabilities.supportedUsageFlags &
+                     VK_IMAGE_USAGE_TRANSFER_DST_BIT),
       .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
       .preTransform = preTransform,
       .compositeAlpha = composite,
       .presentMode = swapchainPresentMode,
       .clipped = VK_TRUE,
-      // temporary
-      .oldSwapchain = VK_NULL_HANDLE,
+      // Lets the driver hand over resources and keep presenting the old
+      // images until the new swapchain takes over
+      .oldSwapchain = oldSwapchain,
   };
 
   VkSwapchainKHR swapchain;
@@ -508,149 +368,280 @@ createSwapchainImageViews(const VkDevice &device,
   return swapchainImageViews;
 }
 
-VkCommandPool createCommandPool(const VkDevice &logicalDevice,
-                                const uint32_t &graphicsQueueIndex) {
-  spdlog::info("Create command pool");
-  VkCommandPoolCreateInfo commandPoolCreateInfo{
-      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-      .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-      .queueFamilyIndex = graphicsQueueIndex,
+// iDate: year, month from 0, day of the month, seconds since local midnight
+glm::vec4 shaderToyDate(const std::chrono::system_clock::time_point &now) {
+  std::time_t seconds = std::chrono::system_clock::to_time_t(now);
+  std::tm local = *std::localtime(&seconds);
+  double fraction = std::chrono::duration<double>(
+                        now - std::chrono::system_clock::from_time_t(seconds))
+                        .count();
+  return glm::vec4{local.tm_year + 1900, local.tm_mon, local.tm_mday,
+                   local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec +
+                       fraction};
+}
+
+// iDate of fixed time step runs, midnight of the first of January 2000
+const glm::vec4 deterministicDate{2000.0f, 0.0f, 1.0f, 0.0f};
+
+// renderScene with the draws recorded in secondary command buffers, eg. by
+// the TileRecorder
+void renderSceneSecondaries(const VkImage &image, const VkImageView &imageView,
+                            const VkExtent2D &extent,
+                            const VkCommandBuffer &commandBuffer,
+                            const std::vector<VkCommandBuffer> &secondaries,
+                            const VkImageLayout &finalLayout) {
+  // Nothing but vkCmdExecuteCommands may be recorded inside
+  beginSceneRendering(commandBuffer, image, imageView, extent,
+                      VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR);
+  vkCmdExecuteCommands(commandBuffer, secondaries.size(), secondaries.data());
+  cmdEndRenderingKHR(commandBuffer);
+
+  finishSceneImage(commandBuffer, image, finalLayout);
+}
+
+// Dynamic resolution needs to blit from an image of the swapchain format
+// into the swapchain images themselves
+bool canBlitToSwapchain(const VkPhysicalDevice &physicalDevice,
+                        const VkSurfaceCapabilitiesKHR &surfaceCapabilities,
+                        const VkFormat &format) {
+  VkFormatProperties formatProperties;
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, format,
+                                      &formatProperties);
+  return (surfaceCapabilities.supportedUsageFlags &
+          VK_IMAGE_USAGE_TRANSFER_DST_BIT) &&
+         (formatProperties.optimalTilingFeatures &
+          VK_FORMAT_FEATURE_BLIT_SRC_BIT);
+}
+
+VkFilter selectUpscaleFilter(const VkPhysicalDevice &physicalDevice,
+                             const VkFormat &format) {
+  VkFormatProperties formatProperties;
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, format,
+                                      &formatProperties);
+  return (formatProperties.optimalTilingFeatures &
+          VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)
+             ? VK_FILTER_LINEAR
+             : VK_FILTER_NEAREST;
+}
+
+/**
+ * Scales the srcExtent region of srcImage (in TRANSFER_SRC_OPTIMAL) up to
+ * the whole swapchain image and leaves that ready to present. The submit
+ * must wait for the acquire semaphore at the transfer stage.
+ **/
+void blitToSwapchain(const VkCommandBuffer &commandBuffer,
+                     const VkImage &srcImage, const VkExtent2D &srcExtent,
+                     const VkImage &swapchainImage,
+                     const VkExtent2D &swapchainExtent,
+                     const VkFilter &filter) {
+  transitionImage(commandBuffer, swapchainImage, VK_IMAGE_LAYOUT_UNDEFINED,
+                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                  VK_ACCESS_TRANSFER_WRITE_BIT);
+
+  VkImageBlit region{
+      .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+      .srcOffsets = {{0, 0, 0},
+                     {static_cast<int32_t>(srcExtent.width),
+                      static_cast<int32_t>(srcExtent.height), 1}},
+      .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+      .dstOffsets = {{0, 0, 0},
+                     {static_cast<int32_t>(swapchainExtent.width),
+                      static_cast<int32_t>(swapchainExtent.height), 1}},
   };
-  VkCommandPool commandPool;
+  vkCmdBlitImage(commandBuffer, srcImage,
+                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, swapchainImage,
+                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, filter);
+
+  transitionImage(commandBuffer, swapchainImage,
+                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                  VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT,
+                  VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                  VK_ACCESS_TRANSFER_WRITE_BIT, 0);
+}
+
+/**
+ * Checkerboard mode traces half the pixels each frame into a half width
+ * target and reconstructs the rest from the previous resolved frame.
+ * history[iFrame & 1] is resolved into while the other one is read.
+ **/
+struct CheckerboardTargets {
+  // One per frame in flight, only read by the resolve of the same frame
+  std::vector<OffscreenImage> traced;
+  std::array<OffscreenImage, 2> history{};
+};
+
+CheckerboardTargets createCheckerboardTargets(
+    const VkPhysicalDevice &physicalDevice, const VkDevice &device,
+    const VkExtent2D &extent, const VkFormat &format,
+    const uint32_t &framesInFlight) {
+  CheckerboardTargets targets;
+  VkExtent2D tracedExtent{(extent.width + 1) / 2, extent.height};
+  targets.traced.resize(framesInFlight);
+  for (auto &traced : targets.traced) {
+    traced = createOffscreenImage(physicalDevice, device, tracedExtent, format,
+                                  VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                      VK_IMAGE_USAGE_SAMPLED_BIT);
+  }
+  for (auto &history : targets.history) {
+    history = createOffscreenImage(physicalDevice, device, extent, format,
+                                   VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                       VK_IMAGE_USAGE_SAMPLED_BIT |
+                                       VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+  }
+  return targets;
+}
 
-  VK_CHECK(vkCreateCommandPool(logicalDevice, &commandPoolCreateInfo, nullptr,
-                               &commandPool));
-  return commandPool;
+void destroyCheckerboardTargets(const VkDevice &device,
+                                const CheckerboardTargets &targets) {
+  for (auto &traced : targets.traced)
+    destroyOffscreenImage(device, traced);
+  for (auto &history : targets.history)
+    destroyOffscreenImage(device, history);
 }
 
-std::vector<VkCommandBuffer>
-createCommandBuffers(const VkDevice &logicalDevice,
-                     const VkCommandPool &commandPool,
-                     const uint32_t &commandBufferCount) {
-  std::vector<VkCommandBuffer> commandBuffers(commandBufferCount);
-  spdlog::info("Create command buffer");
-  VkCommandBufferAllocateInfo commandBufferAllocateInfo{
-      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-      .pNext = nullptr,
-      .commandPool = commandPool,
-      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-      .commandBufferCount = commandBufferCount,
+// Binding 0 the traced half width image, binding 1 the history image
+VkDescriptorSetLayout createResolveSetLayout(const VkDevice &device) {
+  std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+  for (uint32_t i = 0; i < bindings.size(); i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  }
+  VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .bindingCount = static_cast<uint32_t>(bindings.size()),
+      .pBindings = bindings.data(),
   };
-  VK_CHECK(vkAllocateCommandBuffers(logicalDevice, &commandBufferAllocateInfo,
-                                    commandBuffers.data()));
-  return commandBuffers;
+  VkDescriptorSetLayout setLayout;
+  VK_CHECK(vkCreateDescriptorSetLayout(device, &setLayoutCreateInfo, nullptr,
+                                       &setLayout));
+  return setLayout;
+}
+
+VkPipelineLayout
+createResolvePipelineLayout(const VkDevice &device,
+                            const VkDescriptorSetLayout &setLayout) {
+  VkPushConstantRange pushConstantRange{
+      .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+      .offset = 0,
+      .size = sizeof(ResolveConstants),
+  };
+  VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .setLayoutCount = 1,
+      .pSetLayouts = &setLayout,
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &pushConstantRange,
+  };
+  VkPipelineLayout pipelineLayout;
+  VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr,
+                                  &pipelineLayout));
+  return pipelineLayout;
 }
 
-void renderScene(const VkImage &image, const VkImageView &imageView,
-                 const VkSurfaceCapabilitiesKHR surfaceCapabilities,
-                 const VkCommandBuffer &commandBuffer,
-                 const VkPipeline &pipeline,
-                 const VkPipelineLayout &pipelineLayout,
-                 const PushConstants &pushConstants) {
-  // spdlog::info("Check swapchain image view [0]");
-  // spdlog::info("Swapchain image view handle: {}",
-  //              reinterpret_cast<uint64_t>(swapchainImageViews[0]));
+/**
+ * Resolves the traced half width image of this frame slot together with the
+ * previous history image into history[iFrame & 1], left in TRANSFER_SRC for
+ * the blit to the swapchain. The descriptor set must not be in use by the
+ * GPU, ie. belong to the current frame in flight.
+ **/
+void resolveCheckerboard(const VkDevice &device,
+                         const VkCommandBuffer &commandBuffer,
+                         const CheckerboardTargets &targets,
+                         const uint32_t &frameSlot, const int &iFrame,
+                         const bool &historyValid, const VkExtent2D &extent,
+                         const VkPipeline &pipeline,
+                         const VkPipelineLayout &pipelineLayout,
+                         const VkDescriptorSet &descriptorSet,
+                         const VkSampler &sampler) {
+  const OffscreenImage &current = targets.history[iFrame & 1];
+  const OffscreenImage &previous = targets.history[(iFrame & 1) ^ 1];
+
+  // The previous frame left its resolve in TRANSFER_SRC after the blit
+  transitionImage(commandBuffer, previous.image,
+                  historyValid ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                               : VK_IMAGE_LAYOUT_UNDEFINED,
+                  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT,
+                  VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                  VK_ACCESS_SHADER_READ_BIT);
+  // Fully overwritten, waits for the frame before last to stop sampling it
+  transitionImage(commandBuffer, current.image, VK_IMAGE_LAYOUT_UNDEFINED,
+                  VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                  VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                  VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+                  VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+
+  std::array<VkDescriptorImageInfo, 2> imageInfos{{
+      {sampler, targets.traced[frameSlot].view,
+       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+      {sampler, previous.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+  }};
+  std::array<VkWriteDescriptorSet, 2> writes{};
+  for (uint32_t i = 0; i < writes.size(); i++) {
+    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[i].dstSet = descriptorSet;
+    writes[i].dstBinding = i;
+    writes[i].descriptorCount = 1;
+    writes[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[i].pImageInfo = &imageInfos[i];
+  }
+  vkUpdateDescriptorSets(device, writes.size(), writes.data(), 0, nullptr);
 
   VkRenderingAttachmentInfo colorAttachmentInfo{
       .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-      .imageView = imageView,
+      .imageView = current.view,
       .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
       .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-      .clearValue.color = {1.0f, 1.0f, 1.0f, 1.0f}};
-
-  // spdlog::info("Current extent: {}x{}",
-  // surfaceCapabilities.currentExtent.width,
-  //              surfaceCapabilities.currentExtent.height);
-
+  };
   VkRenderingInfo renderingInfo{
       .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
-      .renderArea =
-          {
-              .offset = {0, 0},
-              .extent = {surfaceCapabilities.currentExtent.width,
-                         surfaceCapabilities.currentExtent.height},
-          },
+      .renderArea = {.offset = {0, 0}, .extent = extent},
       .layerCount = 1,
       .colorAttachmentCount = 1,
       .pColorAttachments = &colorAttachmentInfo,
   };
-
-  vkCmdBeginRenderingKHR(commandBuffer, &renderingInfo);
-
-  VkImageMemoryBarrier imageMemoryBarrierDraw{
-      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-      .srcAccessMask = 0,
-      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-      .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-      .image = image,
-      .subresourceRange =
-          {
-              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-              .baseMipLevel = 0,
-              .levelCount = 1,
-              .baseArrayLayer = 0,
-              .layerCount = 1,
-          },
-  };
-
-  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0,
-                       nullptr, 0, nullptr, 1, &imageMemoryBarrierDraw);
+  cmdBeginRenderingKHR(commandBuffer, &renderingInfo);
 
   vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-
-  vkCmdPushConstants(commandBuffer, pipelineLayout,
-                     VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstants),
-                     &pushConstants);
-
-  VkRect2D scissor{
-      .offset = {0, 0},
-      .extent = {surfaceCapabilities.currentExtent.width,
-                 surfaceCapabilities.currentExtent.height},
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+  ResolveConstants resolveConstants{
+      .iFrame = iFrame,
+      .historyValid = historyValid ? 1 : 0,
+      .size = glm::ivec2{extent.width, extent.height},
   };
+  vkCmdPushConstants(commandBuffer, pipelineLayout,
+                     VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(ResolveConstants),
+                     &resolveConstants);
 
+  VkRect2D scissor{.offset = {0, 0}, .extent = extent};
   VkViewport viewport{
       .x = 0.0f,
       .y = 0.0f,
-      .width = static_cast<float>(surfaceCapabilities.currentExtent.width),
-      .height = static_cast<float>(surfaceCapabilities.currentExtent.height),
+      .width = static_cast<float>(extent.width),
+      .height = static_cast<float>(extent.height),
       .minDepth = 0.0f,
       .maxDepth = 1.0f,
   };
-
   vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
   vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-
   vkCmdDraw(commandBuffer, 3, 1, 0, 0);
 
-  VkImageMemoryBarrier imageMemoryBarrierPresent{
-      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-      .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-      .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
-      .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-      .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-      .image = image,
-      .subresourceRange =
-          {
-              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-              .baseMipLevel = 0,
-              .levelCount = 1,
-              .baseArrayLayer = 0,
-              .layerCount = 1,
-          },
-  };
-
-  vkCmdPipelineBarrier(commandBuffer,
-                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-                       VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0,
-                       nullptr, 1, &imageMemoryBarrierPresent);
+  cmdEndRenderingKHR(commandBuffer);
 
-  vkCmdEndRenderingKHR(commandBuffer);
+  transitionImage(commandBuffer, current.image,
+                  VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                  VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT,
+                  VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                  VK_ACCESS_TRANSFER_READ_BIT);
 }
 
 VkSemaphore createSemaphore(const VkDevice &logicalDevice) {
@@ -673,25 +664,33 @@ std::vector<VkSemaphore> createSemaphores(const VkDevice &logicalDevice,
   return semaphores;
 }
 
-uint32_t acquireNextImage(const VkDevice &logicalDevice,
+// Out of date and suboptimal are returned to the caller so it can recreate
+// the swapchain, anything else unexpected is fatal
+bool isSwapchainStatus(const VkResult &result) {
+  return result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR;
+}
+
+VkResult acquireNextImage(const VkDevice &logicalDevice,
                           const VkSemaphore &imageAvailableSemaphore,
-                          const VkSwapchainKHR &swapchain) {
-  // hardcoded for now
-  uint32_t imageIndex;
-  VK_CHECK(vkAcquireNextImageKHR(logicalDevice, swapchain, UINT64_MAX,
-                                 imageAvailableSemaphore, VK_NULL_HANDLE,
-                                 &imageIndex));
-  return imageIndex;
+                          const VkSwapchainKHR &swapchain,
+                          uint32_t &imageIndex) {
+  VkResult result = vkAcquireNextImageKHR(logicalDevice, swapchain, UINT64_MAX,
+                                          imageAvailableSemaphore,
+                                          VK_NULL_HANDLE, &imageIndex);
+  if (!isSwapchainStatus(result))
+    VK_CHECK(result);
+  return result;
 }
 
-void queueSubmit(const VkCommandBuffer &commandBuffer,
-                 const VkSwapchainKHR &swapchain, const VkQueue &queue,
-                 const VkSemaphore &imageAvailableSemaphore,
-                 const VkSemaphore &renderingFinishedSemaphore,
-                 const VkFence &fence, const uint32_t &imageIndex) {
+VkResult queueSubmit(const VkCommandBuffer &commandBuffer,
+                     const VkSwapchainKHR &swapchain, const VkQueue &queue,
+                     const VkSemaphore &imageAvailableSemaphore,
+                     const VkSemaphore &renderingFinishedSemaphore,
+                     const VkFence &fence, const uint32_t &imageIndex,
+                     const VkPipelineStageFlags &waitStage) {
 
-  std::array<VkPipelineStageFlags, 1> waitFlags = {
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+  // First stage that touches the swapchain image
+  std::array<VkPipelineStageFlags, 1> waitFlags = {waitStage};
   VkSubmitInfo submitInfo{
       .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
       .waitSemaphoreCount = 1,
@@ -703,7 +702,10 @@ void queueSubmit(const VkCommandBuffer &commandBuffer,
       .pSignalSemaphores = &renderingFinishedSemaphore,
   };
 
-  VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, fence));
+  {
+    TRACE_SCOPE("vkQueueSubmit");
+    VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, fence));
+  }
 
   VkPresentInfoKHR presentInfo{
       .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
@@ -714,152 +716,206 @@ void queueSubmit(const VkCommandBuffer &commandBuffer,
       .pImageIndices = &imageIndex,
       .pResults = nullptr,
   };
-  VK_CHECK(vkQueuePresentKHR(queue, &presentInfo));
+  TRACE_SCOPE("vkQueuePresentKHR");
+  VkResult result = vkQueuePresentKHR(queue, &presentInfo);
+  if (!isSwapchainStatus(result))
+    VK_CHECK(result);
+  return result;
 }
 
-VkPipelineLayout createPipelineLayout(const VkDevice &logicalDevice) {
-  // https://www.saschawillems.de/blog/2016/08/13/vulkan-tutorial-on-rendering-a-fullscreen-quad-without-buffers/
-
-  VkPushConstantRange pushConstantRange{};
-  pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-  pushConstantRange.offset = 0;
-  pushConstantRange.size = sizeof(float);
+// Storage image written by planetcompute.comp, linear values like the
+// fragment path writes before sRGB encoding, blitted to the swapchain
+static constexpr VkFormat computeFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+// Matches local_size_x/y of planetcompute.comp
+static constexpr uint32_t computeTileSize = 8;
+
+// Binding 0 the storage image the compute raymarch writes, binding 1 the
+// prepass start distances
+VkDescriptorSetLayout createComputeSetLayout(const VkDevice &device) {
+  std::array<VkDescriptorSetLayoutBinding, 2> bindings{{
+      {
+          .binding = 0,
+          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+          .descriptorCount = 1,
+          .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      },
+      {
+          .binding = 1,
+          .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          .descriptorCount = 1,
+          .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      },
+  }};
+  VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .bindingCount = static_cast<uint32_t>(bindings.size()),
+      .pBindings = bindings.data(),
+  };
+  VkDescriptorSetLayout setLayout;
+  VK_CHECK(vkCreateDescriptorSetLayout(device, &setLayoutCreateInfo, nullptr,
+                                       &setLayout));
+  return setLayout;
+}
 
+VkPipelineLayout
+createComputePipelineLayout(const VkDevice &device,
+                            const VkDescriptorSetLayout &setLayout,
+                            const VkDescriptorSetLayout &frameSetLayout) {
+  VkPushConstantRange pushConstantRange{
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      .offset = 0,
+      .size = sizeof(PushConstants),
+  };
+  std::array<VkDescriptorSetLayout, 2> setLayouts{setLayout, frameSetLayout};
   VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{
       .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-      .setLayoutCount = 0,
-      .pSetLayouts = nullptr,
+      .setLayoutCount = static_cast<uint32_t>(setLayouts.size()),
+      .pSetLayouts = setLayouts.data(),
       .pushConstantRangeCount = 1,
       .pPushConstantRanges = &pushConstantRange,
   };
   VkPipelineLayout pipelineLayout;
-  VK_CHECK(vkCreatePipelineLayout(logicalDevice, &pipelineLayoutCreateInfo,
-                                  nullptr, &pipelineLayout));
+  VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr,
+                                  &pipelineLayout));
   return pipelineLayout;
 }
 
-VkPipeline createPipeline(const VkDevice &logicalDevice,
-                          const VkPipelineLayout &pipelineLayout,
-                          const VkSurfaceCapabilitiesKHR &surfaceCapabilities) {
-  spdlog::info("Create pipeline");
-  VkPipelineVertexInputStateCreateInfo emptyVertexInputStateCreateInfo{
-      .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-      .vertexBindingDescriptionCount = 0,
-      .pVertexBindingDescriptions = nullptr,
-      .vertexAttributeDescriptionCount = 0,
-      .pVertexAttributeDescriptions = nullptr,
-  };
-
-  std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages{};
-
-  // Vertex shader stage of the pipeline
-  shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-  shaderStages[0].module =
-      loadShaderModule(logicalDevice, "shaders/fullscreenquad.spv");
-  shaderStages[0].pName = "main";
-
-  // Fragment shader stage of the pipeline
-  shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-  shaderStages[1].module =
-      loadShaderModule(logicalDevice, "shaders/planet.spv");
-  shaderStages[1].pName = "main";
-
-  VkPipelineRasterizationStateCreateInfo rasterizationStateCreateInfo{
-      .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-      .cullMode = VK_CULL_MODE_FRONT_BIT,
-      .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
-      .lineWidth = 1.0f,
-  };
-
-  VkPipelineViewportStateCreateInfo viewportStateCreateInfo{
-      .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-      .viewportCount = 1,
-      .scissorCount = 1,
-  };
-
-  VkPipelineMultisampleStateCreateInfo multisampleStateCreateInfo{
-      .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-      .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT, // no multisampling
-  };
-
-  VkPipelineInputAssemblyStateCreateInfo assemblyStateCreateInfo{
-      .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-      .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+VkPipeline createComputePipeline(const VkDevice &logicalDevice,
+                                 const VkPipelineLayout &pipelineLayout,
+                                 const VkPipelineCache &pipelineCache,
+                                 ShaderCompiler &shaderCompiler,
+                                 const char *computePath,
+                                 const VkSpecializationInfo *specialization) {
+  spdlog::info("Create compute pipeline for {}", computePath);
+  VkComputePipelineCreateInfo pipelineCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+      .stage =
+          {
+              .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+              .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+              .module = loadShaderModule(logicalDevice,
+                                         shaderCompiler.spirv(computePath)),
+              .pName = "main",
+              .pSpecializationInfo = specialization,
+          },
+      .layout = pipelineLayout,
   };
+  VkPipeline pipeline;
+  auto startT = std::chrono::high_resolution_clock::now();
+  VkResult result = vkCreateComputePipelines(
+      logicalDevice, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline);
+  spdlog::info("vkCreateComputePipelines took {:.3f}ms",
+               std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::high_resolution_clock::now() - startT)
+                       .count() *
+                   1e-3);
+  vkDestroyShaderModule(logicalDevice, pipelineCreateInfo.stage.module,
+                        nullptr);
+  VK_CHECK(result);
+  return pipeline;
+}
 
-  VkPipelineColorBlendAttachmentState blendAttachment{};
-  blendAttachment.colorWriteMask =
-      VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-  blendAttachment.blendEnable = VK_FALSE;
-
-  VkPipelineColorBlendStateCreateInfo blend{
-      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO};
-  blend.attachmentCount = 1;
-  blend.pAttachments = &blendAttachment;
-
-  // Disable all depth testing
-  VkPipelineDepthStencilStateCreateInfo depthStencil{
-      VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
-
-  VkFormat defaultFormat = VK_FORMAT_R8G8B8A8_SRGB;
-
-  VkDynamicState dynamicStates[] = {
-      VK_DYNAMIC_STATE_VIEWPORT,
-      VK_DYNAMIC_STATE_SCISSOR,
+/**
+ * Compute alternative to renderScene: raymarches the extent region of
+ * target (a computeFormat storage image) one tile per workgroup and leaves
+ * it in TRANSFER_SRC for the blit to the swapchain / readback. The
+ * descriptor set must belong to the current frame in flight.
+ **/
+void dispatchScene(const VkDevice &device,
+                   const VkCommandBuffer &commandBuffer,
+                   const OffscreenImage &target, const VkExtent2D &extent,
+                   const VkPipeline &pipeline,
+                   const VkPipelineLayout &pipelineLayout,
+                   const VkDescriptorSet &descriptorSet,
+                   const FrameUniforms &frameUniforms,
+                   const PushConstants &pushConstants) {
+  transitionImage(commandBuffer, target.image, VK_IMAGE_LAYOUT_UNDEFINED,
+                  VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                  VK_ACCESS_SHADER_WRITE_BIT);
+
+  VkDescriptorImageInfo imageInfo{
+      .imageView = target.view,
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
   };
-  VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
-      .dynamicStateCount = 2,
-      .pDynamicStates = dynamicStates,
+  VkWriteDescriptorSet write{
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = descriptorSet,
+      .dstBinding = 0,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+      .pImageInfo = &imageInfo,
   };
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          pipelineLayout, 1, 1, &frameUniforms.descriptorSet,
+                          1, &frameUniforms.offset);
+  vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                     0, sizeof(PushConstants), &pushConstants);
+  vkCmdDispatch(commandBuffer,
+                (extent.width + computeTileSize - 1) / computeTileSize,
+                (extent.height + computeTileSize - 1) / computeTileSize, 1);
+
+  transitionImage(commandBuffer, target.image, VK_IMAGE_LAYOUT_GENERAL,
+                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                  VK_ACCESS_TRANSFER_READ_BIT);
+}
 
-  // for dynamic rendering
-  VkPipelineRenderingCreateInfoKHR dynamicPipelineCreate{
-      VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR};
-  dynamicPipelineCreate.colorAttachmentCount = 1;
-  dynamicPipelineCreate.pColorAttachmentFormats = &defaultFormat;
-  dynamicPipelineCreate.depthAttachmentFormat = VK_FORMAT_D16_UNORM;
-  // dynamicPipelineCreate.pNext = &dynamicStateCreateInfo;
-
-  VkGraphicsPipelineCreateInfo pipelineCreateInfo{
-      .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-      .pNext = &dynamicPipelineCreate,
-      .stageCount = static_cast<uint32_t>(shaderStages.size()),
-      .pStages = shaderStages.data(),
-      .pVertexInputState = &emptyVertexInputStateCreateInfo,
-      .pInputAssemblyState = &assemblyStateCreateInfo,
-      .pViewportState = &viewportStateCreateInfo,
-      .pRasterizationState = &rasterizationStateCreateInfo,
-      .pMultisampleState = &multisampleStateCreateInfo,
-      .pDepthStencilState = &depthStencil,
-      .pColorBlendState = &blend,
-      .pDynamicState = &dynamicStateCreateInfo,
-      .layout = pipelineLayout,
+/**
+ * Records the complete frame of the plain fragment path for every swapchain
+ * image and quality tier, indexed image * qualityTierCount + tier. Nothing
+ * in them changes per frame except the uniform ring slot they read, so they
+ * are submitted again as they are until the swapchain or pipelines change.
+ **/
+std::vector<VkCommandBuffer> recordStaticFrames(
+    const VkDevice &device, const VkCommandPool &commandPool,
+    const std::vector<VkImage> &images,
+    const std::vector<VkImageView> &imageViews, const VkExtent2D &extent,
+    const std::vector<VkPipeline> &pipelines,
+    const VkPipelineLayout &pipelineLayout,
+    const VkDescriptorSet &descriptorSet, const OffscreenImage &prepassTarget,
+    const FrameUniforms &frameUniforms, TimestampReadback &timestamps,
+    const uint32_t &slot) {
+  std::vector<VkCommandBuffer> commandBuffers = createCommandBuffers(
+      device, commandPool, images.size() * pipelines.size());
+  // Checkerboard and the prepass are off whenever these are used
+  PushConstants pushConstants{};
+  // No ONE_TIME_SUBMIT, a buffer is never pending when it is submitted again
+  // because its slot's fence has been waited for
+  VkCommandBufferBeginInfo commandBufferBeginInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
   };
-  spdlog::info("Create the graphics pipeline");
-  VkPipeline pipeline;
-  VK_CHECK(vkCreateGraphicsPipelines(logicalDevice, VK_NULL_HANDLE, 1,
-                                     &pipelineCreateInfo, nullptr, &pipeline));
-  spdlog::info("Created the pipeline");
-  return pipeline;
+  for (size_t image = 0; image < images.size(); image++) {
+    for (size_t tier = 0; tier < pipelines.size(); tier++) {
+      VkCommandBuffer commandBuffer =
+          commandBuffers[image * pipelines.size() + tier];
+      VK_CHECK(vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo));
+      timestamps.begin(commandBuffer, slot);
+      // Only moves the start distance image into the layout set 0 expects
+      recordPrepass(commandBuffer, prepassTarget, extent, VK_NULL_HANDLE,
+                    pipelineLayout, frameUniforms, pushConstants, false);
+      renderScene(images[image], imageViews[image], extent, commandBuffer,
+                  pipelines[tier], pipelineLayout, descriptorSet,
+                  frameUniforms, pushConstants,
+                  VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+      timestamps.end(commandBuffer, slot);
+      VK_CHECK(vkEndCommandBuffer(commandBuffer));
+    }
+  }
+  return commandBuffers;
 }
 
-std::vector<VkFence> createFences(const VkDevice &logicalDevice,
-                                  const uint32_t &count) {
-  std::vector<VkFence> fences(count);
-  for (uint32_t i = 0; i < count; i++) {
-    VkFenceCreateInfo fenceCreateInfo{
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        .flags = static_cast<VkFenceCreateFlags>(
-            (i == 0) ? VK_FENCE_CREATE_SIGNALED_BIT : 0),
-    };
-    VK_CHECK(
-        vkCreateFence(logicalDevice, &fenceCreateInfo, nullptr, &fences[i]));
-  }
-  return fences;
+// Cache files are keyed by the SPIR-V the pipeline is built from
+std::string currentPipelineCachePath(ShaderCompiler &shaderCompiler) {
+  return pipelineCachePath(
+      hashSpirv({shaderCompiler.spirv("shaders/fullscreenquad.vert"),
+                 shaderCompiler.spirv("shaders/planet.frag")}));
 }
 
 VkQueryPool createQueryPool(const VkDevice &logicalDevice,
@@ -875,25 +931,474 @@ VkQueryPool createQueryPool(const VkDevice &logicalDevice,
   return queryPool;
 }
 
-struct WindowData {
-  bool framebufferResized;
-  std::chrono::high_resolution_clock::time_point progStartT;
-};
+/**
+ * Copies a frame in TRANSFER_SRC_OPTIMAL into a tightly packed RGBA8 buffer
+ * the host can read once the frame's fence has signaled. Frames in another
+ * format (the compute target) are first blitted into convertImage, an RGBA8
+ * image of the same extent, VK_NULL_HANDLE when image already is RGBA8.
+ **/
+void readbackFrame(const VkCommandBuffer &commandBuffer, const VkImage &image,
+                   const VkImage &convertImage, const VkExtent2D &extent,
+                   const VkBuffer &buffer) {
+  VkImage source = image;
+  if (convertImage != VK_NULL_HANDLE) {
+    transitionImage(commandBuffer, convertImage, VK_IMAGE_LAYOUT_UNDEFINED,
+                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                    VK_ACCESS_TRANSFER_WRITE_BIT);
+    VkImageBlit region{
+        .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .srcOffsets = {{0, 0, 0},
+                       {static_cast<int32_t>(extent.width),
+                        static_cast<int32_t>(extent.height), 1}},
+        .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .dstOffsets = {{0, 0, 0},
+                       {static_cast<int32_t>(extent.width),
+                        static_cast<int32_t>(extent.height), 1}},
+    };
+    vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   convertImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                   &region, VK_FILTER_NEAREST);
+    transitionImage(commandBuffer, convertImage,
+                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+    source = convertImage;
+  }
 
-int main() {
-  WindowData windowData = {
-      .framebufferResized = false,
-      .progStartT = std::chrono::high_resolution_clock::now(),
+  VkBufferImageCopy copy{
+      .bufferOffset = 0,
+      // Tightly packed
+      .bufferRowLength = 0,
+      .bufferImageHeight = 0,
+      .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+      .imageOffset = {0, 0, 0},
+      .imageExtent = {extent.width, extent.height, 1},
+  };
+  vkCmdCopyImageToBuffer(commandBuffer, source,
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1,
+                         &copy);
+
+  // Makes the copy visible to the host after the fence wait
+  VkBufferMemoryBarrier bufferBarrier{
+      .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .buffer = buffer,
+      .offset = 0,
+      .size = VK_WHOLE_SIZE,
   };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                       &bufferBarrier, 0, nullptr);
+}
 
-  spdlog::set_level(spdlog::level::info);
-  // spdlog::set_level(spdlog::level::err);
-  initGLFW();
-  GLFWwindow *window = createGLFWwindow();
-  bool pipelineUpdated = false;
+// The golden images --golden asks for, nullptr without it
+std::unique_ptr<GoldenCheck> createGoldenCheck(const Options &options) {
+  if (options.goldenDir.empty())
+    return nullptr;
+  std::set<uint32_t> goldenFrames = options.goldenFrames;
+  if (goldenFrames.empty())
+    goldenFrames.insert(options.frames - 1);
+  return std::make_unique<GoldenCheck>(
+      options.goldenDir, goldenFrames, options.updateGolden,
+      options.goldenMinPsnr, options.goldenMaxError);
+}
 
-  glfwSetWindowUserPointer(window, &windowData);
+/**
+ * Renders planet.frag into device owned images for options.frames frames
+ * without GLFW, a surface or a swapchain and reports the throughput.
+ * Works with software implementations such as lavapipe. With an output path
+ * every frame is also copied to a staging buffer and streamed to disk by a
+ * FrameWriter, the loop only hands a buffer over once its fence signaled.
+ **/
+int runHeadless(const Options &options) {
+  // Matches the swapchain formats preferred by selectSwapchainFormat
+  static constexpr VkFormat offscreenFormat = VK_FORMAT_R8G8B8A8_SRGB;
+  const uint32_t framesInFlight = options.framesInFlight;
+
+  VkExtent2D extent{options.width, options.height};
+  spdlog::info("Headless render {}x{} for {} frames", extent.width,
+               extent.height, options.frames);
+
+  VkInstance instance = setupVulkanInstance(true);
+  VkPhysicalDevice physicalDevice = findGPU(instance);
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+  uint32_t graphicsQueueIndex =
+      getVulkanGraphicsQueueIndex(physicalDevice, VK_NULL_HANDLE);
+  VkDevice logicalDevice =
+      createVulkanLogicalDevice(physicalDevice, graphicsQueueIndex, true);
+  loadDeviceFunctions(logicalDevice);
+  VkQueue queue;
+  vkGetDeviceQueue(logicalDevice, graphicsQueueIndex, 0, &queue);
 
+  VkCommandPool commandPool =
+      createCommandPool(logicalDevice, graphicsQueueIndex);
+  VkDescriptorSetLayout sceneSetLayout = createSceneSetLayout(logicalDevice);
+  VkDescriptorSetLayout frameSetLayout = createFrameSetLayout(logicalDevice);
+  VkPipelineLayout pipelineLayout =
+      createPipelineLayout(logicalDevice, sceneSetLayout, frameSetLayout);
+  ShaderCompiler shaderCompiler;
+  std::string cachePath = currentPipelineCachePath(shaderCompiler);
+  VkPipelineCache pipelineCache =
+      loadPipelineCache(logicalDevice, deviceProperties, cachePath);
+  VkDescriptorSetLayout computeSetLayout =
+      createComputeSetLayout(logicalDevice);
+  VkPipelineLayout computePipelineLayout = createComputePipelineLayout(
+      logicalDevice, computeSetLayout, frameSetLayout);
+  VkDescriptorPool computeDescriptorPool;
+  std::vector<VkDescriptorSet> computeDescriptorSets = createDescriptorSets(
+      logicalDevice, computeSetLayout,
+      {{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1},
+       {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1}},
+      framesInFlight, computeDescriptorPool);
+  // The tier never changes here so only its pipelines are built
+  VkSpecializationInfo specialization = qualitySpecialization(options.quality);
+  VkPipeline pipeline =
+      options.compute
+          ? createComputePipeline(logicalDevice, computePipelineLayout,
+                                  pipelineCache, shaderCompiler,
+                                  "shaders/planetcompute.comp",
+                                  &specialization)
+          : createPipeline(logicalDevice, pipelineLayout, offscreenFormat,
+                           pipelineCache, shaderCompiler,
+                           "shaders/planet.frag", &specialization);
+  spdlog::info("Render path: {}", options.compute ? "compute" : "fragment");
+  spdlog::info("Quality: {}", qualityName(options.quality));
+  VkPipeline prepassPipeline = createPipeline(
+      logicalDevice, pipelineLayout, prepassFormat, pipelineCache,
+      shaderCompiler, "shaders/prepass.frag", &specialization);
+  VkDescriptorPool sceneDescriptorPool;
+  std::vector<VkDescriptorSet> sceneDescriptorSets = createDescriptorSets(
+      logicalDevice, sceneSetLayout,
+      {{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1}}, framesInFlight,
+      sceneDescriptorPool);
+  VkSampler nearestSampler = createNearestSampler(logicalDevice);
+  std::vector<OffscreenImage> prepassTargets = createPrepassTargets(
+      physicalDevice, logicalDevice, extent, framesInFlight);
+  spdlog::info("Start distance prepass: {}", options.prepass ? "on" : "off");
+  UniformRing uniformRing = createUniformRing(
+      physicalDevice, logicalDevice, sizeof(ShaderToyUniforms), framesInFlight);
+  VkDescriptorPool frameDescriptorPool;
+  VkDescriptorSet frameDescriptorSet =
+      createDescriptorSets(logicalDevice, frameSetLayout,
+                           {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1}}, 1,
+                           frameDescriptorPool)[0];
+  writeUniformRingDescriptor(logicalDevice, frameDescriptorSet, uniformRing);
+
+  std::vector<OffscreenImage> offscreenImages(framesInFlight);
+  for (auto &offscreenImage : offscreenImages) {
+    offscreenImage =
+        options.compute
+            ? createOffscreenImage(physicalDevice, logicalDevice, extent,
+                                   computeFormat,
+                                   VK_IMAGE_USAGE_STORAGE_BIT |
+                                       VK_IMAGE_USAGE_TRANSFER_SRC_BIT)
+            : createOffscreenImage(physicalDevice, logicalDevice, extent,
+                                   offscreenFormat,
+                                   VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                       VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+  }
+  // The ring is a few frames deeper than the frames in flight so a slow
+  // disk only stalls the loop once the writer is that far behind
+  static constexpr uint32_t outputRingSlack = 4;
+  std::unique_ptr<FrameWriter> frameWriter;
+  // RGBA8 copies of the compute target, which is RGBA16F
+  std::vector<OffscreenImage> convertImages;
+  // Staging buffer each slot's frame was copied into, handed to the writer
+  // once the slot's fence has signaled
+  std::vector<std::optional<uint32_t>> slotStaging(framesInFlight);
+  std::unique_ptr<GoldenCheck> golden = createGoldenCheck(options);
+  if (!options.outputPath.empty() || golden) {
+    // Golden frames are compared on the writer thread too
+    FrameWriter::Inspector inspector;
+    if (golden) {
+      inspector = [&](const uint32_t &frame, const uint8_t *rgba) {
+        if (golden->wants(frame))
+          golden->check(frame, rgba, extent.width, extent.height);
+      };
+    }
+    frameWriter = std::make_unique<FrameWriter>(
+        physicalDevice, logicalDevice, options.outputPath,
+        options.outputFormat, extent, options.timeStep,
+        framesInFlight + outputRingSlack, inspector);
+    if (options.compute) {
+      convertImages.resize(framesInFlight);
+      for (auto &convertImage : convertImages) {
+        // Color attachment only so the image view is valid
+        convertImage = createOffscreenImage(
+            physicalDevice, logicalDevice, extent, offscreenFormat,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+      }
+    }
+  }
+  std::vector<VkCommandBuffer> commandBuffers =
+      createCommandBuffers(logicalDevice, commandPool, framesInFlight);
+  std::vector<VkFence> fences = createFences(logicalDevice, framesInFlight);
+  auto queryPool = createQueryPool(logicalDevice, 2 * framesInFlight);
+  TimestampReadback timestamps(logicalDevice, queryPool, deviceProperties,
+                               framesInFlight);
+  // Keep every frame so the report covers the whole run
+  RollingStats gpuStats(options.frames);
+  RollingStats cpuStats(options.frames);
+  std::vector<int64_t> slotSubmitNs(framesInFlight, 0);
+
+  ShaderToyUniforms uniforms{
+      .iResolution = glm::vec3{extent.width, extent.height, 1.0f},
+  };
+  PushConstants pushConstants{};
+
+  auto startT = std::chrono::high_resolution_clock::now();
+  for (uint32_t frame = 0; frame < options.frames; frame++) {
+    TRACE_SCOPE("frame");
+    uint32_t slot = frame % framesInFlight;
+    {
+      TRACE_SCOPE("vkWaitForFences");
+      VK_CHECK(vkWaitForFences(logicalDevice, 1, &fences[slot], VK_TRUE,
+                               UINT64_MAX));
+    }
+    VK_CHECK(vkResetFences(logicalDevice, 1, &fences[slot]));
+    if (auto gpuTime = timestamps.collect(slot)) {
+      gpuStats.push(*gpuTime);
+      TRACE_GPU("gpu", slotSubmitNs[slot],
+                static_cast<int64_t>(*gpuTime * 1e6));
+    }
+    // Slots finish in frame order so frames are queued in order too
+    if (slotStaging[slot]) {
+      frameWriter->submit(*slotStaging[slot], frame - framesInFlight);
+      slotStaging[slot].reset();
+    }
+
+    auto cpuStart = std::chrono::high_resolution_clock::now();
+    VkCommandBuffer commandBuffer = commandBuffers[slot];
+    VK_CHECK(vkResetCommandBuffer(commandBuffer, 0));
+    VkCommandBufferBeginInfo commandBufferBeginInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    VK_CHECK(vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo));
+    timestamps.begin(commandBuffer, slot);
+
+    float iTime =
+        options.timeStep > 0.0
+            ? static_cast<float>(frame * options.timeStep)
+            : std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::high_resolution_clock::now() - startT)
+                      .count() *
+                  1e-9;
+    uniforms.iTimeDelta = frame == 0 ? 0.0f : iTime - uniforms.iTime;
+    uniforms.iFrameRate =
+        uniforms.iTimeDelta > 0.0f ? 1.0f / uniforms.iTimeDelta : 0.0f;
+    uniforms.iTime = iTime;
+    uniforms.iFrame = frame;
+    uniforms.iDate = options.timeStep > 0.0
+                         ? deterministicDate
+                         : shaderToyDate(std::chrono::system_clock::now());
+    // The fence wait above means the GPU is done with this slot
+    FrameUniforms frameUniforms{
+        .descriptorSet = frameDescriptorSet,
+        .offset = writeUniformRing(uniformRing, slot, uniforms),
+    };
+    pushConstants.prepass = options.prepass ? 1 : 0;
+    recordPrepass(commandBuffer, prepassTargets[slot], extent,
+                  prepassPipeline, pipelineLayout, frameUniforms,
+                  pushConstants, options.prepass);
+    if (options.compute) {
+      writeStartDistance(logicalDevice, computeDescriptorSets[slot], 1,
+                         nearestSampler, prepassTargets[slot]);
+      dispatchScene(logicalDevice, commandBuffer, offscreenImages[slot],
+                    extent, pipeline, computePipelineLayout,
+                    computeDescriptorSets[slot], frameUniforms, pushConstants);
+    } else {
+      writeStartDistance(logicalDevice, sceneDescriptorSets[slot], 0,
+                         nearestSampler, prepassTargets[slot]);
+      renderScene(offscreenImages[slot].image, offscreenImages[slot].view,
+                  extent, commandBuffer, pipeline, pipelineLayout,
+                  sceneDescriptorSets[slot], frameUniforms, pushConstants,
+                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    }
+    // Without an output only the golden frames are read back
+    bool readback =
+        !options.outputPath.empty() || (golden && golden->wants(frame));
+    if (readback) {
+      // Only waits when every staging buffer is queued for writing
+      uint32_t staging = frameWriter->acquire();
+      readbackFrame(commandBuffer, offscreenImages[slot].image,
+                    options.compute ? convertImages[slot].image
+                                    : VK_NULL_HANDLE,
+                    extent, frameWriter->buffer(staging));
+      slotStaging[slot] = staging;
+    }
+
+    timestamps.end(commandBuffer, slot);
+    VK_CHECK(vkEndCommandBuffer(commandBuffer));
+
+    VkSubmitInfo submitInfo{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &commandBuffer,
+    };
+    slotSubmitNs[slot] = trace::nowNs();
+    {
+      TRACE_SCOPE("vkQueueSubmit");
+      VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, fences[slot]));
+    }
+    cpuStats.push(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::high_resolution_clock::now() - cpuStart)
+                      .count() *
+                  1e-6);
+  }
+  VK_CHECK(vkDeviceWaitIdle(logicalDevice));
+  auto endT = std::chrono::high_resolution_clock::now();
+  for (uint32_t slot = 0; slot < framesInFlight; slot++) {
+    if (auto gpuTime = timestamps.collect(slot))
+      gpuStats.push(*gpuTime);
+  }
+  if (frameWriter) {
+    // The last frames in flight, oldest first
+    uint32_t frame =
+        options.frames > framesInFlight ? options.frames - framesInFlight : 0;
+    for (; frame < options.frames; frame++) {
+      uint32_t slot = frame % framesInFlight;
+      if (slotStaging[slot])
+        frameWriter->submit(*slotStaging[slot], frame);
+    }
+    frameWriter->finish();
+    if (!options.outputPath.empty()) {
+      spdlog::info("Wrote {} frames to {}", frameWriter->framesWritten(),
+                   options.outputPath);
+    }
+  }
+  bool goldenPassed = !golden || golden->passed();
+
+  double totalSeconds =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(endT - startT)
+          .count() *
+      1e-9;
+  spdlog::info("Rendered {} frames in {:.3f}s: {:.2f} frames/sec",
+               options.frames, totalSeconds, options.frames / totalSeconds);
+  spdlog::info("GPU frame time: {}", formatStats(gpuStats.summary()));
+  spdlog::info("CPU record + submit time: {}",
+               formatStats(cpuStats.summary()));
+  if (trace::isEnabled())
+    trace::dump(options.tracePath);
+
+  vkDestroyQueryPool(logicalDevice, queryPool, nullptr);
+  for (auto &fence : fences) {
+    vkDestroyFence(logicalDevice, fence, nullptr);
+  }
+  vkFreeCommandBuffers(logicalDevice, commandPool, commandBuffers.size(),
+                       commandBuffers.data());
+  for (auto &offscreenImage : offscreenImages) {
+    destroyOffscreenImage(logicalDevice, offscreenImage);
+  }
+  for (auto &convertImage : convertImages) {
+    destroyOffscreenImage(logicalDevice, convertImage);
+  }
+  if (frameWriter)
+    frameWriter->destroy();
+  for (auto &prepassTarget : prepassTargets) {
+    destroyOffscreenImage(logicalDevice, prepassTarget);
+  }
+  vkDestroyPipeline(logicalDevice, pipeline, nullptr);
+  vkDestroyPipeline(logicalDevice, prepassPipeline, nullptr);
+  savePipelineCache(logicalDevice, pipelineCache, cachePath);
+  vkDestroyPipelineCache(logicalDevice, pipelineCache, nullptr);
+  vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
+  vkDestroyDescriptorPool(logicalDevice, sceneDescriptorPool, nullptr);
+  vkDestroyDescriptorSetLayout(logicalDevice, sceneSetLayout, nullptr);
+  destroyUniformRing(logicalDevice, uniformRing);
+  vkDestroyDescriptorPool(logicalDevice, frameDescriptorPool, nullptr);
+  vkDestroySampler(logicalDevice, nearestSampler, nullptr);
+  vkDestroyDescriptorPool(logicalDevice, computeDescriptorPool, nullptr);
+  vkDestroyPipelineLayout(logicalDevice, computePipelineLayout, nullptr);
+  vkDestroyDescriptorSetLayout(logicalDevice, computeSetLayout, nullptr);
+  vkDestroyDescriptorSetLayout(logicalDevice, frameSetLayout, nullptr);
+  vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
+  vkDestroyDevice(logicalDevice, nullptr);
+  vkDestroyInstance(instance, nullptr);
+  return goldenPassed ? 0 : 1;
+}
+
+/**
+ * Renders planet.frag with the CPU reference renderer for options.frames
+ * frames and reports the throughput, without any Vulkan instance. Checks
+ * the same golden images as runHeadless, which makes it an oracle for GPU
+ * side changes.
+ **/
+int runCpuReference(const Options &options) {
+  uint32_t threads = options.cpuThreads > 0
+                         ? options.cpuThreads
+                         : std::max(1u, std::thread::hardware_concurrency());
+  CpuRenderer renderer(threads);
+  spdlog::info("CPU reference render {}x{} for {} frames", options.width,
+               options.height, options.frames);
+  spdlog::info("{} threads, {} rays per packet", renderer.threadCount(),
+               CpuRenderer::packetWidth());
+  spdlog::info("Quality: {}", qualityName(options.quality));
+  if (options.prepass || options.checkerboard || options.compute)
+    spdlog::warn("The CPU renderer ignores --prepass, --checkerboard and "
+                 "--compute");
+  std::unique_ptr<GoldenCheck> golden = createGoldenCheck(options);
+
+  std::vector<uint8_t> rgba(size_t{options.width} * options.height * 4);
+  RollingStats frameStats(options.frames);
+  double renderSeconds = 0.0;
+  auto startT = std::chrono::high_resolution_clock::now();
+  for (uint32_t frame = 0; frame < options.frames; frame++) {
+    TRACE_SCOPE("frame");
+    auto frameStart = std::chrono::high_resolution_clock::now();
+    float iTime =
+        options.timeStep > 0.0
+            ? static_cast<float>(frame * options.timeStep)
+            : std::chrono::duration<double>(frameStart - startT).count();
+    renderer.render(options.quality, iTime, options.width, options.height,
+                    rgba.data());
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::high_resolution_clock::now() -
+                         frameStart)
+                         .count();
+    renderSeconds += seconds;
+    frameStats.push(seconds * 1e3);
+    if (golden && golden->wants(frame))
+      golden->check(frame, rgba.data(), options.width, options.height);
+  }
+
+  double pixels =
+      static_cast<double>(options.width) * options.height * options.frames;
+  spdlog::info("Rendered {} frames in {:.3f}s: {:.2f} frames/sec, {:.2f} "
+               "Mpixels/sec",
+               options.frames, renderSeconds, options.frames / renderSeconds,
+               pixels / renderSeconds * 1e-6);
+  spdlog::info("CPU frame time: {}", formatStats(frameStats.summary()));
+  if (trace::isEnabled())
+    trace::dump(options.tracePath);
+  return !golden || golden->passed() ? 0 : 1;
+}
+
+struct WindowData {
+  bool framebufferResized;
+  bool dumpTrace;
+  // Checkerboard rendering, toggled with C
+  bool checkerboard;
+  // Start distance prepass, toggled with D
+  bool prepass;
+  // Raymarch quality tier, Q cycles through them
+  Quality quality;
+  std::chrono::high_resolution_clock::time_point progStartT;
+};
+
+// Resize and key handling, the window's user pointer is its WindowData
+void setWindowCallbacks(GLFWwindow *window) {
   glfwSetFramebufferSizeCallback(
       window, [](GLFWwindow *window, int width, int height) {
         WindowData *windowData =
@@ -909,185 +1414,1054 @@ int main() {
           static_cast<WindowData *>(glfwGetWindowUserPointer(window));
       windowData->progStartT = std::chrono::high_resolution_clock::now();
     }
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+      WindowData *windowData =
+          static_cast<WindowData *>(glfwGetWindowUserPointer(window));
+      windowData->dumpTrace = true;
+    }
+    if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+      WindowData *windowData =
+          static_cast<WindowData *>(glfwGetWindowUserPointer(window));
+      windowData->checkerboard = !windowData->checkerboard;
+      spdlog::info("Checkerboard rendering {}",
+                   windowData->checkerboard ? "on" : "off");
+    }
+    if (key == GLFW_KEY_D && action == GLFW_PRESS) {
+      WindowData *windowData =
+          static_cast<WindowData *>(glfwGetWindowUserPointer(window));
+      windowData->prepass = !windowData->prepass;
+      spdlog::info("Start distance prepass {}",
+                   windowData->prepass ? "on" : "off");
+    }
+    if (key == GLFW_KEY_Q && action == GLFW_PRESS) {
+      WindowData *windowData =
+          static_cast<WindowData *>(glfwGetWindowUserPointer(window));
+      windowData->quality = nextQuality(windowData->quality);
+      spdlog::info("Quality {}", qualityName(windowData->quality));
+    }
   });
+}
 
-  VkInstance instance = setupVulkanInstance();
-  VkPhysicalDevice physicalDevice = findGPU(instance);
-  VkPhysicalDeviceProperties deviceProperties;
-  vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
-  enumerateExtensions(physicalDevice);
+int main(int argc, char **argv) {
+  // Time to first present is measured from here
+  const int64_t startNs = trace::nowNs();
+  Options options = parseOptions(argc, argv);
+  spdlog::set_level(spdlog::level::info);
+  trace::setEnabled(!options.tracePath.empty());
+  if (options.cpu) {
+    return runCpuReference(options);
+  }
+  if (options.headless) {
+    return runHeadless(options);
+  }
 
-  VkSurfaceKHR surface = createVulkanSurface(instance, window);
-  uint32_t graphicsQueueIndex =
-      getVulkanGraphicsQueueIndex(physicalDevice, surface);
-  VkDevice logicalDevice =
-      createVulkanLogicalDevice(physicalDevice, graphicsQueueIndex);
-  VkSurfaceCapabilitiesKHR surfaceCapabilities =
-      getSurfaceCapabilities(physicalDevice, surface);
-  VkSurfaceFormatKHR surfaceFormat =
-      selectSwapchainFormat(physicalDevice, surface);
-  VkSwapchainKHR swapchain = createSwapchain(
-      logicalDevice, surface, surfaceCapabilities, surfaceFormat);
-  std::vector<VkImage> swapchainImages =
-      getSwapchainImages(logicalDevice, swapchain);
-  std::vector<VkImageView> swapchainImageViews =
-      createSwapchainImageViews(logicalDevice, swapchainImages, surfaceFormat);
-  VkCommandPool commandPool =
-      createCommandPool(logicalDevice, graphicsQueueIndex);
-  VkPipelineLayout pipelineLayout = createPipelineLayout(logicalDevice);
-  VkPipeline pipeline =
-      createPipeline(logicalDevice, pipelineLayout, surfaceCapabilities);
-  // Create vkqueue
-  VkQueue queue;
-  vkGetDeviceQueue(logicalDevice, graphicsQueueIndex, 0, &queue);
+  WindowData windowData = {
+      .framebufferResized = false,
+      .dumpTrace = false,
+      .checkerboard = options.checkerboard,
+      .prepass = options.prepass,
+      .quality = options.quality,
+      .progStartT = std::chrono::high_resolution_clock::now(),
+  };
 
-  // Command buffers
+  // Startup runs as a task graph: the instance, device and shader loading
+  // overlap with the window, and the pipelines are built while the
+  // swapchain is created. GLFW calls stay on the main thread.
+  GLFWwindow *window = nullptr;
+  VkInstance instance = VK_NULL_HANDLE;
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkPhysicalDeviceProperties deviceProperties;
+  VkSurfaceKHR surface = VK_NULL_HANDLE;
+  uint32_t graphicsQueueIndex = 0;
+  VkDevice logicalDevice = VK_NULL_HANDLE;
+  VkQueue queue = VK_NULL_HANDLE;
+  VkSurfaceCapabilitiesKHR surfaceCapabilities;
+  VkSurfaceFormatKHR surfaceFormat;
+  VkPresentModeKHR presentMode;
+  VkExtent2D swapchainExtent;
+  VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+  std::vector<VkImage> swapchainImages;
+  std::vector<VkImageView> swapchainImageViews;
+  VkCommandPool commandPool = VK_NULL_HANDLE;
+  VkDescriptorSetLayout sceneSetLayout = VK_NULL_HANDLE;
+  VkDescriptorSetLayout frameSetLayout = VK_NULL_HANDLE;
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+  VkDescriptorSetLayout computeSetLayout = VK_NULL_HANDLE;
+  VkPipelineLayout computePipelineLayout = VK_NULL_HANDLE;
+  VkDescriptorSetLayout resolveSetLayout = VK_NULL_HANDLE;
+  VkPipelineLayout resolvePipelineLayout = VK_NULL_HANDLE;
+  VkPipeline resolvePipeline = VK_NULL_HANDLE;
+  // Shared by the watcher (compiles) and pipeline builder (reads SPIR-V)
+  ShaderCompiler shaderCompiler;
+  // Written by the pipeline builder thread, read after it has stopped
+  std::string cachePath;
+  VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+  // The render path is picked at startup, hot reload rebuilds the one in use.
+  // Every quality tier is built so switching tiers never compiles.
+  // Set once from the surface format, before any pipeline is built
+  VkFormat pipelineFormat = VK_FORMAT_UNDEFINED;
+  auto destroyPipeline = [&](VkPipeline builtPipeline) {
+    vkDestroyPipeline(logicalDevice, builtPipeline, nullptr);
+  };
+  auto buildPipelines = [&]() {
+    return buildQualityPipelines(
+        [&](const VkSpecializationInfo &specialization) {
+          if (options.compute) {
+            return createComputePipeline(logicalDevice, computePipelineLayout,
+                                         pipelineCache, shaderCompiler,
+                                         "shaders/planetcompute.comp",
+                                         &specialization);
+          }
+          return createPipeline(logicalDevice, pipelineLayout, pipelineFormat,
+                                pipelineCache, shaderCompiler,
+                                "shaders/planet.frag", &specialization);
+        },
+        destroyPipeline);
+  };
+  // The prepass marches with the same step count and distances as the tier
+  auto buildPrepassPipelines = [&]() {
+    return buildQualityPipelines(
+        [&](const VkSpecializationInfo &specialization) {
+          return createPipeline(logicalDevice, pipelineLayout, prepassFormat,
+                                pipelineCache, shaderCompiler,
+                                "shaders/prepass.frag", &specialization);
+        },
+        destroyPipeline);
+  };
+  std::vector<VkPipeline> pipelines;
+  std::vector<VkPipeline> prepassPipelines;
+
+  using Affinity = TaskGraph::Affinity;
+  TaskGraph startup(3);
+  auto glfwReady = startup.add("initGLFW", Affinity::Main, {}, initGLFW);
+  auto windowReady =
+      startup.add("createWindow", Affinity::Main, {glfwReady}, [&]() {
+        window = createGLFWwindow();
+        glfwSetWindowUserPointer(window, &windowData);
+        setWindowCallbacks(window);
+      });
+  // Only asks GLFW for the surface extensions, which any thread may do
+  auto instanceReady = startup.add(
+      "setupVulkanInstance", Affinity::Worker, {glfwReady},
+      [&]() { instance = setupVulkanInstance(false); });
+  auto gpuReady =
+      startup.add("findGPU", Affinity::Worker, {instanceReady}, [&]() {
+        physicalDevice = findGPU(instance);
+        vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+        enumerateExtensions(physicalDevice);
+      });
+  // Reads the SPIR-V every startup pipeline needs into the compiler's cache
+  // and hashes it for the pipeline cache path, no device needed
+  auto shadersReady = startup.add("loadShaders", Affinity::Worker, {}, [&]() {
+    std::vector<const char *> paths = {
+        "shaders/fullscreenquad.vert", "shaders/planet.frag",
+        "shaders/prepass.frag", "shaders/checkerresolve.frag"};
+    if (options.compute)
+      paths.push_back("shaders/planetcompute.comp");
+    for (const char *path : paths)
+      shaderCompiler.spirv(path);
+    cachePath = currentPipelineCachePath(shaderCompiler);
+  });
+  auto surfaceReady = startup.add(
+      "createSurface", Affinity::Main, {windowReady, instanceReady},
+      [&]() { surface = createVulkanSurface(instance, window); });
+  auto deviceReady = startup.add(
+      "createDevice", Affinity::Worker, {gpuReady, surfaceReady}, [&]() {
+        graphicsQueueIndex =
+            getVulkanGraphicsQueueIndex(physicalDevice, surface);
+        logicalDevice = createVulkanLogicalDevice(physicalDevice,
+                                                  graphicsQueueIndex, false);
+        loadDeviceFunctions(logicalDevice);
+        vkGetDeviceQueue(logicalDevice, graphicsQueueIndex, 0, &queue);
+        commandPool = createCommandPool(logicalDevice, graphicsQueueIndex);
+      });
+  // The extent comes from the framebuffer size, only the main thread may
+  // ask GLFW for it
+  auto formatReady = startup.add(
+      "selectSurfaceFormat", Affinity::Main, {gpuReady, surfaceReady},
+      [&]() {
+        surfaceCapabilities = getSurfaceCapabilities(physicalDevice, surface);
+        surfaceFormat = selectSwapchainFormat(physicalDevice, surface);
+        presentMode =
+            selectPresentMode(physicalDevice, surface, options.presentMode);
+        swapchainExtent = selectSwapchainExtent(surfaceCapabilities, window);
+        pipelineFormat = surfaceFormat.format;
+        spdlog::info("Render path: {}",
+                     options.compute ? "compute" : "fragment");
+        if (options.compute && !canBlitToSwapchain(physicalDevice,
+                                                   surfaceCapabilities,
+                                                   computeFormat)) {
+          throw std::runtime_error(
+              "Compute path needs to blit its storage image to the swapchain");
+        }
+      });
+  // MoltenVK sets up the window's CAMetalLayer for the swapchain
+  startup.add("createSwapchain", Affinity::Main, {deviceReady, formatReady},
+              [&]() {
+                swapchain = createSwapchain(logicalDevice, surface,
+                                            surfaceCapabilities, surfaceFormat,
+                                            presentMode, swapchainExtent,
+                                            VK_NULL_HANDLE);
+                swapchainImages = getSwapchainImages(logicalDevice, swapchain);
+                swapchainImageViews = createSwapchainImageViews(
+                    logicalDevice, swapchainImages, surfaceFormat);
+              });
+  auto layoutsReady = startup.add(
+      "createLayouts", Affinity::Worker, {deviceReady, shadersReady}, [&]() {
+        sceneSetLayout = createSceneSetLayout(logicalDevice);
+        frameSetLayout = createFrameSetLayout(logicalDevice);
+        pipelineLayout =
+            createPipelineLayout(logicalDevice, sceneSetLayout, frameSetLayout);
+        computeSetLayout = createComputeSetLayout(logicalDevice);
+        computePipelineLayout = createComputePipelineLayout(
+            logicalDevice, computeSetLayout, frameSetLayout);
+        resolveSetLayout = createResolveSetLayout(logicalDevice);
+        resolvePipelineLayout =
+            createResolvePipelineLayout(logicalDevice, resolveSetLayout);
+        pipelineCache =
+            loadPipelineCache(logicalDevice, deviceProperties, cachePath);
+      });
+  startup.add("buildPipelines", Affinity::Worker, {layoutsReady, formatReady},
+              [&]() { pipelines = buildPipelines(); });
+  startup.add("buildPrepassPipelines", Affinity::Worker, {layoutsReady},
+              [&]() { prepassPipelines = buildPrepassPipelines(); });
+  startup.add("buildResolvePipeline", Affinity::Worker,
+              {layoutsReady, formatReady}, [&]() {
+                resolvePipeline = createPipeline(
+                    logicalDevice, resolvePipelineLayout, surfaceFormat.format,
+                    pipelineCache, shaderCompiler,
+                    "shaders/checkerresolve.frag");
+              });
+  startup.run();
+
+  // Per frame in flight: command buffer, fence, acquire semaphore and
+  // timestamp slot. Independent of the swapchain image count.
+  const uint32_t framesInFlight = options.framesInFlight;
+  spdlog::info("Frames in flight: {}", framesInFlight);
   std::vector<VkCommandBuffer> commandBuffers =
-      createCommandBuffers(logicalDevice, commandPool, swapchainImages.size());
-
-  // Create fences and semaphores
-  std::vector<VkFence> fences =
-      createFences(logicalDevice, swapchainImages.size());
+      createCommandBuffers(logicalDevice, commandPool, framesInFlight);
+  std::vector<VkFence> fences = createFences(logicalDevice, framesInFlight);
   std::vector<VkSemaphore> imageAvailableSemaphores =
-      createSemaphores(logicalDevice, swapchainImages.size());
-  std::vector<VkSemaphore> renderFinishedSemaphore =
-      createSemaphores(logicalDevice, swapchainImages.size());
+      createSemaphores(logicalDevice, framesInFlight);
 
-  auto queryPool = createQueryPool(logicalDevice, 2 * swapchainImages.size());
+  // Per swapchain image: the present wait semaphore and the fence of the
+  // frame currently rendering to it (VK_NULL_HANDLE when none)
+  std::vector<VkSemaphore> renderFinishedSemaphores =
+      createSemaphores(logicalDevice, swapchainImages.size());
+  std::vector<VkFence> imagesInFlight(swapchainImages.size(), VK_NULL_HANDLE);
+
+  auto queryPool = createQueryPool(logicalDevice, 2 * framesInFlight);
+  TimestampReadback timestamps(logicalDevice, queryPool, deviceProperties,
+                               framesInFlight);
+  // A replay drives the loop from its frames and reports over all of them
+  std::vector<CapturedFrame> replayFrames;
+  if (!options.replayPath.empty()) {
+    replayFrames = readCapture(options.replayPath);
+    if (replayFrames.empty()) {
+      throw std::runtime_error(
+          fmt::format("{} has no frames", options.replayPath));
+    }
+    spdlog::info("Replaying {} frames from {} at {} pace",
+                 replayFrames.size(), options.replayPath,
+                 options.replayPace == ReplayPace::Fast ? "fast"
+                                                        : "recorded");
+  }
+  size_t statsWindow = replayFrames.empty() ? 256 : replayFrames.size();
+  RollingStats cpuStats(statsWindow);
+  RollingStats gpuStats(statsWindow);
+  auto lastTitleT = std::chrono::high_resolution_clock::now();
+  auto lastWallReportT = lastTitleT;
+  // CPU time each query slot was submitted, anchors the GPU trace intervals
+  std::vector<int64_t> slotSubmitNs(framesInFlight, 0);
+
+  // With a GPU budget the scene is rendered into a window sized target per
+  // frame in flight, only the scaled region is drawn and blitted up
+  double gpuBudgetMs = options.gpuBudgetMs;
+  if (gpuBudgetMs > 0.0 && !canBlitToSwapchain(physicalDevice,
+                                               surfaceCapabilities,
+                                               surfaceFormat.format)) {
+    spdlog::warn("Swapchain cannot be blitted to, dynamic resolution off");
+    gpuBudgetMs = 0.0;
+  }
+  ResolutionController resolution(gpuBudgetMs, 0.25f, 1.0f);
+  VkFilter upscaleFilter = selectUpscaleFilter(
+      physicalDevice, options.compute ? computeFormat : surfaceFormat.format);
+  // The compute path always writes a storage image and blits it
+  auto createSceneTargets = [&]() {
+    std::vector<OffscreenImage> targets;
+    if (!resolution.enabled() && !options.compute)
+      return targets;
+    targets.resize(framesInFlight);
+    for (auto &target : targets) {
+      target = options.compute
+                   ? createOffscreenImage(physicalDevice, logicalDevice,
+                                          swapchainExtent, computeFormat,
+                                          VK_IMAGE_USAGE_STORAGE_BIT |
+                                              VK_IMAGE_USAGE_TRANSFER_SRC_BIT)
+                   : createOffscreenImage(physicalDevice, logicalDevice,
+                                          swapchainExtent, surfaceFormat.format,
+                                          VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                              VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+    }
+    return targets;
+  };
+  std::vector<OffscreenImage> sceneTargets = createSceneTargets();
+  std::vector<OffscreenImage> prepassTargets = createPrepassTargets(
+      physicalDevice, logicalDevice, swapchainExtent, framesInFlight);
+  VkDescriptorPool sceneDescriptorPool;
+  std::vector<VkDescriptorSet> sceneDescriptorSets = createDescriptorSets(
+      logicalDevice, sceneSetLayout,
+      {{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1}}, framesInFlight,
+      sceneDescriptorPool);
+  VkDescriptorPool computeDescriptorPool;
+  std::vector<VkDescriptorSet> computeDescriptorSets = createDescriptorSets(
+      logicalDevice, computeSetLayout,
+      {{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1},
+       {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1}},
+      framesInFlight, computeDescriptorPool);
+  // One slot per frame in flight, a single set selects it by offset
+  UniformRing uniformRing = createUniformRing(
+      physicalDevice, logicalDevice, sizeof(ShaderToyUniforms), framesInFlight);
+  VkDescriptorPool frameDescriptorPool;
+  VkDescriptorSet frameDescriptorSet =
+      createDescriptorSets(logicalDevice, frameSetLayout,
+                           {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1}}, 1,
+                           frameDescriptorPool)[0];
+  writeUniformRingDescriptor(logicalDevice, frameDescriptorSet, uniformRing);
+
+  // Checkerboard mode also finishes with a blit to the swapchain, it only
+  // exists for the fragment path
+  bool checkerboardSupported =
+      !options.compute && canBlitToSwapchain(physicalDevice,
+                                             surfaceCapabilities,
+                                             surfaceFormat.format);
+  if (!checkerboardSupported)
+    spdlog::warn("Checkerboard mode unavailable");
+  VkSampler nearestSampler = createNearestSampler(logicalDevice);
+  VkDescriptorPool resolveDescriptorPool;
+  std::vector<VkDescriptorSet> resolveDescriptorSets =
+      createDescriptorSets(logicalDevice, resolveSetLayout,
+                           {{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2}},
+                           framesInFlight, resolveDescriptorPool);
+  auto createCheckerboard = [&]() {
+    CheckerboardTargets targets;
+    if (checkerboardSupported) {
+      targets = createCheckerboardTargets(physicalDevice, logicalDevice,
+                                          swapchainExtent,
+                                          surfaceFormat.format, framesInFlight);
+    }
+    return targets;
+  };
+  CheckerboardTargets checkerboardTargets = createCheckerboard();
+
+  // Shadertoy style multi-pass demo: Buffer A-C feed the Image pass, which
+  // is blitted to the swapchain
+  bool passesSupported =
+      options.passes && !options.wall &&
+      hasDeviceExtension(physicalDevice, "VK_KHR_synchronization2") &&
+      canBlitToSwapchain(physicalDevice, surfaceCapabilities,
+                         surfaceFormat.format);
+  if (options.passes && !passesSupported)
+    spdlog::warn("Pass graph unavailable, rendering the single pass scene");
+  std::optional<PassGraph> passGraph;
+  VkPipelineLayout passPipelineLayout = VK_NULL_HANDLE;
+  // Read by the pass callbacks while the graph records
+  FrameUniforms passUniforms{};
+  size_t passTier = 0;
+  // Fragment shader and target format of each pass, in graph order
+  // Buffers hold linear HDR colour like the compute target
+  const VkFormat bufferFormat = computeFormat;
+  const std::array<std::pair<const char *, VkFormat>, 4> passShaders{{
+      {"shaders/buffera.frag", bufferFormat},
+      {"shaders/bufferb.frag", bufferFormat},
+      {"shaders/bufferc.frag", bufferFormat},
+      {"shaders/image.frag", surfaceFormat.format},
+  }};
+  // Buffer A raymarches planet.glsl so it has one pipeline per quality
+  // tier, indexed by Quality, followed by one for each later pass
+  auto buildPassPipelines = [&]() {
+    std::vector<VkPipeline> built = buildQualityPipelines(
+        [&](const VkSpecializationInfo &specialization) {
+          return createPipeline(logicalDevice, passPipelineLayout,
+                                passShaders[0].second, pipelineCache,
+                                shaderCompiler, passShaders[0].first,
+                                &specialization);
+        },
+        destroyPipeline);
+    try {
+      for (size_t i = 1; i < passShaders.size(); i++) {
+        auto &[path, format] = passShaders[i];
+        built.push_back(createPipeline(logicalDevice, passPipelineLayout,
+                                       format, pipelineCache, shaderCompiler,
+                                       path));
+      }
+    } catch (...) {
+      for (auto &builtPipeline : built)
+        destroyPipeline(builtPipeline);
+      throw;
+    }
+    return built;
+  };
+  std::vector<VkPipeline> passPipelines;
+  // Pipeline of a pass at the tier being recorded
+  auto passPipeline = [&](const size_t &pass) {
+    return pass == 0 ? passPipelines[passTier]
+                     : passPipelines[qualityTierCount + pass - 1];
+  };
+  if (passesSupported) {
+    passGraph.emplace(physicalDevice, logicalDevice, framesInFlight);
+    passPipelineLayout = createPipelineLayout(
+        logicalDevice, passGraph->channelSetLayout(), frameSetLayout);
+    passPipelines = buildPassPipelines();
+    auto recordPass = [&](const size_t &index) {
+      return [&, index](const VkCommandBuffer &commandBuffer,
+                        const VkDescriptorSet &channels) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          passPipeline(index));
+        std::array<VkDescriptorSet, 2> descriptorSets{
+            channels, passUniforms.descriptorSet};
+        vkCmdBindDescriptorSets(commandBuffer,
+                                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                passPipelineLayout, 0, descriptorSets.size(),
+                                descriptorSets.data(), 1,
+                                &passUniforms.offset);
+        PushConstants passConstants{};
+        vkCmdPushConstants(commandBuffer, passPipelineLayout,
+                           VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                           sizeof(PushConstants), &passConstants);
+        vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+      };
+    };
+    PassImage bufferA = passGraph->addImage("Buffer A", bufferFormat,
+                                            PassImageKind::Transient);
+    PassImage bufferB = passGraph->addImage("Buffer B", bufferFormat,
+                                            PassImageKind::History);
+    PassImage bufferC = passGraph->addImage("Buffer C", bufferFormat,
+                                            PassImageKind::Transient);
+    PassImage image = passGraph->addImage("Image", surfaceFormat.format,
+                                          PassImageKind::Output);
+    passGraph->addPass("Buffer A", {}, bufferA, recordPass(0));
+    passGraph->addPass("Buffer B", {{bufferA}, {bufferB, true}}, bufferB,
+                       recordPass(1));
+    passGraph->addPass("Buffer C", {{bufferB}}, bufferC, recordPass(2));
+    passGraph->addPass("Image", {{bufferB}, {bufferC}}, image, recordPass(3));
+    passGraph->build(swapchainExtent);
+    spdlog::info("Render path: pass graph");
+  }
+  // Split the fragment path's draw into tiles recorded on worker threads
+  std::optional<JobSystem> jobs;
+  std::optional<TileRecorder> tileRecorder;
+  if (options.tiles > 1) {
+    uint32_t workers = options.recordThreads;
+    if (workers == 0)
+      workers = std::max(1u, std::thread::hardware_concurrency());
+    jobs.emplace(workers);
+    tileRecorder.emplace(logicalDevice, graphicsQueueIndex, *jobs,
+                         framesInFlight);
+    spdlog::info("Tiles: {0}x{0}", options.tiles);
+  }
+  // Every fragment shader in shaders/ side by side, one pipeline each
+  std::vector<std::string> wallShaders;
+  std::optional<ShaderWall> wall;
+  VkQueryPool wallQueryPool = VK_NULL_HANDLE;
+  // A shader that fails to compile or build leaves its tile empty
+  auto buildWallPipelines = [&]() {
+    std::vector<VkPipeline> built;
+    for (auto &path : wallShaders) {
+      VkPipeline wallPipeline = VK_NULL_HANDLE;
+      // Shaders without a build step have no .spv to start from
+      ShaderCompileResult compiled = shaderCompiler.compile(path);
+      logDiagnostics(compiled.diagnostics);
+      if (compiled.success) {
+        try {
+          wallPipeline = createPipeline(
+              logicalDevice, wall->pipelineLayout(), surfaceFormat.format,
+              pipelineCache, shaderCompiler, path.c_str());
+        } catch (const std::exception &e) {
+          spdlog::warn("Shader wall skips {}: {}", path, e.what());
+        }
+      }
+      built.push_back(wallPipeline);
+    }
+    return built;
+  };
+  std::vector<VkPipeline> wallPipelines;
+  if (options.wall) {
+    wallShaders = findWallShaders("shaders");
+    wallQueryPool = createQueryPool(
+        logicalDevice,
+        ShaderWall::queryCount(wallShaders.size(), framesInFlight));
+    wall.emplace(physicalDevice, logicalDevice, wallQueryPool,
+                 deviceProperties, wallShaders, framesInFlight,
+                 frameSetLayout);
+    wallPipelines = buildWallPipelines();
+    spdlog::info("Render path: shader wall");
+  }
+  // Extent the previous frame resolved history at, zero when there is no
+  // usable history
+  VkExtent2D historyExtent{0, 0};
+
+  // Objects retired during the frame loop wait here until the frames that
+  // used them have completed
+  DeletionQueue deletionQueue;
+  // Frame each fence was last submitted with, -1 when none
+  std::vector<int64_t> fenceFrame(framesInFlight, -1);
+  int64_t completedFrame = -1;
+
+  // Only the plain fragment path, straight into the swapchain, is the same
+  // every frame. Checkerboard and the prepass record per frame while on.
+  bool prerecordSupported = options.prerecord && !options.compute &&
+                            !resolution.enabled() && !passGraph &&
+                            !tileRecorder && !wall;
+  if (options.prerecord && !prerecordSupported)
+    spdlog::warn("Prerecorded command buffers need the plain fragment path");
+  // Per frame in flight, recordStaticFrames() output or empty when stale
+  std::vector<std::vector<VkCommandBuffer>> prerecorded(framesInFlight);
+  int iFrame = 0;
+  // Frames already submitted may still use them, so they are freed later
+  auto invalidatePrerecorded = [&]() {
+    for (auto &slotBuffers : prerecorded) {
+      if (slotBuffers.empty())
+        continue;
+      deletionQueue.push(iFrame - 1, [=]() {
+        vkFreeCommandBuffers(logicalDevice, commandPool, slotBuffers.size(),
+                             slotBuffers.data());
+      });
+      slotBuffers.clear();
+    }
+  };
 
-  FWatcher watcher("shaders", std::chrono::milliseconds(300), [&]() {
-    pipelineUpdated = true;
-    spdlog::info("Shaders changed");
-  });
+  PipelineBuilder pipelineBuilder(
+      [&]() {
+        std::vector<VkPipeline> builtPipelines = buildPipelines();
+        cachePath = currentPipelineCachePath(shaderCompiler);
+        savePipelineCache(logicalDevice, pipelineCache, cachePath);
+        return builtPipelines;
+      },
+      destroyPipeline);
+  // The prepass marches the same map() so it is rebuilt alongside, the cache
+  // is saved by the main builder only
+  PipelineBuilder prepassBuilder(buildPrepassPipelines, destroyPipeline);
+  PipelineBuilder passBuilder(buildPassPipelines, destroyPipeline);
+  PipelineBuilder wallBuilder(buildWallPipelines, destroyPipeline);
+
+  FWatcher watcher("shaders", std::chrono::milliseconds(300), shaderCompiler,
+                   [&]() {
+                     spdlog::info("Shaders changed");
+                     pipelineBuilder.requestRebuild();
+                     prepassBuilder.requestRebuild();
+                     if (passGraph)
+                       passBuilder.requestRebuild();
+                     if (wall)
+                       wallBuilder.requestRebuild();
+                   });
   watcher.start();
 
-  uint32_t currentImage = 0;
-  int iFrame = 0;
+  // Set when acquire or present report the swapchain no longer matches
+  bool swapchainOutOfDate = false;
   std::chrono::high_resolution_clock::time_point cpuStart, cpuEnd;
-  PushConstants pushConstants;
+  ShaderToyUniforms uniforms{};
+  PushConstants pushConstants{};
+  // Where the left button went down, in render pixels, and whether it is
+  // still held
+  glm::vec2 mouseClick{0.0f, 0.0f};
+  bool mouseDown = false;
+  std::unique_ptr<CaptureWriter> captureWriter;
+  if (!options.capturePath.empty())
+    captureWriter = std::make_unique<CaptureWriter>(options.capturePath);
+  // The next capture frame to replay, only advanced once a frame is
+  // recorded so frames skipped by a continue are replayed by the next loop
+  size_t replayIndex = 0;
+  VkExtent2D replaySize{0, 0};
+  auto sessionStartT = std::chrono::high_resolution_clock::now();
+  const int64_t loopStartNs = trace::nowNs();
   while (!glfwWindowShouldClose(window)) {
+    TRACE_SCOPE("frame");
     cpuStart = std::chrono::high_resolution_clock::now();
-    glfwPollEvents();
-    if (windowData.framebufferResized) {
-      VK_CHECK(vkDeviceWaitIdle(logicalDevice));
-      for (auto &imageView : swapchainImageViews)
-        vkDestroyImageView(logicalDevice, imageView, nullptr);
-      vkDestroySwapchainKHR(logicalDevice, swapchain, nullptr);
-      for (auto &fence : fences) {
-        vkDestroyFence(logicalDevice, fence, nullptr);
+    {
+      TRACE_SCOPE("glfwPollEvents");
+      glfwPollEvents();
+    }
+    if (windowData.dumpTrace) {
+      if (trace::isEnabled()) {
+        trace::dump(options.tracePath);
+      } else {
+        spdlog::warn("Tracing is off, run with --trace <prefix>");
       }
-
+      windowData.dumpTrace = false;
+    }
+    // Replayed input overrides the window's
+    const CapturedFrame *replayed = nullptr;
+    if (!replayFrames.empty()) {
+      if (replayIndex == replayFrames.size())
+        break;
+      replayed = &replayFrames[replayIndex];
+      if (options.replayPace == ReplayPace::Recorded) {
+        auto due = std::chrono::duration<double>(replayed->wallTime);
+        std::this_thread::sleep_until(
+            sessionStartT +
+            std::chrono::duration_cast<std::chrono::nanoseconds>(due));
+      }
+      windowData.checkerboard = replayed->checkerboard;
+      windowData.prepass = replayed->prepass;
+      windowData.quality = replayed->quality;
+      // Asks for the captured size once per change, the resize then goes
+      // through the framebuffer callback like an interactive one
+      if (replayed->framebufferWidth != replaySize.width ||
+          replayed->framebufferHeight != replaySize.height) {
+        replaySize = {replayed->framebufferWidth, replayed->framebufferHeight};
+        int framebufferWidth, framebufferHeight, windowWidth, windowHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        glfwGetWindowSize(window, &windowWidth, &windowHeight);
+        // Window sizes are in screen coordinates, which are smaller than
+        // pixels on high DPI screens
+        glfwSetWindowSize(
+            window,
+            replaySize.width * windowWidth / std::max(framebufferWidth, 1),
+            replaySize.height * windowHeight / std::max(framebufferHeight, 1));
+      }
+    }
+    // Resize events arrive in bursts while the window is dragged, they only
+    // set a flag so the swapchain is recreated at most once per frame
+    if (windowData.framebufferResized || swapchainOutOfDate) {
       surfaceCapabilities = getSurfaceCapabilities(physicalDevice, surface);
-      surfaceFormat = selectSwapchainFormat(physicalDevice, surface);
-      swapchain = createSwapchain(logicalDevice, surface, surfaceCapabilities,
-                                  surfaceFormat);
-      swapchainImages = getSwapchainImages(logicalDevice, swapchain);
-      swapchainImageViews = createSwapchainImageViews(
-          logicalDevice, swapchainImages, surfaceFormat);
-
-      fences = createFences(logicalDevice, swapchainImages.size());
-      currentImage = 0;
+      VkExtent2D extent = selectSwapchainExtent(surfaceCapabilities, window);
+      if (extent.width == 0 || extent.height == 0) {
+        // Minimized, nothing can be presented until the window comes back
+        glfwWaitEvents();
+        continue;
+      }
+      if (swapchainOutOfDate || extent.width != swapchainExtent.width ||
+          extent.height != swapchainExtent.height) {
+        TRACE_SCOPE("recreateSwapchain");
+        VkSwapchainKHR oldSwapchain = swapchain;
+        std::vector<VkImageView> oldImageViews = swapchainImageViews;
+        std::vector<VkSemaphore> oldSemaphores = renderFinishedSemaphores;
+
+        swapchainExtent = extent;
+        swapchain =
+            createSwapchain(logicalDevice, surface, surfaceCapabilities,
+                            surfaceFormat, presentMode, swapchainExtent,
+                            oldSwapchain);
+        swapchainImages = getSwapchainImages(logicalDevice, swapchain);
+        swapchainImageViews = createSwapchainImageViews(
+            logicalDevice, swapchainImages, surfaceFormat);
+        renderFinishedSemaphores =
+            createSemaphores(logicalDevice, swapchainImages.size());
+        imagesInFlight.assign(swapchainImages.size(), VK_NULL_HANDLE);
+
+        // Frames already submitted may still render to and present the old
+        // images. Once the first frame on the new swapchain completes, the
+        // queue is past all of their present waits.
+        deletionQueue.push(iFrame, [=]() {
+          for (auto &imageView : oldImageViews)
+            vkDestroyImageView(logicalDevice, imageView, nullptr);
+          for (auto &semaphore : oldSemaphores)
+            vkDestroySemaphore(logicalDevice, semaphore, nullptr);
+          vkDestroySwapchainKHR(logicalDevice, oldSwapchain, nullptr);
+        });
+
+        std::vector<OffscreenImage> oldSceneTargets = sceneTargets;
+        std::vector<OffscreenImage> oldPrepassTargets = prepassTargets;
+        CheckerboardTargets oldCheckerboardTargets = checkerboardTargets;
+        sceneTargets = createSceneTargets();
+        prepassTargets = createPrepassTargets(physicalDevice, logicalDevice,
+                                              swapchainExtent, framesInFlight);
+        checkerboardTargets = createCheckerboard();
+        historyExtent = VkExtent2D{0, 0};
+        deletionQueue.push(iFrame - 1, [=]() {
+          for (auto &target : oldSceneTargets)
+            destroyOffscreenImage(logicalDevice, target);
+          for (auto &target : oldPrepassTargets)
+            destroyOffscreenImage(logicalDevice, target);
+          destroyCheckerboardTargets(logicalDevice, oldCheckerboardTargets);
+        });
+        if (passGraph) {
+          deletionQueue.push(iFrame - 1, passGraph->releaseImages());
+          passGraph->build(swapchainExtent);
+        }
+        invalidatePrerecorded();
+      }
       windowData.framebufferResized = false;
-
-      continue;
+      swapchainOutOfDate = false;
     }
-    if (pipelineUpdated) {
-      VK_CHECK(vkDeviceWaitIdle(logicalDevice));
-      vkDestroyPipeline(logicalDevice, pipeline, nullptr);
-      pipeline =
-          createPipeline(logicalDevice, pipelineLayout, surfaceCapabilities);
-      pipelineUpdated = false;
+    // Swap in hot reloaded pipelines at the frame boundary, the old ones are
+    // destroyed once the frames that used them have finished
+    std::vector<VkPipeline> rebuiltPipelines = pipelineBuilder.takeReady();
+    if (!rebuiltPipelines.empty()) {
+      std::vector<VkPipeline> oldPipelines = pipelines;
+      deletionQueue.push(iFrame - 1, [=]() {
+        for (auto &oldPipeline : oldPipelines)
+          vkDestroyPipeline(logicalDevice, oldPipeline, nullptr);
+      });
+      pipelines = rebuiltPipelines;
+      spdlog::info("Swapped in rebuilt pipelines");
+      invalidatePrerecorded();
     }
-
-    // Wait for the fence from the last frame before acquiring next image
-    VK_CHECK(vkWaitForFences(logicalDevice, 1, &fences[currentImage], VK_TRUE,
-                             UINT64_MAX));
-    VK_CHECK(vkResetFences(logicalDevice, 1, &fences[currentImage]));
-
-    uint32_t imageIndex = acquireNextImage(
-        logicalDevice, imageAvailableSemaphores[currentImage], swapchain);
-    VK_CHECK(vkResetCommandBuffer(commandBuffers[imageIndex], 0));
-
-    // spdlog::info("Image index: {}", imageIndex);
-
-    VkCommandBufferBeginInfo commandBufferBeginInfo{
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT,
-    };
-
-    VK_CHECK(vkBeginCommandBuffer(commandBuffers[imageIndex],
-                                  &commandBufferBeginInfo));
-    // Start GPU Timestamp
-    vkCmdResetQueryPool(commandBuffers[currentImage], queryPool,
-                        currentImage * 2, 2);
-
-    vkCmdWriteTimestamp(commandBuffers[imageIndex],
-                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool,
-                        currentImage * 2);
-
-    std::chrono::high_resolution_clock::time_point currentT =
-        std::chrono::high_resolution_clock::now();
-
-    float iTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
-                      currentT - windowData.progStartT)
-                      .count() *
-                  1e-9;
-
-    double xpos, ypos;
-    glfwGetCursorPos(window, &xpos, &ypos);
-
-    pushConstants.iTime = iTime;
-    pushConstants.iFrame = iFrame;
-    pushConstants.iResolution =
-        glm::vec2{surfaceCapabilities.currentExtent.width,
-                  surfaceCapabilities.currentExtent.height};
-    if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
-      pushConstants.iMouse = glm::vec2{xpos, ypos};
+    std::vector<VkPipeline> rebuiltPrepass = prepassBuilder.takeReady();
+    if (!rebuiltPrepass.empty()) {
+      std::vector<VkPipeline> oldPipelines = prepassPipelines;
+      deletionQueue.push(iFrame - 1, [=]() {
+        for (auto &oldPipeline : oldPipelines)
+          vkDestroyPipeline(logicalDevice, oldPipeline, nullptr);
+      });
+      prepassPipelines = rebuiltPrepass;
+    }
+    std::vector<VkPipeline> rebuiltPasses = passBuilder.takeReady();
+    if (!rebuiltPasses.empty()) {
+      std::vector<VkPipeline> oldPipelines = passPipelines;
+      deletionQueue.push(iFrame - 1, [=]() {
+        for (auto &oldPipeline : oldPipelines)
+          vkDestroyPipeline(logicalDevice, oldPipeline, nullptr);
+      });
+      passPipelines = rebuiltPasses;
+    }
+    std::vector<VkPipeline> rebuiltWall = wallBuilder.takeReady();
+    if (!rebuiltWall.empty()) {
+      std::vector<VkPipeline> oldPipelines = wallPipelines;
+      deletionQueue.push(iFrame - 1, [=]() {
+        for (auto &oldPipeline : oldPipelines)
+          vkDestroyPipeline(logicalDevice, oldPipeline, nullptr);
+      });
+      wallPipelines = rebuiltWall;
+    }
+    // Tiers are only bound, never built, in the frame loop
+    size_t tier = static_cast<size_t>(windowData.quality);
+    VkPipeline pipeline = pipelines[tier];
+    VkPipeline prepassPipeline = prepassPipelines[tier];
+
+    uint32_t currentFrame = iFrame % framesInFlight;
+
+    // Wait until the GPU is done with this frame's resources
+    {
+      TRACE_SCOPE("vkWaitForFences");
+      VK_CHECK(vkWaitForFences(logicalDevice, 1, &fences[currentFrame],
+                               VK_TRUE, UINT64_MAX));
+    }
+    // Frames complete in submission order on the single queue
+    completedFrame = std::max(completedFrame, fenceFrame[currentFrame]);
+    deletionQueue.flush(completedFrame);
+
+    uint32_t imageIndex;
+    {
+      TRACE_SCOPE("vkAcquireNextImageKHR");
+      VkResult acquireResult = acquireNextImage(
+          logicalDevice, imageAvailableSemaphores[currentFrame], swapchain,
+          imageIndex);
+      // Nothing was acquired and the fence is untouched, retry next loop
+      if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR) {
+        swapchainOutOfDate = true;
+        continue;
+      }
+      // Still usable, the semaphore will signal so this frame goes ahead
+      if (acquireResult == VK_SUBOPTIMAL_KHR)
+        swapchainOutOfDate = true;
     }
+    // The image can still be in use by an older frame when there are more
+    // frames in flight than swapchain images or images come back out of order
+    if (imagesInFlight[imageIndex] != VK_NULL_HANDLE &&
+        imagesInFlight[imageIndex] != fences[currentFrame]) {
+      TRACE_SCOPE("imageInFlightWait");
+      VK_CHECK(vkWaitForFences(logicalDevice, 1, &imagesInFlight[imageIndex],
+                               VK_TRUE, UINT64_MAX));
+    }
+    imagesInFlight[imageIndex] = fences[currentFrame];
+    VK_CHECK(vkResetFences(logicalDevice, 1, &fences[currentFrame]));
+
+    VkCommandBuffer commandBuffer = commandBuffers[currentFrame];
+    {
+      TRACE_SCOPE("record");
+      // Results from the last time this slot was used, frames ago
+      if (auto gpuTime = timestamps.collect(currentFrame)) {
+        gpuStats.push(*gpuTime);
+        resolution.update(*gpuTime);
+        TRACE_GPU("gpu", slotSubmitNs[currentFrame],
+                  static_cast<int64_t>(*gpuTime * 1e6));
+      }
+      if (wall)
+        wall->collect(currentFrame);
+
+      std::chrono::high_resolution_clock::time_point currentT =
+          std::chrono::high_resolution_clock::now();
+
+      // A fixed time step ignores the clock and T, a replay uses the
+      // captured time
+      float iTime =
+          options.timeStep > 0.0
+              ? static_cast<float>(iFrame * options.timeStep)
+              : std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    currentT - windowData.progStartT)
+                        .count() *
+                    1e-9;
+      if (replayed)
+        iTime = replayed->iTime;
+
+      double xpos, ypos;
+      glfwGetCursorPos(window, &xpos, &ypos);
+      if (replayed) {
+        xpos = replayed->cursorX;
+        ypos = replayed->cursorY;
+      }
 
-    renderScene(swapchainImages[imageIndex], swapchainImageViews[imageIndex],
-                surfaceCapabilities, commandBuffers[imageIndex], pipeline,
-                pipelineLayout, pushConstants);
+      // Restarting the clock with T would make the delta negative
+      uniforms.iTimeDelta = std::max(0.0f, iTime - uniforms.iTime);
+      uniforms.iFrameRate =
+          uniforms.iTimeDelta > 0.0f ? 1.0f / uniforms.iTimeDelta : 0.0f;
+      uniforms.iTime = iTime;
+      uniforms.iFrame = iFrame;
+      uniforms.iDate = options.timeStep > 0.0
+                           ? deterministicDate
+                           : shaderToyDate(std::chrono::system_clock::now());
+      // The shader only sees the scaled down render
+      VkExtent2D renderExtent = resolution.apply(swapchainExtent);
+      uniforms.iResolution =
+          glm::vec3{renderExtent.width, renderExtent.height, 1.0f};
+      // Pass graph channels are graph images, which all cover the render
+      // extent. Nothing else binds channels.
+      glm::vec4 channelResolution =
+          passGraph
+              ? glm::vec4{renderExtent.width, renderExtent.height, 1.0f, 0.0f}
+              : glm::vec4{0.0f};
+      for (glm::vec4 &channel : uniforms.iChannelResolution)
+        channel = channelResolution;
+      // Every wall shader sees its own tile as the whole screen
+      if (wall) {
+        VkExtent2D tileExtent = wall->tileExtent(swapchainExtent);
+        uniforms.iResolution =
+            glm::vec3{tileExtent.width, tileExtent.height, 1.0f};
+      }
+      glm::vec2 mouse = glm::vec2{xpos, ypos} * resolution.scale();
+      bool pressed =
+          replayed ? replayed->mouseDown
+                   : glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) ==
+                         GLFW_PRESS;
+      bool clicked = pressed && !mouseDown;
+      if (clicked)
+        mouseClick = mouse;
+      mouseDown = pressed;
+      if (pressed) {
+        uniforms.iMouse.x = mouse.x;
+        uniforms.iMouse.y = mouse.y;
+      }
+      uniforms.iMouse.z = pressed ? mouseClick.x : -mouseClick.x;
+      uniforms.iMouse.w = clicked ? mouseClick.y : -mouseClick.y;
+      if (captureWriter) {
+        captureWriter->push(CapturedFrame{
+            .wallTime =
+                std::chrono::duration<double>(cpuStart - sessionStartT)
+                    .count(),
+            .iTime = iTime,
+            .cursorX = static_cast<float>(xpos),
+            .cursorY = static_cast<float>(ypos),
+            .mouseDown = pressed,
+            .checkerboard = windowData.checkerboard,
+            .prepass = windowData.prepass,
+            .quality = windowData.quality,
+            .framebufferWidth = swapchainExtent.width,
+            .framebufferHeight = swapchainExtent.height,
+        });
+      }
+      if (replayed)
+        replayIndex++;
+      // The fence wait above means the GPU is done with this slot
+      FrameUniforms frameUniforms{
+          .descriptorSet = frameDescriptorSet,
+          .offset = writeUniformRing(uniformRing, currentFrame, uniforms),
+      };
+
+      bool checkerboard = windowData.checkerboard && checkerboardSupported;
+      pushConstants.checkerboard = checkerboard ? 1 : 0;
+      // Buffer A of the pass graph marches without the prepass
+      bool prepass = windowData.prepass && !passGraph && !wall;
+      pushConstants.prepass = prepass ? 1 : 0;
+      // Full frame fragment draws, split into tiles when asked to
+      auto drawScene = [&](const VkImage &image, const VkImageView &imageView,
+                           const VkExtent2D &extent,
+                           const VkImageLayout &finalLayout) {
+        const VkDescriptorSet &descriptorSet =
+            sceneDescriptorSets[currentFrame];
+        if (!tileRecorder) {
+          renderScene(image, imageView, extent, commandBuffer, pipeline,
+                      pipelineLayout, descriptorSet, frameUniforms,
+                      pushConstants, finalLayout);
+          return;
+        }
+        std::vector<VkCommandBuffer> secondaries = tileRecorder->record(
+            currentFrame, surfaceFormat.format, extent,
+            splitTiles(extent, options.tiles),
+            [&](const VkCommandBuffer &secondary) {
+              bindScene(secondary, pipeline, pipelineLayout, descriptorSet,
+                        frameUniforms, pushConstants);
+            });
+        renderSceneSecondaries(image, imageView, extent, commandBuffer,
+                               secondaries, finalLayout);
+      };
+      // The plain fragment path submits buffers recorded ahead of time
+      bool replay = prerecordSupported && !checkerboard && !prepass;
+      if (!replay) {
+        // Rewriting the scene descriptor set invalidates them anyway
+        invalidatePrerecorded();
+        VK_CHECK(vkResetCommandBuffer(commandBuffer, 0));
+        VkCommandBufferBeginInfo commandBufferBeginInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        };
+        VK_CHECK(
+            vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo));
+        // Start GPU Timestamp
+        timestamps.begin(commandBuffer, currentFrame);
+        recordPrepass(commandBuffer, prepassTargets[currentFrame], renderExtent,
+                      prepassPipeline, pipelineLayout, frameUniforms,
+                      pushConstants, prepass);
+        writeStartDistance(logicalDevice,
+                           options.compute ? computeDescriptorSets[currentFrame]
+                                           : sceneDescriptorSets[currentFrame],
+                           options.compute ? 1 : 0, nearestSampler,
+                           prepassTargets[currentFrame]);
+      }
+      if (replay) {
+        historyExtent = VkExtent2D{0, 0};
+        // The slot's fence was waited for above, so its descriptor set can
+        // be written and its buffers recorded again
+        if (prerecorded[currentFrame].empty()) {
+          writeStartDistance(logicalDevice, sceneDescriptorSets[currentFrame],
+                             0, nearestSampler, prepassTargets[currentFrame]);
+          prerecorded[currentFrame] = recordStaticFrames(
+              logicalDevice, commandPool, swapchainImages,
+              swapchainImageViews, swapchainExtent, pipelines,
+              pipelineLayout, sceneDescriptorSets[currentFrame],
+              prepassTargets[currentFrame], frameUniforms, timestamps,
+              currentFrame);
+        }
+        commandBuffer =
+            prerecorded[currentFrame][imageIndex * qualityTierCount + tier];
+        timestamps.resubmit(currentFrame);
+      } else if (wall) {
+        historyExtent = VkExtent2D{0, 0};
+        wall->reset(commandBuffer, currentFrame);
+        beginSceneRendering(commandBuffer, swapchainImages[imageIndex],
+                            swapchainImageViews[imageIndex], swapchainExtent,
+                            0);
+        wall->draw(commandBuffer, currentFrame, swapchainExtent,
+                   wallPipelines, frameUniforms.descriptorSet,
+                   frameUniforms.offset);
+        cmdEndRenderingKHR(commandBuffer);
+        finishSceneImage(commandBuffer, swapchainImages[imageIndex],
+                         VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+      } else if (passGraph) {
+        historyExtent = VkExtent2D{0, 0};
+        passUniforms = frameUniforms;
+        passTier = tier;
+        VkImage output =
+            passGraph->execute(commandBuffer, currentFrame, renderExtent);
+        blitToSwapchain(commandBuffer, output, renderExtent,
+                        swapchainImages[imageIndex], swapchainExtent,
+                        upscaleFilter);
+      } else if (options.compute) {
+        historyExtent = VkExtent2D{0, 0};
+        const OffscreenImage &target = sceneTargets[currentFrame];
+        dispatchScene(logicalDevice, commandBuffer, target, renderExtent,
+                      pipeline, computePipelineLayout,
+                      computeDescriptorSets[currentFrame], frameUniforms,
+                      pushConstants);
+        blitToSwapchain(commandBuffer, target.image, renderExtent,
+                        swapchainImages[imageIndex], swapchainExtent,
+                        upscaleFilter);
+      } else if (checkerboard) {
+        // Same size as last frame's resolve, otherwise it cannot be reused
+        bool historyValid = historyExtent.width == renderExtent.width &&
+                            historyExtent.height == renderExtent.height;
+        const OffscreenImage &traced =
+            checkerboardTargets.traced[currentFrame];
+        renderScene(traced.image, traced.view,
+                    VkExtent2D{(renderExtent.width + 1) / 2,
+                               renderExtent.height},
+                    commandBuffer, pipeline, pipelineLayout,
+                    sceneDescriptorSets[currentFrame], frameUniforms,
+                    pushConstants, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        resolveCheckerboard(logicalDevice, commandBuffer, checkerboardTargets,
+                            currentFrame, iFrame, historyValid, renderExtent,
+                            resolvePipeline, resolvePipelineLayout,
+                            resolveDescriptorSets[currentFrame],
+                            nearestSampler);
+        blitToSwapchain(commandBuffer,
+                        checkerboardTargets.history[iFrame & 1].image,
+                        renderExtent, swapchainImages[imageIndex],
+                        swapchainExtent, upscaleFilter);
+        historyExtent = renderExtent;
+      } else if (resolution.enabled()) {
+        historyExtent = VkExtent2D{0, 0};
+        const OffscreenImage &target = sceneTargets[currentFrame];
+        drawScene(target.image, target.view, renderExtent,
+                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+        blitToSwapchain(commandBuffer, target.image, renderExtent,
+                        swapchainImages[imageIndex], swapchainExtent,
+                        upscaleFilter);
+      } else {
+        historyExtent = VkExtent2D{0, 0};
+        drawScene(swapchainImages[imageIndex],
+                  swapchainImageViews[imageIndex], swapchainExtent,
+                  VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+      }
 
-    vkCmdWriteTimestamp(commandBuffers[imageIndex],
-                        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool,
-                        currentImage * 2 + 1);
-    VK_CHECK(vkEndCommandBuffer(commandBuffers[imageIndex]));
-    queueSubmit(commandBuffers[imageIndex], swapchain, queue,
-                imageAvailableSemaphores[currentImage],
-                renderFinishedSemaphore[currentImage],
-                fences[(imageIndex + 1) % fences.size()], imageIndex);
+      if (!replay) {
+        timestamps.end(commandBuffer, currentFrame);
+        VK_CHECK(vkEndCommandBuffer(commandBuffer));
+      }
+    }
+    slotSubmitNs[currentFrame] = trace::nowNs();
+    VkResult presentResult =
+        queueSubmit(commandBuffer, swapchain, queue,
+                    imageAvailableSemaphores[currentFrame],
+                    renderFinishedSemaphores[imageIndex], fences[currentFrame],
+                    imageIndex,
+                    (!wall && (passGraph || options.compute ||
+                               resolution.enabled() ||
+                               pushConstants.checkerboard))
+                        ? VK_PIPELINE_STAGE_TRANSFER_BIT
+                        : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    fenceFrame[currentFrame] = iFrame;
+    if (isSwapchainStatus(presentResult))
+      swapchainOutOfDate = true;
+    if (iFrame == 0) {
+      int64_t presentNs = trace::nowNs();
+      spdlog::info("Time to first present {:.3f}ms: startup tasks {:.3f}ms, "
+                   "setup {:.3f}ms, first frame {:.3f}ms",
+                   (presentNs - startNs) * 1e-6,
+                   (startup.endNs() - startNs) * 1e-6,
+                   (loopStartNs - startup.endNs()) * 1e-6,
+                   (presentNs - loopStartNs) * 1e-6);
+      startup.logTimings(startNs);
+    }
 
     cpuEnd = std::chrono::high_resolution_clock::now();
-
-    // Get Gpu time
-    uint64_t gpuBegin, gpuEnd = 0;
-    uint64_t times[2];
-
-    // bad?
-    // VK_CHECK(vkDeviceWaitIdle(logicalDevice));
-
-    VK_CHECK(vkGetQueryPoolResults(
-        logicalDevice, queryPool, currentImage * 2, 2, sizeof(uint64_t) * 2,
-        &times, sizeof(uint64_t),
-        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
-
-    double totalCpuTime =
+    cpuStats.push(
         std::chrono::duration_cast<std::chrono::nanoseconds>(cpuEnd - cpuStart)
             .count() *
-        1e-6;
-    double totalGpuTime =
-        (times[1] - times[0]) * deviceProperties.limits.timestampPeriod * 1e-6;
-    //
-    // std::string title = fmt::format(
-    //     "CPU: {:d}ms  GPU B: {:.3f}ms GPU E: {:.3f}ms", totalCpuTime,
-    //     times[0] * deviceProperties.limits.timestampPeriod * 1e-6,
-    //     times[1] * deviceProperties.limits.timestampPeriod * 1e-6);
-    std::string title =
-        fmt::format("CPU: {:.3f}ms  GPU: {:.3f}ms", totalCpuTime, totalGpuTime);
-    glfwSetWindowTitle(window, title.c_str());
-
-    currentImage = (currentImage + 1) % swapchainImages.size();
+        1e-6);
+
+    // Setting the title is slow on some platforms, a few times a second is
+    // plenty for rolling stats
+    if (cpuEnd - lastTitleT > std::chrono::milliseconds(250)) {
+      std::string title =
+          fmt::format("CPU: {}  GPU: {}", formatStats(cpuStats.summary()),
+                      formatStats(gpuStats.summary()));
+      title += fmt::format("  Quality: {}", qualityName(windowData.quality));
+      if (wall)
+        title += fmt::format("  Wall: {} shaders", wallShaders.size());
+      if (resolution.enabled()) {
+        VkExtent2D renderExtent = resolution.apply(swapchainExtent);
+        title += fmt::format("  Scale: {:.3f} ({}x{})", resolution.scale(),
+                             renderExtent.width, renderExtent.height);
+      }
+      glfwSetWindowTitle(window, title.c_str());
+      lastTitleT = cpuEnd;
+    }
+    if (wall && cpuEnd - lastWallReportT > std::chrono::seconds(5)) {
+      wall->report();
+      lastWallReportT = cpuEnd;
+    }
+
     iFrame++;
 
     /*
@@ -1099,6 +2473,74 @@ int main() {
     */
   }
 
+  if (!replayFrames.empty()) {
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::high_resolution_clock::now() -
+                         sessionStartT)
+                         .count();
+    spdlog::info("Replayed {} of {} frames in {:.3f}s: {:.2f} frames/sec",
+                 replayIndex, replayFrames.size(), seconds,
+                 replayIndex / seconds);
+    spdlog::info("GPU frame time: {}", formatStats(gpuStats.summary()));
+    spdlog::info("CPU frame time: {}", formatStats(cpuStats.summary()));
+  }
+  if (captureWriter) {
+    captureWriter->finish();
+    spdlog::info("Captured {} frames to {}", captureWriter->framesCaptured(),
+                 options.capturePath);
+  }
+
+  if (trace::isEnabled())
+    trace::dump(options.tracePath);
+
+  watcher.stop();
+  VK_CHECK(vkDeviceWaitIdle(logicalDevice));
+  pipelineBuilder.stop();
+  prepassBuilder.stop();
+  passBuilder.stop();
+  wallBuilder.stop();
+  invalidatePrerecorded();
+  deletionQueue.flushAll();
+  savePipelineCache(logicalDevice, pipelineCache, cachePath);
+  vkDestroyPipelineCache(logicalDevice, pipelineCache, nullptr);
+
+  for (auto &target : sceneTargets)
+    destroyOffscreenImage(logicalDevice, target);
+  destroyCheckerboardTargets(logicalDevice, checkerboardTargets);
+  if (tileRecorder)
+    tileRecorder->destroy();
+  if (wall) {
+    wall->report();
+    for (auto &wallPipeline : wallPipelines)
+      vkDestroyPipeline(logicalDevice, wallPipeline, nullptr);
+    wall->destroy();
+    vkDestroyQueryPool(logicalDevice, wallQueryPool, nullptr);
+  }
+  if (passGraph) {
+    for (auto &passPipeline : passPipelines)
+      vkDestroyPipeline(logicalDevice, passPipeline, nullptr);
+    vkDestroyPipelineLayout(logicalDevice, passPipelineLayout, nullptr);
+    passGraph->destroy();
+  }
+  vkDestroyPipeline(logicalDevice, resolvePipeline, nullptr);
+  vkDestroyDescriptorPool(logicalDevice, resolveDescriptorPool, nullptr);
+  vkDestroyPipelineLayout(logicalDevice, resolvePipelineLayout, nullptr);
+  vkDestroyDescriptorSetLayout(logicalDevice, resolveSetLayout, nullptr);
+  vkDestroySampler(logicalDevice, nearestSampler, nullptr);
+  for (auto &target : prepassTargets)
+    destroyOffscreenImage(logicalDevice, target);
+  for (auto &prepassPipeline : prepassPipelines)
+    vkDestroyPipeline(logicalDevice, prepassPipeline, nullptr);
+  vkDestroyDescriptorPool(logicalDevice, sceneDescriptorPool, nullptr);
+  vkDestroyDescriptorSetLayout(logicalDevice, sceneSetLayout, nullptr);
+  vkDestroyDescriptorPool(logicalDevice, computeDescriptorPool, nullptr);
+  vkDestroyPipelineLayout(logicalDevice, computePipelineLayout, nullptr);
+  vkDestroyDescriptorSetLayout(logicalDevice, computeSetLayout, nullptr);
+  destroyUniformRing(logicalDevice, uniformRing);
+  vkDestroyDescriptorPool(logicalDevice, frameDescriptorPool, nullptr);
+  vkDestroyDescriptorSetLayout(logicalDevice, frameSetLayout, nullptr);
+  vkDestroyQueryPool(logicalDevice, queryPool, nullptr);
+
   // Free command buffers
   vkFreeCommandBuffers(logicalDevice, commandPool, commandBuffers.size(),
                        commandBuffers.data());
@@ -1107,7 +2549,7 @@ int main() {
   for (auto &semaphore : imageAvailableSemaphores) {
     vkDestroySemaphore(logicalDevice, semaphore, nullptr);
   }
-  for (auto &semaphore : renderFinishedSemaphore) {
+  for (auto &semaphore : renderFinishedSemaphores) {
     vkDestroySemaphore(logicalDevice, semaphore, nullptr);
   }
   for (auto &fence : fences) {
@@ -1118,7 +2560,8 @@ int main() {
   }
   vkDestroySwapchainKHR(logicalDevice, swapchain, nullptr);
   vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
-  vkDestroyPipeline(logicalDevice, pipeline, nullptr);
+  for (auto &pipeline : pipelines)
+    vkDestroyPipeline(logicalDevice, pipeline, nullptr);
   vkDestroyDevice(logicalDevice, nullptr);
   vkDestroySurfaceKHR(instance, surface, nullptr);
   vkDestroyInstance(instance, nullptr);
@@ -0,0 +1,286 @@
+#include "options.h"
+#include <algorithm>
+#include <cstdlib>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+void printUsage(const char *program) {
+  spdlog::info("Usage: {} [options]", program);
+  spdlog::info("  --headless        Render offscreen without a window");
+  spdlog::info("  --width <px>      Offscreen render width (default 800)");
+  spdlog::info("  --height <px>     Offscreen render height (default 600)");
+  spdlog::info("  --frames <n>      Frames to render in headless mode");
+  spdlog::info("  --cpu             Render headless on the CPU, no Vulkan "
+               "device needed");
+  spdlog::info("  --cpu-threads <n> CPU renderer threads (default one per "
+               "core)");
+  spdlog::info("  --output <file>   Write headless frames to file (implies "
+               "--headless)");
+  spdlog::info("  --output-format <raw|y4m|ppm>  Default from the extension");
+  spdlog::info("  --time-step <s>   Fixed iTime step per frame (default 1/60 "
+               "with --output or --golden)");
+  spdlog::info("  --golden <dir>    Compare headless frames against "
+               "<dir>/frame_<n>.ppm");
+  spdlog::info("  --golden-frames <n,n,...>  Frames to compare (default the "
+               "last)");
+  spdlog::info("  --update-golden   Write the golden images instead");
+  spdlog::info("  --golden-psnr <db>  Minimum PSNR (default 40, inf for "
+               "identical frames)");
+  spdlog::info("  --golden-max-error <n>  Maximum channel error (default 24, "
+               "0 for identical frames)");
+  spdlog::info("  --trace <prefix>  Record frame phases to <prefix>.json/.csv");
+  spdlog::info("  --present-mode <fifo|fifo_relaxed|mailbox|immediate>");
+  spdlog::info("  --frames-in-flight <n>  Frames recorded ahead (default 2)");
+  spdlog::info("  --gpu-budget-ms <ms>    Scale render resolution to this "
+               "GPU frame time");
+  spdlog::info("  --checkerboard    Trace half the pixels per frame "
+               "(toggle C)");
+  spdlog::info("  --compute         Raymarch in a compute shader");
+  spdlog::info("  --passes          Multi-pass buffer graph demo");
+  spdlog::info("  --quality <low|medium|high>  Raymarch quality tier "
+               "(cycle Q)");
+  spdlog::info("  --prepass         Seed rays from a 1/8 res prepass "
+               "(toggle D)");
+  spdlog::info("  --tiles <n>       Draw n x n tiles recorded on worker "
+               "threads");
+  spdlog::info("  --record-threads <n>  Tile recording threads (default one "
+               "per core)");
+  spdlog::info("  --wall            Draw every shaders/*.frag side by side "
+               "and time each");
+  spdlog::info("  --prerecord       Replay command buffers recorded once "
+               "per swapchain image");
+  spdlog::info("  --capture <file>  Record the input of every frame");
+  spdlog::info("  --replay <file>   Replay a capture and report its timing");
+  spdlog::info("  --replay-pace <fast|recorded>  Replay speed (default "
+               "fast)");
+}
+
+double parsePositiveDouble(const std::string &flag, const char *value) {
+  if (value == nullptr) {
+    throw std::runtime_error(fmt::format("Missing value for {}", flag));
+  }
+  try {
+    double parsed = std::stod(value);
+    if (!(parsed > 0.0)) {
+      throw std::out_of_range(value);
+    }
+    return parsed;
+  } catch (const std::logic_error &) {
+    throw std::runtime_error(
+        fmt::format("Invalid value for {}: {}", flag, value));
+  }
+}
+
+PresentMode parsePresentMode(const char *value) {
+  std::string mode = value ? value : "";
+  if (mode == "fifo")
+    return PresentMode::Fifo;
+  if (mode == "fifo_relaxed")
+    return PresentMode::FifoRelaxed;
+  if (mode == "mailbox")
+    return PresentMode::Mailbox;
+  if (mode == "immediate")
+    return PresentMode::Immediate;
+  throw std::runtime_error(fmt::format("Invalid present mode: {}", mode));
+}
+
+ReplayPace parseReplayPace(const char *value) {
+  std::string pace = value ? value : "";
+  if (pace == "fast")
+    return ReplayPace::Fast;
+  if (pace == "recorded")
+    return ReplayPace::Recorded;
+  throw std::runtime_error(fmt::format("Invalid replay pace: {}", pace));
+}
+
+Quality parseQuality(const char *value) {
+  std::string name = value ? value : "";
+  for (uint32_t i = 0; i < qualityTierCount; i++) {
+    Quality quality = static_cast<Quality>(i);
+    if (name == qualityName(quality))
+      return quality;
+  }
+  throw std::runtime_error(fmt::format("Invalid quality: {}", name));
+}
+
+std::set<uint32_t> parseFrameList(const std::string &flag, const char *value) {
+  if (value == nullptr) {
+    throw std::runtime_error(fmt::format("Missing value for {}", flag));
+  }
+  std::set<uint32_t> frames;
+  std::string list = value;
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t end = std::min(list.find(',', start), list.size());
+    std::string item = list.substr(start, end - start);
+    try {
+      size_t parsed = 0;
+      unsigned long frame = std::stoul(item, &parsed);
+      if (parsed != item.size() || frame > UINT32_MAX) {
+        throw std::out_of_range(item);
+      }
+      frames.insert(static_cast<uint32_t>(frame));
+    } catch (const std::logic_error &) {
+      throw std::runtime_error(
+          fmt::format("Invalid value for {}: {}", flag, value));
+    }
+    start = end + 1;
+  }
+  return frames;
+}
+
+FrameFormat parseFrameFormat(const char *value) {
+  std::string name = value ? value : "";
+  for (FrameFormat format :
+       {FrameFormat::Raw, FrameFormat::Y4m, FrameFormat::Ppm}) {
+    if (name == frameFormatName(format))
+      return format;
+  }
+  throw std::runtime_error(fmt::format("Invalid output format: {}", name));
+}
+
+} // namespace
+
+uint32_t parseUint(const std::string &flag, const char *value,
+                   const uint32_t &min) {
+  if (value == nullptr) {
+    throw std::runtime_error(fmt::format("Missing value for {}", flag));
+  }
+  try {
+    unsigned long parsed = std::stoul(value);
+    if (parsed < min || parsed > UINT32_MAX) {
+      throw std::out_of_range(value);
+    }
+    return static_cast<uint32_t>(parsed);
+  } catch (const std::logic_error &) {
+    throw std::runtime_error(
+        fmt::format("Invalid value for {}: {}", flag, value));
+  }
+}
+
+Options parseOptions(int argc, char **argv) {
+  Options options;
+  bool outputFormatGiven = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const char *next = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if (arg == "--headless") {
+      options.headless = true;
+    } else if (arg == "--width") {
+      options.width = parseUint(arg, next);
+      i++;
+    } else if (arg == "--height") {
+      options.height = parseUint(arg, next);
+      i++;
+    } else if (arg == "--frames") {
+      options.frames = parseUint(arg, next);
+      i++;
+    } else if (arg == "--cpu") {
+      options.cpu = true;
+    } else if (arg == "--cpu-threads") {
+      options.cpuThreads = parseUint(arg, next);
+      i++;
+    } else if (arg == "--output") {
+      if (next == nullptr) {
+        throw std::runtime_error("Missing value for --output");
+      }
+      options.outputPath = next;
+      options.headless = true;
+      i++;
+    } else if (arg == "--output-format") {
+      options.outputFormat = parseFrameFormat(next);
+      outputFormatGiven = true;
+      i++;
+    } else if (arg == "--time-step") {
+      options.timeStep = parsePositiveDouble(arg, next);
+      i++;
+    } else if (arg == "--golden") {
+      if (next == nullptr) {
+        throw std::runtime_error("Missing value for --golden");
+      }
+      options.goldenDir = next;
+      options.headless = true;
+      i++;
+    } else if (arg == "--golden-frames") {
+      options.goldenFrames = parseFrameList(arg, next);
+      i++;
+    } else if (arg == "--update-golden") {
+      options.updateGolden = true;
+    } else if (arg == "--golden-psnr") {
+      options.goldenMinPsnr = parsePositiveDouble(arg, next);
+      i++;
+    } else if (arg == "--golden-max-error") {
+      // 0 only passes bit exact frames
+      options.goldenMaxError = parseUint(arg, next, 0);
+      i++;
+    } else if (arg == "--present-mode") {
+      options.presentMode = parsePresentMode(next);
+      i++;
+    } else if (arg == "--frames-in-flight") {
+      options.framesInFlight = parseUint(arg, next);
+      i++;
+    } else if (arg == "--gpu-budget-ms") {
+      options.gpuBudgetMs = parsePositiveDouble(arg, next);
+      i++;
+    } else if (arg == "--compute") {
+      options.compute = true;
+    } else if (arg == "--quality") {
+      options.quality = parseQuality(next);
+      i++;
+    } else if (arg == "--prepass") {
+      options.prepass = true;
+    } else if (arg == "--passes") {
+      options.passes = true;
+    } else if (arg == "--tiles") {
+      options.tiles = parseUint(arg, next);
+      i++;
+    } else if (arg == "--record-threads") {
+      options.recordThreads = parseUint(arg, next);
+      i++;
+    } else if (arg == "--wall") {
+      options.wall = true;
+    } else if (arg == "--prerecord") {
+      options.prerecord = true;
+    } else if (arg == "--capture") {
+      if (next == nullptr) {
+        throw std::runtime_error("Missing value for --capture");
+      }
+      options.capturePath = next;
+      i++;
+    } else if (arg == "--replay") {
+      if (next == nullptr) {
+        throw std::runtime_error("Missing value for --replay");
+      }
+      options.replayPath = next;
+      i++;
+    } else if (arg == "--replay-pace") {
+      options.replayPace = parseReplayPace(next);
+      i++;
+    } else if (arg == "--checkerboard") {
+      options.checkerboard = true;
+    } else if (arg == "--trace") {
+      if (next == nullptr) {
+        throw std::runtime_error("Missing value for --trace");
+      }
+      options.tracePath = next;
+      i++;
+    } else if (arg == "--help" || arg == "-h") {
+      printUsage(argv[0]);
+      std::exit(0);
+    } else {
+      printUsage(argv[0]);
+      throw std::runtime_error(fmt::format("Unknown option {}", arg));
+    }
+  }
+  if (!options.outputPath.empty() && !outputFormatGiven)
+    options.outputFormat = frameFormatFromPath(options.outputPath);
+  // Frames written to disk are meant to be played back at a fixed rate and
+  // golden images only match frames rendered at the same iTime
+  bool framesKept = !options.outputPath.empty() || !options.goldenDir.empty();
+  if (framesKept && options.timeStep == 0.0)
+    options.timeStep = 1.0 / 60.0;
+  return options;
+}
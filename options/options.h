@@ -0,0 +1,91 @@
+/**
+ * Command line options for the different run modes
+ **/
+#pragma once
+#include "../framewriter/framewriter.h"
+#include "../quality/quality.h"
+#include <cstdint>
+#include <set>
+#include <string>
+
+enum class PresentMode { Fifo, FifoRelaxed, Mailbox, Immediate };
+
+// Fast replays frames back to back, Recorded waits for each frame's
+// captured time
+enum class ReplayPace { Fast, Recorded };
+
+struct Options {
+  // Render offscreen without a window or swapchain, eg. on CI with lavapipe
+  bool headless = false;
+  uint32_t width = 800;
+  uint32_t height = 600;
+  // Number of frames to render in headless mode
+  uint32_t frames = 1000;
+  // Render headless with the CPU reference renderer, needs no Vulkan device
+  bool cpu = false;
+  // Threads of the CPU reference renderer, 0 uses one per core
+  uint32_t cpuThreads = 0;
+  // Headless frames are streamed to this file when not empty
+  std::string outputPath;
+  // Inferred from the outputPath extension unless given
+  FrameFormat outputFormat = FrameFormat::Raw;
+  // Advance iTime by this many seconds per frame instead of following the
+  // clock and fix iDate, so every run renders the same frames. 0 follows
+  // the clock. Defaults to 1/60 when writing or checking frames.
+  double timeStep = 0.0;
+  // Compare headless frames against <goldenDir>/frame_<n>.ppm when not
+  // empty, the run fails on a mismatch
+  std::string goldenDir;
+  // Frames to compare, the last frame when empty
+  std::set<uint32_t> goldenFrames;
+  // Write the golden images instead of comparing against them
+  bool updateGolden = false;
+  // A frame fails below this PSNR or above this error of any channel
+  double goldenMinPsnr = 40.0;
+  uint32_t goldenMaxError = 24;
+  // Falls back to FIFO when the surface does not support it
+  PresentMode presentMode = PresentMode::Fifo;
+  // Frames the CPU may record ahead of the GPU, independent of how many
+  // images the swapchain has
+  uint32_t framesInFlight = 2;
+  // GPU frame time the dynamic resolution controller aims for, 0 renders at
+  // the full window size
+  double gpuBudgetMs = 0.0;
+  // Raymarch with the compute shader instead of the fullscreen triangle
+  bool compute = false;
+  // Raymarch quality tier to start with, Q cycles through them
+  Quality quality = Quality::Medium;
+  // Start with the coarse start distance prepass on, D toggles it
+  bool prepass = false;
+  // Render the multi-pass Buffer A-C + Image demo through the pass graph
+  bool passes = false;
+  // Record the plain fragment path once per swapchain image and tier and
+  // replay it, only uniforms change per frame
+  bool prerecord = false;
+  // Split the fragment path's draw into tiles x tiles scissored draws,
+  // recorded into secondary command buffers on worker threads
+  uint32_t tiles = 1;
+  // Recording worker threads for tiles, 0 uses one per core
+  uint32_t recordThreads = 0;
+  // Draw every fragment shader in shaders/ as a grid and report the GPU
+  // time of each
+  bool wall = false;
+  // Record every frame's input to this file when not empty
+  std::string capturePath;
+  // Drive the window from a capture instead of the input, exits when it
+  // ends and reports the timing
+  std::string replayPath;
+  ReplayPace replayPace = ReplayPace::Fast;
+  // Start with checkerboard rendering on, C toggles it at runtime
+  bool checkerboard = false;
+  // Enables frame phase tracing, written to <tracePath>.json/.csv on exit
+  // (or when P is pressed) when not empty
+  std::string tracePath;
+};
+
+// An integer flag value, throws naming the flag when it is missing or not a
+// number in min..UINT32_MAX
+uint32_t parseUint(const std::string &flag, const char *value,
+                   const uint32_t &min = 1);
+
+Options parseOptions(int argc, char **argv);
@@ -0,0 +1,438 @@
+#include "passgraph.h"
+#include "../vkcommon/vkcommon.h"
+#include <algorithm>
+#include <array>
+#include <numeric>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+namespace {
+
+const VkImageSubresourceRange colorRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0,
+                                         1};
+
+bool isRead(const VkAccessFlags2 &access) {
+  return (access & ~(VK_ACCESS_2_SHADER_SAMPLED_READ_BIT |
+                     VK_ACCESS_2_TRANSFER_READ_BIT)) == 0;
+}
+
+} // namespace
+
+PassGraph::PassGraph(const VkPhysicalDevice &physicalDevice,
+                     const VkDevice &device, const uint32_t &framesInFlight)
+    : physicalDevice{physicalDevice}, device{device},
+      framesInFlight{framesInFlight} {
+  cmdPipelineBarrier2 = reinterpret_cast<PFN_vkCmdPipelineBarrier2KHR>(
+      vkGetDeviceProcAddr(device, "vkCmdPipelineBarrier2KHR"));
+  cmdBeginRendering = reinterpret_cast<PFN_vkCmdBeginRenderingKHR>(
+      vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR"));
+  cmdEndRendering = reinterpret_cast<PFN_vkCmdEndRenderingKHR>(
+      vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR"));
+  if (!cmdPipelineBarrier2 || !cmdBeginRendering || !cmdEndRendering) {
+    throw std::runtime_error(
+        "Pass graph needs VK_KHR_synchronization2 and dynamic rendering");
+  }
+
+  VkSamplerCreateInfo samplerCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+      .magFilter = VK_FILTER_LINEAR,
+      .minFilter = VK_FILTER_LINEAR,
+      .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+      .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .maxLod = 0.0f,
+  };
+  VK_CHECK(vkCreateSampler(device, &samplerCreateInfo, nullptr, &sampler));
+
+  std::array<VkDescriptorSetLayoutBinding, maxChannels> bindings{};
+  for (uint32_t i = 0; i < maxChannels; i++) {
+    bindings[i] = {
+        .binding = i,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+    };
+  }
+  VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .bindingCount = maxChannels,
+      .pBindings = bindings.data(),
+  };
+  VK_CHECK(vkCreateDescriptorSetLayout(device, &setLayoutCreateInfo, nullptr,
+                                       &setLayout));
+}
+
+PassImage PassGraph::addImage(const std::string &name, const VkFormat &format,
+                              const PassImageKind &kind) {
+  images.push_back(Image{
+      .name = name,
+      .format = format,
+      .kind = kind,
+      .copies = std::vector<Copy>(kind == PassImageKind::History ? 2 : 1),
+      .firstPass = UINT32_MAX,
+      .lastPass = 0,
+  });
+  return static_cast<PassImage>(images.size() - 1);
+}
+
+void PassGraph::addPass(const std::string &name,
+                        const std::vector<PassRead> &reads,
+                        const PassImage &write, Record record) {
+  if (reads.size() > maxChannels) {
+    throw std::runtime_error(
+        fmt::format("Pass {} reads more than {} images", name, maxChannels));
+  }
+  uint32_t index = static_cast<uint32_t>(passes.size());
+  auto use = [&](const PassImage &image) {
+    images[image].firstPass = std::min(images[image].firstPass, index);
+    images[image].lastPass = std::max(images[image].lastPass, index);
+  };
+  for (auto &read : reads) {
+    if (read.previous && images[read.image].kind != PassImageKind::History) {
+      throw std::runtime_error(fmt::format(
+          "Pass {} reads last frame of {}, which keeps no history", name,
+          images[read.image].name));
+    }
+    use(read.image);
+  }
+  use(write);
+  passes.push_back(Pass{name, reads, write, std::move(record)});
+}
+
+VkDescriptorSetLayout PassGraph::channelSetLayout() const { return setLayout; }
+
+void PassGraph::build(const VkExtent2D &extent) {
+  struct Allocation {
+    VkDeviceSize size = 0;
+    uint32_t typeBits = ~0u;
+    // Last pass of the images bound so far, transient blocks only
+    uint32_t lastPass = 0;
+    bool shared = false;
+  };
+  std::vector<Allocation> allocations;
+  VkDeviceSize unaliasedSize = 0;
+
+  // Transient images claim memory in order of their first pass, reusing a
+  // block once every image in it is done
+  std::vector<PassImage> order(images.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](const PassImage &a, const PassImage &b) {
+                     return images[a].firstPass < images[b].firstPass;
+                   });
+  for (auto &index : order) {
+    Image &image = images[index];
+    bool transient = image.kind == PassImageKind::Transient;
+    // The output is read by the blit after the last pass
+    uint32_t lastPass = image.kind == PassImageKind::Output
+                            ? static_cast<uint32_t>(passes.size())
+                            : image.lastPass;
+    for (auto &copy : image.copies) {
+      VkImageCreateInfo imageCreateInfo{
+          .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+          .imageType = VK_IMAGE_TYPE_2D,
+          .format = image.format,
+          .extent = {extent.width, extent.height, 1},
+          .mipLevels = 1,
+          .arrayLayers = 1,
+          .samples = VK_SAMPLE_COUNT_1_BIT,
+          .tiling = VK_IMAGE_TILING_OPTIMAL,
+          .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                   VK_IMAGE_USAGE_SAMPLED_BIT |
+                   VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                   VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+          .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+          .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      };
+      VK_CHECK(vkCreateImage(device, &imageCreateInfo, nullptr, &copy.image));
+      copy.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+      VkMemoryRequirements requirements;
+      vkGetImageMemoryRequirements(device, copy.image, &requirements);
+      unaliasedSize += requirements.size;
+      auto fits = [&](const Allocation &allocation) {
+        return allocation.shared && allocation.lastPass < image.firstPass &&
+               (allocation.typeBits & requirements.memoryTypeBits) != 0;
+      };
+      auto found = transient ? std::find_if(allocations.begin(),
+                                            allocations.end(), fits)
+                             : allocations.end();
+      if (found == allocations.end()) {
+        allocations.push_back(Allocation{.shared = transient});
+        found = allocations.end() - 1;
+      }
+      // Every image is bound at offset 0, which meets any alignment
+      found->size = std::max(found->size, requirements.size);
+      found->typeBits &= requirements.memoryTypeBits;
+      found->lastPass = lastPass;
+      copy.block = static_cast<uint32_t>(found - allocations.begin());
+    }
+  }
+
+  VkDeviceSize allocatedSize = 0;
+  blocks.assign(allocations.size(), Block{});
+  for (size_t i = 0; i < allocations.size(); i++) {
+    uint32_t typeIndex =
+        findMemoryType(physicalDevice, allocations[i].typeBits,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    VkMemoryAllocateInfo allocateInfo{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = allocations[i].size,
+        .memoryTypeIndex = typeIndex,
+    };
+    VK_CHECK(vkAllocateMemory(device, &allocateInfo, nullptr,
+                              &blocks[i].memory));
+    allocatedSize += allocations[i].size;
+  }
+
+  for (auto &image : images) {
+    for (auto &copy : image.copies) {
+      VK_CHECK(vkBindImageMemory(device, copy.image, blocks[copy.block].memory,
+                                 0));
+      VkImageViewCreateInfo viewCreateInfo{
+          .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+          .image = copy.image,
+          .viewType = VK_IMAGE_VIEW_TYPE_2D,
+          .format = image.format,
+          .subresourceRange = colorRange,
+      };
+      VK_CHECK(vkCreateImageView(device, &viewCreateInfo, nullptr, &copy.view));
+    }
+  }
+  historyCleared = false;
+
+  if (descriptorPool == VK_NULL_HANDLE && !passes.empty()) {
+    uint32_t setCount = static_cast<uint32_t>(passes.size()) * framesInFlight;
+    VkDescriptorPoolSize poolSize{
+        .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = setCount * maxChannels,
+    };
+    VkDescriptorPoolCreateInfo poolCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = setCount,
+        .poolSizeCount = 1,
+        .pPoolSizes = &poolSize,
+    };
+    VK_CHECK(vkCreateDescriptorPool(device, &poolCreateInfo, nullptr,
+                                    &descriptorPool));
+    std::vector<VkDescriptorSetLayout> setLayouts(setCount, setLayout);
+    VkDescriptorSetAllocateInfo allocateInfo{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = descriptorPool,
+        .descriptorSetCount = setCount,
+        .pSetLayouts = setLayouts.data(),
+    };
+    descriptorSets.resize(setCount);
+    VK_CHECK(vkAllocateDescriptorSets(device, &allocateInfo,
+                                      descriptorSets.data()));
+  }
+
+  spdlog::info("Pass graph {}x{}: {} passes, {} memory blocks, {:.1f}MB "
+               "({:.1f}MB without aliasing)",
+               extent.width, extent.height, passes.size(), blocks.size(),
+               allocatedSize / (1024.0 * 1024.0),
+               unaliasedSize / (1024.0 * 1024.0));
+}
+
+std::function<void()> PassGraph::releaseImages() {
+  std::vector<Copy> copies;
+  for (auto &image : images) {
+    copies.insert(copies.end(), image.copies.begin(), image.copies.end());
+    image.copies.assign(image.copies.size(), Copy{});
+  }
+  std::vector<Block> oldBlocks = std::move(blocks);
+  blocks.clear();
+  VkDevice device = this->device;
+  return [device, copies, oldBlocks]() {
+    for (auto &copy : copies) {
+      vkDestroyImageView(device, copy.view, nullptr);
+      vkDestroyImage(device, copy.image, nullptr);
+    }
+    for (auto &block : oldBlocks)
+      vkFreeMemory(device, block.memory, nullptr);
+  };
+}
+
+PassGraph::Copy &PassGraph::resolve(const PassImage &image,
+                                    const bool &previous) {
+  Image &resolved = images[image];
+  if (resolved.kind != PassImageKind::History)
+    return resolved.copies[0];
+  return resolved.copies[(executions + (previous ? 1 : 0)) & 1];
+}
+
+void PassGraph::require(Copy &copy, const VkImageLayout &layout,
+                        const VkPipelineStageFlags2 &stage,
+                        const VkAccessFlags2 &access,
+                        std::vector<VkImageMemoryBarrier2> &barriers) {
+  Block &block = blocks[copy.block];
+  // Read after read in the same layout needs no barrier, the later stage
+  // is added so the next writer waits for it as well
+  if (copy.layout == layout && isRead(block.access) && isRead(access)) {
+    block.stage |= stage;
+    block.access |= access;
+    return;
+  }
+  barriers.push_back(VkImageMemoryBarrier2{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+      .srcStageMask = block.stage,
+      .srcAccessMask = block.access,
+      .dstStageMask = stage,
+      .dstAccessMask = access,
+      .oldLayout = copy.layout,
+      .newLayout = layout,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .image = copy.image,
+      .subresourceRange = colorRange,
+  });
+  copy.layout = layout;
+  block.stage = stage;
+  block.access = access;
+}
+
+void PassGraph::barrier(const VkCommandBuffer &commandBuffer,
+                        const std::vector<VkImageMemoryBarrier2> &barriers) {
+  if (barriers.empty())
+    return;
+  VkDependencyInfo dependencyInfo{
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size()),
+      .pImageMemoryBarriers = barriers.data(),
+  };
+  cmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+}
+
+void PassGraph::clearHistory(const VkCommandBuffer &commandBuffer) {
+  std::vector<VkImageMemoryBarrier2> barriers;
+  for (auto &image : images) {
+    if (image.kind != PassImageKind::History)
+      continue;
+    for (auto &copy : image.copies) {
+      require(copy, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+              VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+              barriers);
+    }
+  }
+  barrier(commandBuffer, barriers);
+  VkClearColorValue black{};
+  for (auto &image : images) {
+    if (image.kind != PassImageKind::History)
+      continue;
+    for (auto &copy : image.copies) {
+      vkCmdClearColorImage(commandBuffer, copy.image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &black, 1,
+                           &colorRange);
+    }
+  }
+  historyCleared = true;
+}
+
+VkImage PassGraph::execute(const VkCommandBuffer &commandBuffer,
+                           const uint32_t &slot, const VkExtent2D &extent) {
+  if (!historyCleared || extent.width != historyExtent.width ||
+      extent.height != historyExtent.height) {
+    clearHistory(commandBuffer);
+  }
+  historyExtent = extent;
+  // Transient contents never carry over, the block still remembers the
+  // last access so reuse waits for it
+  for (auto &image : images) {
+    if (image.kind != PassImageKind::History)
+      image.copies[0].layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  }
+  // The history copy written this frame is fully redrawn
+  for (auto &pass : passes) {
+    if (images[pass.write].kind == PassImageKind::History)
+      resolve(pass.write, false).layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  }
+
+  std::vector<VkImageMemoryBarrier2> barriers;
+  for (size_t p = 0; p < passes.size(); p++) {
+    Pass &pass = passes[p];
+    VkDescriptorSet descriptorSet = descriptorSets[p * framesInFlight + slot];
+
+    barriers.clear();
+    std::array<VkDescriptorImageInfo, maxChannels> imageInfos{};
+    std::array<VkWriteDescriptorSet, maxChannels> writes{};
+    for (size_t c = 0; c < pass.reads.size(); c++) {
+      Copy &copy = resolve(pass.reads[c].image, pass.reads[c].previous);
+      require(copy, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+              VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+              VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, barriers);
+      imageInfos[c] = {
+          .sampler = sampler,
+          .imageView = copy.view,
+          .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      };
+      writes[c] = {
+          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+          .dstSet = descriptorSet,
+          .dstBinding = static_cast<uint32_t>(c),
+          .descriptorCount = 1,
+          .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          .pImageInfo = &imageInfos[c],
+      };
+    }
+    Copy &target = resolve(pass.write, false);
+    require(target, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, barriers);
+    barrier(commandBuffer, barriers);
+    // The slot's sets are no longer in use once its fence was waited on
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(pass.reads.size()),
+                           writes.data(), 0, nullptr);
+
+    VkRenderingAttachmentInfo colorAttachmentInfo{
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+        .imageView = target.view,
+        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        // Every pass covers the whole extent
+        .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+    };
+    VkRenderingInfo renderingInfo{
+        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+        .renderArea = {.offset = {0, 0}, .extent = extent},
+        .layerCount = 1,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &colorAttachmentInfo,
+    };
+    cmdBeginRendering(commandBuffer, &renderingInfo);
+    VkViewport viewport{
+        .width = static_cast<float>(extent.width),
+        .height = static_cast<float>(extent.height),
+        .maxDepth = 1.0f,
+    };
+    VkRect2D scissor{.offset = {0, 0}, .extent = extent};
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    pass.record(commandBuffer, descriptorSet);
+    cmdEndRendering(commandBuffer);
+  }
+
+  VkImage output = VK_NULL_HANDLE;
+  barriers.clear();
+  for (auto &image : images) {
+    if (image.kind != PassImageKind::Output)
+      continue;
+    require(image.copies[0], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT,
+            barriers);
+    output = image.copies[0].image;
+  }
+  barrier(commandBuffer, barriers);
+  executions++;
+  return output;
+}
+
+void PassGraph::destroy() {
+  releaseImages()();
+  if (descriptorPool != VK_NULL_HANDLE)
+    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  descriptorPool = VK_NULL_HANDLE;
+  descriptorSets.clear();
+  vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+  vkDestroySampler(device, sampler, nullptr);
+}
@@ -0,0 +1,131 @@
+/**
+ * Render graph for Shadertoy style multi-pass shaders, Buffer A-D feeding an
+ * Image pass. Every pass samples the images it reads through iChannel
+ * descriptors and draws a fullscreen triangle into the one image it writes.
+ * The graph works out the layout transitions between passes and records
+ * them as one vkCmdPipelineBarrier2 per pass. Transient images whose
+ * lifetimes do not overlap share memory.
+ **/
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+using PassImage = uint32_t;
+
+enum class PassImageKind {
+  // Lives from its first to its last pass in a frame, may share memory
+  Transient,
+  // Two copies swapped every frame so a pass can read last frame's result
+  History,
+  // Left in TRANSFER_SRC after the last pass for a blit or readback
+  Output,
+};
+
+// Input of a pass, the n-th read is bound to iChannel<n>
+struct PassRead {
+  PassImage image;
+  // The copy written last frame, history images only
+  bool previous = false;
+};
+
+class PassGraph {
+public:
+  // iChannel bindings in channelSetLayout()
+  static constexpr uint32_t maxChannels = 4;
+  // Binds the pass pipeline and draws, rendering has begun and the viewport
+  // and scissor cover the extent. channels is set 0 of the pass.
+  using Record = std::function<void(const VkCommandBuffer &commandBuffer,
+                                    const VkDescriptorSet &channels)>;
+
+private:
+  struct Copy {
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    // Index into blocks
+    uint32_t block = 0;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  };
+  struct Image {
+    std::string name;
+    VkFormat format;
+    PassImageKind kind;
+    std::vector<Copy> copies;
+    // First and last pass using the image, decides what it can alias
+    uint32_t firstPass;
+    uint32_t lastPass;
+  };
+  struct Pass {
+    std::string name;
+    std::vector<PassRead> reads;
+    PassImage write;
+    Record record;
+  };
+  // Memory shared by the copies bound to it and the last access to it, which
+  // the next user of the memory has to wait for
+  struct Block {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkPipelineStageFlags2 stage = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 access = VK_ACCESS_2_NONE;
+  };
+
+  VkPhysicalDevice physicalDevice;
+  VkDevice device;
+  uint32_t framesInFlight;
+  PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2;
+  PFN_vkCmdBeginRenderingKHR cmdBeginRendering;
+  PFN_vkCmdEndRenderingKHR cmdEndRendering;
+  VkSampler sampler;
+  VkDescriptorSetLayout setLayout;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  // passes.size() * framesInFlight, pass major
+  std::vector<VkDescriptorSet> descriptorSets;
+  std::vector<Image> images;
+  std::vector<Pass> passes;
+  std::vector<Block> blocks;
+  // Selects which history copy is written, flips every execute
+  uint64_t executions = 0;
+  // History copies hold garbage until cleared once after build()
+  bool historyCleared = false;
+  // Region the history was last drawn over, it is cleared when the region
+  // changes instead of reading back a frame drawn at another scale
+  VkExtent2D historyExtent{0, 0};
+
+  Copy &resolve(const PassImage &image, const bool &previous);
+  // Adds a barrier to barriers unless copy is already in layout and only
+  // read before and after
+  void require(Copy &copy, const VkImageLayout &layout,
+               const VkPipelineStageFlags2 &stage,
+               const VkAccessFlags2 &access,
+               std::vector<VkImageMemoryBarrier2> &barriers);
+  void barrier(const VkCommandBuffer &commandBuffer,
+               const std::vector<VkImageMemoryBarrier2> &barriers);
+  void clearHistory(const VkCommandBuffer &commandBuffer);
+
+public:
+  // Needs VK_KHR_synchronization2 and VK_KHR_dynamic_rendering enabled
+  PassGraph(const VkPhysicalDevice &physicalDevice, const VkDevice &device,
+            const uint32_t &framesInFlight);
+  PassImage addImage(const std::string &name, const VkFormat &format,
+                     const PassImageKind &kind);
+  // Passes run in the order they are added
+  void addPass(const std::string &name, const std::vector<PassRead> &reads,
+               const PassImage &write, Record record);
+  // Layout of set 0 of every pass pipeline, sampler2D iChannel0-3
+  VkDescriptorSetLayout channelSetLayout() const;
+  // Creates the images at extent and places transient ones in shared
+  // memory. Call releaseImages() first when rebuilding.
+  void build(const VkExtent2D &extent);
+  // Returns a function destroying the current images, to run once the
+  // frames using them have completed
+  std::function<void()> releaseImages();
+  // Records every pass over the extent region, slot is the frame in flight
+  // whose descriptor sets are rewritten. History restarts from black when
+  // extent differs from the last call. Returns the output image.
+  VkImage execute(const VkCommandBuffer &commandBuffer, const uint32_t &slot,
+                  const VkExtent2D &extent);
+  // Only call once the device is idle
+  void destroy();
+};
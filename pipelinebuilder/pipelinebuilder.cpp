@@ -0,0 +1,73 @@
+#include "pipelinebuilder.h"
+#include <chrono>
+#include <spdlog/spdlog.h>
+#include <utility>
+
+PipelineBuilder::PipelineBuilder(
+    std::function<std::vector<VkPipeline>()> build,
+    std::function<void(VkPipeline)> destroy)
+    : build{build}, destroy{destroy}, worker{[this]() { run(); }} {}
+
+PipelineBuilder::~PipelineBuilder() { stop(); }
+
+void PipelineBuilder::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  condition.notify_one();
+  if (worker.joinable())
+    worker.join();
+  for (auto &unclaimed : takeReady())
+    destroy(unclaimed);
+}
+
+void PipelineBuilder::requestRebuild() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    requested = true;
+  }
+  condition.notify_one();
+}
+
+std::vector<VkPipeline> PipelineBuilder::takeReady() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return std::exchange(ready, {});
+}
+
+void PipelineBuilder::run() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [this]() { return requested || stopping; });
+      if (stopping)
+        return;
+      requested = false;
+    }
+
+    std::vector<VkPipeline> pipelines;
+    auto startT = std::chrono::high_resolution_clock::now();
+    try {
+      pipelines = build();
+    } catch (const std::exception &e) {
+      spdlog::error("Pipeline rebuild failed, keeping the old pipeline: {}",
+                    e.what());
+      continue;
+    }
+    spdlog::info("Rebuilt {} pipelines in {:.3f}ms", pipelines.size(),
+                 std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::high_resolution_clock::now() - startT)
+                         .count() *
+                     1e-3);
+
+    // A set the render loop never picked up is superseded and was never
+    // used by a frame so it can be destroyed straight away
+    std::vector<VkPipeline> superseded;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      superseded = std::exchange(ready, pipelines);
+    }
+    for (auto &pipeline : superseded)
+      destroy(pipeline);
+  }
+}
@@ -0,0 +1,39 @@
+/**
+ * Rebuilds a set of pipelines (one per quality tier) on a worker thread for
+ * shader hot reload. The render loop picks the finished set up with
+ * takeReady() at a frame boundary so it never stalls on compilation.
+ **/
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+class PipelineBuilder {
+private:
+  std::function<std::vector<VkPipeline>()> build;
+  std::function<void(VkPipeline)> destroy;
+  std::mutex mutex;
+  // Built pipelines waiting to be swapped in by the render loop
+  std::vector<VkPipeline> ready;
+  std::condition_variable condition;
+  bool requested = false;
+  bool stopping = false;
+  std::thread worker;
+
+  void run();
+
+public:
+  PipelineBuilder(std::function<std::vector<VkPipeline>()> build,
+                  std::function<void(VkPipeline)> destroy);
+  ~PipelineBuilder();
+  // Joins the worker and destroys any unclaimed pipelines, call before the
+  // device is destroyed
+  void stop();
+  // Requests made while a build is running are coalesced into one rebuild
+  void requestRebuild();
+  // Returns a newly built set exactly once, an empty vector otherwise
+  std::vector<VkPipeline> takeReady();
+};
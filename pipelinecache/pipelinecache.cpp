@@ -0,0 +1,164 @@
+#include "pipelinecache.h"
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <utility>
+
+namespace fs = boost::filesystem;
+
+static const char *pipelineCacheDir = "pipeline_cache";
+// Every shader edit writes a new file, only the most recently saved ones
+// are kept so switching back to a recent version still hits the cache
+static constexpr size_t keptCacheFiles = 4;
+
+uint64_t hashSpirv(const std::vector<std::vector<uint32_t>> &modules) {
+  uint64_t hash = 14695981039346656037ull;
+  for (const auto &module : modules) {
+    for (uint32_t word : module) {
+      hash ^= word;
+      hash *= 1099511628211ull;
+    }
+  }
+  return hash;
+}
+
+std::string pipelineCachePath(const uint64_t &contentHash) {
+  return fmt::format("{}/{:016x}.bin", pipelineCacheDir, contentHash);
+}
+
+bool isCacheCompatible(const std::vector<char> &data,
+                       const VkPhysicalDeviceProperties &deviceProperties) {
+  VkPipelineCacheHeaderVersionOne header;
+  if (data.size() < sizeof(header)) {
+    spdlog::warn("Pipeline cache is truncated");
+    return false;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+  if (header.headerSize < sizeof(header) ||
+      header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+    spdlog::warn("Pipeline cache has unknown header version {}",
+                 static_cast<int>(header.headerVersion));
+    return false;
+  }
+  if (header.vendorID != deviceProperties.vendorID ||
+      header.deviceID != deviceProperties.deviceID) {
+    spdlog::warn("Pipeline cache is for vendor {} device {}", header.vendorID,
+                 header.deviceID);
+    return false;
+  }
+  if (memcmp(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID,
+             VK_UUID_SIZE) != 0) {
+    spdlog::warn("Pipeline cache UUID does not match the driver");
+    return false;
+  }
+  return true;
+}
+
+// Deletes all but the keptCacheFiles most recently written cache files. The
+// just saved file always counts as one of them, since write times only have
+// a resolution of a second and ties are broken by path
+void prunePipelineCaches(const fs::path &saved) {
+  boost::system::error_code ec;
+  std::vector<std::pair<std::time_t, fs::path>> files;
+  for (fs::directory_iterator it(pipelineCacheDir, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    if (it->path().extension() == ".bin" && it->path() != saved)
+      files.emplace_back(fs::last_write_time(it->path(), ec), it->path());
+  }
+  if (ec || files.size() < keptCacheFiles)
+    return;
+  std::sort(files.begin(), files.end(),
+            [](const auto &a, const auto &b) { return a > b; });
+  for (size_t i = keptCacheFiles - 1; i < files.size(); i++) {
+    if (fs::remove(files[i].second, ec))
+      spdlog::info("Removed old pipeline cache {}", files[i].second.string());
+  }
+}
+
+VkPipelineCache
+loadPipelineCache(const VkDevice &device,
+                  const VkPhysicalDeviceProperties &deviceProperties,
+                  const std::string &path) {
+  auto startT = std::chrono::high_resolution_clock::now();
+  std::vector<char> data;
+  std::ifstream file(path, std::ios::ate | std::ios::binary);
+  if (file) {
+    data.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(data.data(), data.size());
+    if (!isCacheCompatible(data, deviceProperties))
+      data.clear();
+  } else {
+    spdlog::info("No pipeline cache at {}", path);
+  }
+
+  VkPipelineCacheCreateInfo pipelineCacheCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+      .initialDataSize = data.size(),
+      .pInitialData = data.empty() ? nullptr : data.data(),
+  };
+  VkPipelineCache pipelineCache;
+  VkResult result = vkCreatePipelineCache(device, &pipelineCacheCreateInfo,
+                                          nullptr, &pipelineCache);
+  if (result != VK_SUCCESS && !data.empty()) {
+    // Driver rejected the contents, start over with an empty cache
+    spdlog::warn("Discarding pipeline cache {}", path);
+    pipelineCacheCreateInfo.initialDataSize = 0;
+    pipelineCacheCreateInfo.pInitialData = nullptr;
+    data.clear();
+    result = vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr,
+                                   &pipelineCache);
+  }
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create pipeline cache");
+  }
+  spdlog::info("Loaded pipeline cache {} ({} bytes) in {:.3f}ms", path,
+               data.size(),
+               std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::high_resolution_clock::now() - startT)
+                       .count() *
+                   1e-3);
+  return pipelineCache;
+}
+
+void savePipelineCache(const VkDevice &device,
+                       const VkPipelineCache &pipelineCache,
+                       const std::string &path) {
+  size_t size = 0;
+  if (vkGetPipelineCacheData(device, pipelineCache, &size, nullptr) !=
+      VK_SUCCESS) {
+    spdlog::warn("Failed to query pipeline cache size");
+    return;
+  }
+  std::vector<char> data(size);
+  if (vkGetPipelineCacheData(device, pipelineCache, &size, data.data()) !=
+      VK_SUCCESS) {
+    spdlog::warn("Failed to read pipeline cache data");
+    return;
+  }
+
+  // Write then rename so a crash never leaves a torn cache file behind
+  boost::system::error_code ec;
+  fs::create_directories(pipelineCacheDir, ec);
+  std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), size);
+    if (!file) {
+      spdlog::warn("Failed to write pipeline cache {}", tmpPath);
+      return;
+    }
+  }
+  fs::rename(tmpPath, path, ec);
+  if (ec) {
+    spdlog::warn("Failed to save pipeline cache {}: {}", path, ec.message());
+    return;
+  }
+  spdlog::info("Saved pipeline cache {} ({} bytes)", path, size);
+  prunePipelineCaches(path);
+}
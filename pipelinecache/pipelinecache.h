@@ -0,0 +1,27 @@
+/**
+ * Persists the VkPipelineCache between runs so launches and hot reloads
+ * skip driver compiles that already happened. A cache file is written per
+ * SPIR-V content hash, the 4 most recent are kept, and only loaded back on
+ * the exact same GPU + driver.
+ **/
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// FNV-1a over every module, used to key cache files by shader content
+uint64_t hashSpirv(const std::vector<std::vector<uint32_t>> &modules);
+
+std::string pipelineCachePath(const uint64_t &contentHash);
+
+// Falls back to an empty cache when the file is missing or was written by a
+// different device / driver
+VkPipelineCache
+loadPipelineCache(const VkDevice &device,
+                  const VkPhysicalDeviceProperties &deviceProperties,
+                  const std::string &path);
+
+void savePipelineCache(const VkDevice &device,
+                       const VkPipelineCache &pipelineCache,
+                       const std::string &path);
@@ -0,0 +1,75 @@
+#include "quality.h"
+#include <array>
+#include <cstddef>
+#include <exception>
+#include <future>
+
+namespace {
+// Medium keeps the values the shader had before the tiers existed
+const std::array<QualityConstants, qualityTierCount> tiers{{
+    {.maxSteps = 48, .eps = 0.01f, .far = 20.0f, .reflections = VK_FALSE},
+    {.maxSteps = 100, .eps = 0.005f, .far = 40.0f, .reflections = VK_TRUE},
+    {.maxSteps = 200, .eps = 0.0025f, .far = 40.0f, .reflections = VK_TRUE},
+}};
+
+const std::array<const char *, qualityTierCount> names{"low", "medium",
+                                                       "high"};
+
+const std::array<VkSpecializationMapEntry, 4> mapEntries{{
+    {0, offsetof(QualityConstants, maxSteps), sizeof(int32_t)},
+    {1, offsetof(QualityConstants, eps), sizeof(float)},
+    {2, offsetof(QualityConstants, far), sizeof(float)},
+    {3, offsetof(QualityConstants, reflections), sizeof(VkBool32)},
+}};
+} // namespace
+
+const char *qualityName(const Quality &quality) {
+  return names[static_cast<size_t>(quality)];
+}
+
+const QualityConstants &qualityConstants(const Quality &quality) {
+  return tiers[static_cast<size_t>(quality)];
+}
+
+VkSpecializationInfo qualitySpecialization(const Quality &quality) {
+  return VkSpecializationInfo{
+      .mapEntryCount = static_cast<uint32_t>(mapEntries.size()),
+      .pMapEntries = mapEntries.data(),
+      .dataSize = sizeof(QualityConstants),
+      .pData = &qualityConstants(quality),
+  };
+}
+
+Quality nextQuality(const Quality &quality) {
+  return static_cast<Quality>((static_cast<uint32_t>(quality) + 1) %
+                              qualityTierCount);
+}
+
+std::vector<VkPipeline> buildQualityPipelines(
+    const std::function<VkPipeline(const VkSpecializationInfo &)> &build,
+    const std::function<void(VkPipeline)> &destroy) {
+  // Pipeline caches are internally synchronized, so the tiers can share one
+  std::vector<std::future<VkPipeline>> builds;
+  for (uint32_t i = 0; i < qualityTierCount; i++) {
+    builds.push_back(std::async(std::launch::async, [&build, i]() {
+      return build(qualitySpecialization(static_cast<Quality>(i)));
+    }));
+  }
+
+  std::vector<VkPipeline> pipelines;
+  std::exception_ptr failure;
+  for (auto &pending : builds) {
+    try {
+      pipelines.push_back(pending.get());
+    } catch (...) {
+      if (!failure)
+        failure = std::current_exception();
+    }
+  }
+  if (failure) {
+    for (auto &pipeline : pipelines)
+      destroy(pipeline);
+    std::rethrow_exception(failure);
+  }
+  return pipelines;
+}
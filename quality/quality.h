@@ -0,0 +1,35 @@
+/**
+ * Raymarch quality tiers. The step count, hit epsilon, far distance and
+ * reflection bounce of planet.glsl are specialization constants, so every
+ * tier is its own pipeline, built up front, and switching tiers at runtime
+ * is just binding a different pipeline.
+ **/
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+enum class Quality { Low, Medium, High };
+static constexpr uint32_t qualityTierCount = 3;
+
+// Specialization data, member i is constant_id i in planet.glsl
+struct QualityConstants {
+  int32_t maxSteps;
+  float eps;
+  float far;
+  VkBool32 reflections;
+};
+
+const char *qualityName(const Quality &quality);
+const QualityConstants &qualityConstants(const Quality &quality);
+// Points into static storage, stays valid for the lifetime of the program
+VkSpecializationInfo qualitySpecialization(const Quality &quality);
+// Next tier up, wrapping around from High to Low
+Quality nextQuality(const Quality &quality);
+// Builds one pipeline per tier concurrently, indexed by Quality. When a
+// build throws the pipelines that did build are destroyed and the first
+// exception is rethrown.
+std::vector<VkPipeline> buildQualityPipelines(
+    const std::function<VkPipeline(const VkSpecializationInfo &)> &build,
+    const std::function<void(VkPipeline)> &destroy);
@@ -0,0 +1,245 @@
+#include "shadercompiler.h"
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#ifdef PLANET_HAS_SHADERC
+#include <shaderc/shaderc.hpp>
+#endif
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+std::vector<uint32_t> readSpirv(const std::string &path) {
+  std::ifstream file(path, std::ios::ate | std::ios::binary);
+  if (!file) {
+    throw std::runtime_error(fmt::format("Failed to open {}", path));
+  }
+  size_t fileSize = static_cast<size_t>(file.tellg());
+  std::vector<uint32_t> spirv(fileSize / sizeof(uint32_t));
+  file.seekg(0);
+  file.read(reinterpret_cast<char *>(spirv.data()),
+            spirv.size() * sizeof(uint32_t));
+  return spirv;
+}
+
+std::string spvPathFor(const std::string &sourcePath) {
+  fs::path spvPath = sourcePath;
+  spvPath.replace_extension(".spv");
+  return spvPath.string();
+}
+
+// Handles both shaderc ("file:12: error: msg") and glslangValidator
+// ("ERROR: file:12: msg") message formats
+std::vector<ShaderDiagnostic> parseDiagnostics(const std::string &output) {
+  static const std::regex lineRegex(
+      R"(^(?:(ERROR|WARNING): )?([^:]+):(\d+): (?:(error|warning): )?(.*)$)");
+  std::vector<ShaderDiagnostic> diagnostics;
+  std::istringstream stream(output);
+  std::string line;
+  while (std::getline(stream, line)) {
+    std::smatch match;
+    if (!std::regex_match(line, match, lineRegex))
+      continue;
+    std::string severity = match[4].matched ? match[4].str()
+                           : match[1] == "WARNING" ? "warning"
+                                                   : "error";
+    diagnostics.push_back({
+        .file = match[2].str(),
+        .line = std::stoi(match[3].str()),
+        .severity = severity,
+        .message = match[5].str(),
+    });
+  }
+  return diagnostics;
+}
+
+} // namespace
+
+#ifdef PLANET_HAS_SHADERC
+
+namespace {
+
+std::string readText(const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error(fmt::format("Failed to open {}", path));
+  }
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  return buffer.str();
+}
+
+// Resolves #include "file" relative to the including shader, the same way
+// glslangValidator does
+class FileIncluder : public shaderc::CompileOptions::IncluderInterface {
+private:
+  struct Include {
+    std::string path;
+    std::string content;
+    shaderc_include_result result;
+  };
+
+public:
+  shaderc_include_result *GetInclude(const char *requestedSource,
+                                     shaderc_include_type type,
+                                     const char *requestingSource,
+                                     size_t includeDepth) override {
+    auto include = new Include;
+    include->path =
+        (fs::path(requestingSource).parent_path() / requestedSource).string();
+    try {
+      include->content = readText(include->path);
+    } catch (const std::runtime_error &error) {
+      // An empty source name tells shaderc the include failed, the content
+      // is the error message
+      include->content = error.what();
+      include->path.clear();
+    }
+    include->result = {
+        .source_name = include->path.c_str(),
+        .source_name_length = include->path.size(),
+        .content = include->content.c_str(),
+        .content_length = include->content.size(),
+        .user_data = include,
+    };
+    return &include->result;
+  }
+
+  void ReleaseInclude(shaderc_include_result *data) override {
+    delete static_cast<Include *>(data->user_data);
+  }
+};
+
+} // namespace
+
+struct ShaderCompiler::Backend {
+  shaderc::Compiler compiler;
+  shaderc::CompileOptions options;
+
+  Backend() {
+    options.SetTargetEnvironment(shaderc_target_env_vulkan,
+                                 shaderc_env_version_vulkan_1_2);
+    options.SetOptimizationLevel(shaderc_optimization_level_performance);
+    options.SetIncluder(std::make_unique<FileIncluder>());
+  }
+
+  ShaderCompileResult compile(const std::string &sourcePath) {
+    shaderc_shader_kind kind;
+    std::string ext = fs::path(sourcePath).extension().string();
+    if (ext == ".vert") {
+      kind = shaderc_vertex_shader;
+    } else if (ext == ".frag") {
+      kind = shaderc_fragment_shader;
+    } else if (ext == ".geom") {
+      kind = shaderc_geometry_shader;
+    } else if (ext == ".comp") {
+      kind = shaderc_compute_shader;
+    } else {
+      throw std::runtime_error(
+          fmt::format("Unknown shader stage for {}", sourcePath));
+    }
+
+    shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(
+        readText(sourcePath), kind, sourcePath.c_str(), options);
+    ShaderCompileResult result{
+        .success = module.GetCompilationStatus() ==
+                   shaderc_compilation_status_success,
+        .diagnostics = parseDiagnostics(module.GetErrorMessage()),
+    };
+    if (result.success) {
+      result.spirv.assign(module.cbegin(), module.cend());
+    }
+    return result;
+  }
+};
+
+#else
+
+struct ShaderCompiler::Backend {
+  ShaderCompileResult compile(const std::string &sourcePath) {
+    std::string spvPath = spvPathFor(sourcePath);
+    std::string command =
+        fmt::format("glslangValidator -V {} -o {} 2>&1", sourcePath, spvPath);
+
+    std::string output;
+    FILE *pipe = popen(command.c_str(), "r");
+    if (pipe == nullptr) {
+      throw std::runtime_error("Failed to run glslangValidator");
+    }
+    char buffer[256];
+    while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
+      output += buffer;
+    }
+    int status = pclose(pipe);
+
+    ShaderCompileResult result{
+        .success = status == 0,
+        .diagnostics = parseDiagnostics(output),
+    };
+    if (result.success) {
+      result.spirv = readSpirv(spvPath);
+    }
+    return result;
+  }
+};
+
+#endif
+
+ShaderCompiler::ShaderCompiler() : backend{std::make_unique<Backend>()} {}
+
+ShaderCompiler::~ShaderCompiler() = default;
+
+ShaderCompileResult ShaderCompiler::compile(const std::string &sourcePath) {
+  auto startT = std::chrono::high_resolution_clock::now();
+  ShaderCompileResult result = backend->compile(sourcePath);
+  spdlog::info("Compiled {} in {:.3f}ms", sourcePath,
+               std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::high_resolution_clock::now() - startT)
+                       .count() *
+                   1e-3);
+  logDiagnostics(result.diagnostics);
+  if (result.success) {
+    std::lock_guard<std::mutex> lock(mutex);
+    compiled[sourcePath] = result.spirv;
+  }
+  return result;
+}
+
+std::vector<uint32_t> ShaderCompiler::spirv(const std::string &sourcePath) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = compiled.find(sourcePath);
+    if (it != compiled.end())
+      return it->second;
+  }
+  std::string spvPath = spvPathFor(sourcePath);
+  if (fs::exists(spvPath)) {
+    std::vector<uint32_t> code = readSpirv(spvPath);
+    std::lock_guard<std::mutex> lock(mutex);
+    // A concurrent compile wins over the build time .spv
+    return compiled.emplace(sourcePath, std::move(code)).first->second;
+  }
+  ShaderCompileResult result = compile(sourcePath);
+  if (!result.success) {
+    throw std::runtime_error(fmt::format("Failed to compile {}", sourcePath));
+  }
+  return result.spirv;
+}
+
+void logDiagnostics(const std::vector<ShaderDiagnostic> &diagnostics) {
+  for (const auto &diagnostic : diagnostics) {
+    if (diagnostic.severity == "warning") {
+      spdlog::warn("{}:{}: {}", diagnostic.file, diagnostic.line,
+                   diagnostic.message);
+    } else {
+      spdlog::error("{}:{}: {}", diagnostic.file, diagnostic.line,
+                    diagnostic.message);
+    }
+  }
+}
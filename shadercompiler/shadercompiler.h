@@ -0,0 +1,50 @@
+/**
+ * Compiles GLSL to SPIR-V in process (shaderc) so hot reload skips the
+ * fork/exec of glslangValidator and never round-trips through disk.
+ * Without shaderc it falls back to glslangValidator but keeps the same
+ * interface, including parsed diagnostics.
+ **/
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct ShaderDiagnostic {
+  std::string file;
+  int line;
+  // "error" or "warning"
+  std::string severity;
+  std::string message;
+};
+
+struct ShaderCompileResult {
+  bool success;
+  std::vector<uint32_t> spirv;
+  std::vector<ShaderDiagnostic> diagnostics;
+};
+
+class ShaderCompiler {
+private:
+  // Backend state (shaderc::Compiler) is kept alive between compiles
+  struct Backend;
+  std::unique_ptr<Backend> backend;
+  std::mutex mutex;
+  // Latest successfully compiled SPIR-V per GLSL source path
+  std::unordered_map<std::string, std::vector<uint32_t>> compiled;
+
+public:
+  ShaderCompiler();
+  ~ShaderCompiler();
+  // Compiles a .vert/.frag/.geom/.comp source, on success the result
+  // replaces the in memory SPIR-V for that path. Safe to call from any
+  // thread. #include "file" resolves relative to the source.
+  ShaderCompileResult compile(const std::string &sourcePath);
+  // Latest SPIR-V for a source path. Uses the build time .spv next to the
+  // source until the first in process compile.
+  std::vector<uint32_t> spirv(const std::string &sourcePath);
+};
+
+void logDiagnostics(const std::vector<ShaderDiagnostic> &diagnostics);
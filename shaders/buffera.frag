@@ -0,0 +1,14 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// Buffer A of the pass graph: the planet scene, marched from the camera
+
+#include "planet.glsl"
+
+layout (location = 0) in vec2 TexCoord;
+layout (location = 0) out vec4 color;
+
+void main()
+{
+    color = vec4(shade(TexCoord, 0.), 1);
+}
@@ -0,0 +1,23 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// Buffer B of the pass graph: feedback. Keeps the brighter of the new scene
+// and its own fading result from last frame, so highlights leave trails.
+
+#include "shadertoy.glsl"
+
+// Buffer A
+layout (set = 0, binding = 0) uniform sampler2D iChannel0;
+// Buffer B, last frame
+layout (set = 0, binding = 1) uniform sampler2D iChannel1;
+layout (location = 0) out vec4 color;
+
+void main()
+{
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    vec3 scene = texelFetch(iChannel0, p, 0).rgb;
+    vec3 history = texelFetch(iChannel1, p, 0).rgb;
+    // Same fade at any frame rate, 10% per frame at 60Hz
+    float keep = pow(.9, iTimeDelta * 60.);
+    color = vec4(max(scene, history * keep), 1);
+}
@@ -0,0 +1,26 @@
+#version 450
+
+// Buffer C of the pass graph: blurred bright parts of Buffer B for bloom.
+// Only lives after Buffer A is done so the graph lets them share memory.
+
+// Buffer B
+layout (set = 0, binding = 0) uniform sampler2D iChannel0;
+layout (location = 0) out vec4 color;
+
+#define threshold .6
+
+void main()
+{
+    vec2 texel = 1. / vec2(textureSize(iChannel0, 0));
+    vec2 uv = gl_FragCoord.xy * texel;
+    vec3 sum = vec3(0.);
+    for (int y = -2; y <= 2; y++)
+    {
+        for (int x = -2; x <= 2; x++)
+        {
+            vec3 c = texture(iChannel0, uv + vec2(x, y) * 2. * texel).rgb;
+            sum += max(c - threshold, 0.);
+        }
+    }
+    color = vec4(sum / 25., 1);
+}
@@ -0,0 +1,60 @@
+#version 450
+
+// Rebuilds the full resolution frame from this frame's half width
+// checkerboard trace and the previous resolved frame
+
+layout (set = 0, binding = 0) uniform sampler2D traced;
+layout (set = 0, binding = 1) uniform sampler2D history;
+layout (push_constant) uniform ResolveConstants {
+    int iFrame;
+    // Zero when history does not hold the previous frame (first frame,
+    // resize, mode switch)
+    int historyValid;
+    ivec2 size;
+} pc;
+layout (location = 0) in vec2 TexCoord;
+layout (location = 0) out vec4 color;
+
+bool tracedThisFrame(ivec2 p)
+{
+    return ((p.x + p.y + pc.iFrame) & 1) == 0;
+}
+
+// Texel of the half width trace covering full resolution pixel p
+vec3 fetchTraced(ivec2 p)
+{
+    p = clamp(p, ivec2(0), pc.size - 1);
+    return texelFetch(traced, ivec2(p.x >> 1, p.y), 0).rgb;
+}
+
+void main()
+{
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    if (tracedThisFrame(p))
+    {
+        color = vec4(fetchTraced(p), 1);
+        return;
+    }
+
+    // The four direct neighbours were all traced this frame
+    vec3 l = fetchTraced(p - ivec2(1, 0));
+    vec3 r = fetchTraced(p + ivec2(1, 0));
+    vec3 u = fetchTraced(p - ivec2(0, 1));
+    vec3 d = fetchTraced(p + ivec2(0, 1));
+    vec3 spatial = (l + r + u + d) * .25;
+    if (pc.historyValid == 0)
+    {
+        color = vec4(spatial, 1);
+        return;
+    }
+
+    // The camera is static so the previous frame traced exactly this pixel.
+    // History outside the range of its fresh neighbours is stale (the
+    // surface moved or was uncovered) and falls back to the spatial estimate.
+    vec3 lo = min(min(l, r), min(u, d));
+    vec3 hi = max(max(l, r), max(u, d));
+    vec3 prev = texelFetch(history, p, 0).rgb;
+    vec3 clamped = clamp(prev, lo, hi);
+    float rejection = clamp(length(prev - clamped) * 4., 0., 1.);
+    color = vec4(mix(clamped, spatial, rejection), 1);
+}
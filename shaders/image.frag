@@ -0,0 +1,18 @@
+#version 450
+
+// Image pass of the pass graph: Buffer B with Buffer C's bloom on top,
+// written in the swapchain format and blitted to it
+
+// Buffer B
+layout (set = 0, binding = 0) uniform sampler2D iChannel0;
+// Buffer C
+layout (set = 0, binding = 1) uniform sampler2D iChannel1;
+layout (location = 0) out vec4 color;
+
+void main()
+{
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    vec3 col = texelFetch(iChannel0, p, 0).rgb;
+    col += texelFetch(iChannel1, p, 0).rgb * 1.5;
+    color = vec4(col, 1);
+}
@@ -0,0 +1,133 @@
+// Scene shared by the raymarching stages (planet.frag, planetcompute.comp,
+// prepass.frag, buffera.frag), include right after the #version line
+
+#include "shadertoy.glsl"
+
+// Flags that differ between the passes of one frame
+layout (push_constant) uniform PushConstants {
+    // Non zero when rendering half width for checkerboard resolve
+    int checkerboard;
+    // Non zero when the distance prepass ran and its result is bound
+    int prepass;
+} pc;
+
+// Quality tier, set per pipeline by the specialization constants in
+// quality.cpp. The defaults are the medium tier.
+layout (constant_id = 0) const int maxSteps = 100;
+layout (constant_id = 1) const float eps = 0.005;
+layout (constant_id = 2) const float far = 40.;
+layout (constant_id = 3) const bool reflections = true;
+
+#define time iTime*.25
+#define PI 3.1415926
+
+// https://www.shadertoy.com/view/MdjyRm
+
+vec2 rotate(vec2 p, float a)
+{
+    float t = atan(p.y, p.x)+a;
+    float l = length(p);
+    return vec2(l*cos(t), l*sin(t));
+}
+
+float sdTorus( vec3 p, vec2 t )
+{
+  vec2 q = vec2(length(p.xz)-t.x,p.y);
+  return length(q)-t.y;
+}
+
+vec3 tri(in vec3 x){return abs(x-floor(x)-.5);} // Triangle function.
+
+float distort(vec3 p)
+{
+    // return sin(p.x + sin(p.y + time * .1) + sin(p.z)*p.z + p.x + p.y + time);
+    //return -3.;
+    return dot(tri(p + time) + sin(tri(p + time)), vec3(.966));
+    // return dot(tri(p+time) + sin(tri(p+time)), vec3(.666));
+}
+
+float trap;
+
+float map(vec3 p)
+{
+    p.z += .2;
+    p += distort(p*distort(p))*.1;
+    trap = dot(sin(p), 1.-abs(p))*1.2;
+    float d = -sdTorus(p, vec2(1., .7)) + distort(p)*.05;
+    
+    return d;
+}
+
+vec3 calcNormal(vec3 p)
+{
+    vec2 e = vec2(eps, 0);
+    return normalize(vec3(
+        map(p+e.xyy)-map(p-e.xyy),
+        map(p+e.yxy)-map(p-e.yxy),
+        map(p+e.yyx)-map(p-e.yyx)
+        ));
+}
+
+float trace(vec3 r, vec3 d, float start)
+{
+    float m, t=start;
+    for (int i = 0; i < maxSteps; i++)
+    {
+        m = map(r + d * t);
+        t += m;
+        if (m < eps || t > far) break;
+    }
+    return t;
+}
+
+// The distance prepass renders 1/prepassScale of the resolution in each
+// direction, keep in sync with prepassScale in vkcommon/vkcommon.h
+#define prepassScale 8
+
+// Extent of the prepass target for this frame's render
+ivec2 prepassSize()
+{
+    return (ivec2(iResolution.xy) + prepassScale - 1) / prepassScale;
+}
+
+// Prepass texel covering texCoord of the full resolution render
+ivec2 prepassTexel(vec2 texCoord)
+{
+    ivec2 size = prepassSize();
+    return min(ivec2(texCoord * vec2(size)), size - 1);
+}
+
+// Colour of the scene at texCoord in [0, 1] across the render target.
+// tStart is where the primary ray may start marching, 0 without prepass.
+vec3 shade(vec2 texCoord, float tStart)
+{
+    // normalize to [-1, 1]
+    vec2 uv = texCoord * 2.0 - 1.0;
+    uv.x *= 1.4;
+    
+    vec3 r = vec3(0, 0, 1), d = normalize(vec3(uv, -1)), p, n, col;
+    col = vec3(0.);
+    float t = trace(r, d, tStart);
+    p = r + d * t;
+    
+    n = calcNormal(p);
+    
+    if (t < far)
+    {
+        vec3 objcol = vec3(trap/abs(1.-trap), trap*trap, 1.-trap);
+        vec3 lp = vec3(1, 3, 3);
+        vec3 ld = lp - p;
+        float len = length(ld);
+        float atten = max(0., 1./(len*len));
+        ld /= len;
+        float amb = .25;
+        float diff = max(0., dot(ld, n));
+        float spec = pow(max(0., dot(reflect(-ld, n), r)), 8.);
+        // Without the bounce use roughly the distance it travels across
+        // the tube on average
+        float ref = reflections ? trace(r, reflect(d, n), eps*5.) : 1.;
+        col = objcol * (((diff*.8+amb*.8)+.1*spec)+atten*.1)*ref;
+    }
+    
+    return col;
+}
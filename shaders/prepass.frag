@@ -0,0 +1,38 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// Coarse distance prepass, rendered at 1/prepassScale resolution. Marches
+// a cone enclosing every primary ray through this texel and stores a
+// distance all of them can start marching from.
+
+#include "planet.glsl"
+
+layout (location = 0) in vec2 TexCoord;
+layout (location = 0) out float startDistance;
+
+// map() is distorted and not an exact distance bound, back off this
+// fraction of the distance on top of the cone test
+#define safety .2
+
+void main()
+{
+    // Same camera as shade()
+    vec2 uv = TexCoord * 2.0 - 1.0;
+    uv.x *= 1.4;
+    vec3 r = vec3(0, 0, 1), d = normalize(vec3(uv, -1));
+
+    // Tangent of the cone half angle: half the texel diagonal on the z = -1
+    // image plane, which contains every full resolution pixel centre in it
+    float k = .5 * length(vec2(2.8, 2.) / vec2(prepassSize()));
+
+    float t = 0.;
+    for (int i = 0; i < maxSteps; i++)
+    {
+        float m = map(r + d * t);
+        // The surface may be inside the cone, rays can only start here
+        if (m < k * t + eps || t > far) break;
+        // Largest step that keeps the whole cone cross section clear
+        t += (m - k * t) / (1. + k);
+    }
+    startDistance = max(0., t * (1. - safety));
+}
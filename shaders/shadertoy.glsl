@@ -0,0 +1,17 @@
+// Shadertoy inputs, written once per frame into a ring buffer slot and
+// bound with a dynamic offset to set 1 of every pass. Keep in sync with
+// ShaderToyUniforms in vkcommon/vkcommon.h (std140).
+layout (set = 1, binding = 0) uniform ShaderToy {
+    // Full resolution render extent, z is the pixel aspect ratio
+    vec3 iResolution;
+    float iTime;
+    vec4 iMouse;
+    // Year, month (0 based), day and seconds since midnight
+    vec4 iDate;
+    // Render extent in the pass graph, where every channel is a graph
+    // image. All zero everywhere else.
+    vec3 iChannelResolution[4];
+    float iTimeDelta;
+    float iFrameRate;
+    int iFrame;
+};
@@ -0,0 +1,166 @@
+#include "taskgraph.h"
+#include "../jobs/jobs.h"
+#include "../trace/trace.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <numeric>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <utility>
+
+TaskGraph::TaskGraph(const uint32_t &workerCount) : workerCount{workerCount} {}
+
+TaskGraph::TaskId TaskGraph::add(const char *name, const Affinity &affinity,
+                                 const std::vector<TaskId> &dependencies,
+                                 Task task) {
+  TaskId id = static_cast<TaskId>(nodes.size());
+  for (TaskId dependency : dependencies) {
+    if (dependency >= id) {
+      throw std::runtime_error(
+          fmt::format("Task {} depends on a task added after it", name));
+    }
+  }
+  nodes.push_back({name, affinity, dependencies, std::move(task)});
+  return id;
+}
+
+void TaskGraph::run() {
+  runStartNs = trace::nowNs();
+  std::mutex mutex;
+  // Signaled when a task finished or a main thread task became ready
+  std::condition_variable changed;
+  // Unfinished dependencies per task and the tasks waiting on each
+  std::vector<uint32_t> waiting(nodes.size());
+  std::vector<std::vector<TaskId>> dependents(nodes.size());
+  for (TaskId id = 0; id < nodes.size(); id++) {
+    waiting[id] = nodes[id].dependencies.size();
+    for (TaskId dependency : nodes[id].dependencies)
+      dependents[dependency].push_back(id);
+  }
+  std::deque<TaskId> mainReady;
+  // Started and not finished, including the queued main thread tasks
+  uint32_t running = 0;
+  std::exception_ptr failure;
+  JobSystem jobs(workerCount);
+
+  auto execute = [&](const TaskId &id) {
+    Node &node = nodes[id];
+    std::exception_ptr thrown;
+    node.startNs = trace::nowNs();
+    try {
+      node.task();
+    } catch (...) {
+      thrown = std::current_exception();
+    }
+    node.endNs = trace::nowNs();
+#ifdef PLANET_TRACE_ENABLED
+    trace::record(node.name, node.startNs, node.endNs - node.startNs);
+#endif
+    return thrown;
+  };
+  // start and finish run with the lock held
+  std::function<void(const TaskId &)> start;
+  std::function<void(const TaskId &, const std::exception_ptr &)> finish;
+  start = [&](const TaskId &id) {
+    running++;
+    if (nodes[id].affinity == Affinity::Main) {
+      mainReady.push_back(id);
+      changed.notify_all();
+      return;
+    }
+    jobs.submit([&, id]() {
+      std::exception_ptr thrown = execute(id);
+      std::lock_guard<std::mutex> lock(mutex);
+      finish(id, thrown);
+    });
+  };
+  finish = [&](const TaskId &id, const std::exception_ptr &thrown) {
+    running--;
+    if (thrown && !failure)
+      failure = thrown;
+    if (!failure) {
+      for (TaskId dependent : dependents[id]) {
+        if (--waiting[dependent] == 0)
+          start(dependent);
+      }
+    }
+    changed.notify_all();
+  };
+
+  std::unique_lock<std::mutex> lock(mutex);
+  for (TaskId id = 0; id < nodes.size(); id++) {
+    if (waiting[id] == 0)
+      start(id);
+  }
+  while (true) {
+    changed.wait(lock, [&]() { return !mainReady.empty() || running == 0; });
+    if (mainReady.empty())
+      break;
+    TaskId id = mainReady.front();
+    mainReady.pop_front();
+    // Became ready before a worker task failed
+    if (failure) {
+      finish(id, nullptr);
+      continue;
+    }
+    lock.unlock();
+    std::exception_ptr thrown = execute(id);
+    lock.lock();
+    finish(id, thrown);
+  }
+  lock.unlock();
+  // The last worker may still be returning from its job
+  jobs.wait();
+  runEndNs = trace::nowNs();
+  if (failure)
+    std::rethrow_exception(failure);
+}
+
+int64_t TaskGraph::endNs() const { return runEndNs; }
+
+void TaskGraph::logTimings(const int64_t &originNs) const {
+  std::vector<TaskId> order(nodes.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [this](TaskId a, TaskId b) {
+    return nodes[a].startNs < nodes[b].startNs;
+  });
+  int64_t busyNs = 0;
+  spdlog::info("{:<24} {:>10} {:>10}", "Startup task", "start ms", "took ms");
+  for (TaskId id : order) {
+    const Node &node = nodes[id];
+    if (node.startNs < 0)
+      continue;
+    busyNs += node.endNs - node.startNs;
+    spdlog::info("{:<24} {:>10.3f} {:>10.3f} {}", node.name,
+                 (node.startNs - originNs) * 1e-6,
+                 (node.endNs - node.startNs) * 1e-6,
+                 node.affinity == Affinity::Main ? "main" : "worker");
+  }
+  spdlog::info("Startup tasks took {:.3f}ms for {:.3f}ms of work",
+               (runEndNs - runStartNs) * 1e-6, busyNs * 1e-6);
+
+  // Back from the task that finished last, always through the dependency
+  // that finished last, the chain that bounded the graph's run time
+  auto finishedLast = [this](const std::vector<TaskId> &ids) {
+    return *std::max_element(
+        ids.begin(), ids.end(),
+        [this](TaskId a, TaskId b) { return nodes[a].endNs < nodes[b].endNs; });
+  };
+  if (nodes.empty() || runEndNs < 0)
+    return;
+  std::vector<TaskId> all(nodes.size());
+  std::iota(all.begin(), all.end(), 0);
+  std::vector<TaskId> path{finishedLast(all)};
+  while (!nodes[path.back()].dependencies.empty())
+    path.push_back(finishedLast(nodes[path.back()].dependencies));
+  std::string chain;
+  for (auto it = path.rbegin(); it != path.rend(); ++it) {
+    const Node &node = nodes[*it];
+    chain += fmt::format("{}{} {:.3f}ms", chain.empty() ? "" : " > ",
+                         node.name, (node.endNs - node.startNs) * 1e-6);
+  }
+  spdlog::info("Startup critical path: {}", chain);
+}
@@ -0,0 +1,51 @@
+/**
+ * Runs startup work as a graph of named tasks, each started as soon as the
+ * tasks it depends on have finished, so independent work like loading
+ * shaders and building pipelines overlaps with window and swapchain setup.
+ * Tasks that have to stay on the main thread (GLFW) run on the thread that
+ * calls run(), everything else on worker threads. When each task ran is
+ * recorded for a startup breakdown and the trace.
+ **/
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class TaskGraph {
+public:
+  using Task = std::function<void()>;
+  // Tasks are numbered in the order they were added
+  using TaskId = uint32_t;
+  enum class Affinity { Main, Worker };
+
+private:
+  struct Node {
+    // A string literal, it ends up in the trace
+    const char *name;
+    Affinity affinity;
+    std::vector<TaskId> dependencies;
+    Task task;
+    // trace::nowNs() clock, -1 until the task ran
+    int64_t startNs = -1;
+    int64_t endNs = -1;
+  };
+  std::vector<Node> nodes;
+  uint32_t workerCount;
+  int64_t runStartNs = -1;
+  int64_t runEndNs = -1;
+
+public:
+  explicit TaskGraph(const uint32_t &workerCount);
+  // Dependencies have to be added first, which keeps the graph acyclic
+  TaskId add(const char *name, const Affinity &affinity,
+             const std::vector<TaskId> &dependencies, Task task);
+  // Runs every task and returns once all have finished. If a task throws
+  // nothing else is started and the first exception is rethrown once the
+  // running tasks have finished.
+  void run();
+  // trace::nowNs() when run() returned
+  int64_t endNs() const;
+  // Logs when each task started relative to originNs and how long it took,
+  // how much work overlapped and the chain of tasks run() waited on
+  void logTimings(const int64_t &originNs) const;
+};
@@ -0,0 +1,127 @@
+#include "tilerecorder.h"
+#include "../trace/trace.h"
+#include "../vkcommon/vkcommon.h"
+#include <algorithm>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+std::vector<VkRect2D> splitTiles(const VkExtent2D &extent,
+                                 const uint32_t &tilesPerSide) {
+  std::vector<VkRect2D> tiles;
+  tiles.reserve(tilesPerSide * tilesPerSide);
+  // Edges are rounded so the tiles cover every pixel exactly once
+  for (uint32_t row = 0; row < tilesPerSide; row++) {
+    uint32_t y0 = extent.height * row / tilesPerSide;
+    uint32_t y1 = extent.height * (row + 1) / tilesPerSide;
+    for (uint32_t column = 0; column < tilesPerSide; column++) {
+      uint32_t x0 = extent.width * column / tilesPerSide;
+      uint32_t x1 = extent.width * (column + 1) / tilesPerSide;
+      if (x1 == x0 || y1 == y0)
+        continue;
+      tiles.push_back(VkRect2D{
+          .offset = {static_cast<int32_t>(x0), static_cast<int32_t>(y0)},
+          .extent = {x1 - x0, y1 - y0},
+      });
+    }
+  }
+  return tiles;
+}
+
+TileRecorder::TileRecorder(const VkDevice &device,
+                           const uint32_t &queueFamilyIndex, JobSystem &jobs,
+                           const uint32_t &framesInFlight)
+    : device{device}, jobs{jobs}, framesInFlight{framesInFlight} {
+  // Command pools are externally synchronized, one per run keeps the
+  // workers from ever contending on one
+  uint32_t runs = jobs.workerCount() * framesInFlight;
+  commandPools.resize(runs, VK_NULL_HANDLE);
+  commandBuffers.resize(runs, VK_NULL_HANDLE);
+  for (uint32_t i = 0; i < runs; i++) {
+    VkCommandPoolCreateInfo commandPoolCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = queueFamilyIndex,
+    };
+    VK_CHECK(vkCreateCommandPool(device, &commandPoolCreateInfo, nullptr,
+                                 &commandPools[i]));
+    VkCommandBufferAllocateInfo commandBufferAllocateInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = commandPools[i],
+        .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+        .commandBufferCount = 1,
+    };
+    VK_CHECK(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo,
+                                      &commandBuffers[i]));
+  }
+  spdlog::info("Tile recorder: {} workers, {} command pools",
+               jobs.workerCount(), runs);
+}
+
+std::vector<VkCommandBuffer>
+TileRecorder::record(const uint32_t &slot, const VkFormat &colorFormat,
+                     const VkExtent2D &extent,
+                     const std::vector<VkRect2D> &tiles, const Bind &bind) {
+  TRACE_SCOPE("recordTiles");
+  uint32_t runCount = std::min<size_t>(jobs.workerCount(), tiles.size());
+  std::vector<VkCommandBuffer> recorded;
+  for (uint32_t run = 0; run < runCount; run++) {
+    uint32_t index = run * framesInFlight + slot;
+    recorded.push_back(commandBuffers[index]);
+    // Tiles [first, last) of this run
+    size_t first = tiles.size() * run / runCount;
+    size_t last = tiles.size() * (run + 1) / runCount;
+    jobs.submit([&, index, first, last]() {
+      TRACE_SCOPE("recordTileRun");
+      VkCommandBuffer commandBuffer = commandBuffers[index];
+      // Resetting the pool is cheaper than resetting its buffers one by one
+      VK_CHECK(vkResetCommandPool(device, commandPools[index], 0));
+      // Has to match the vkCmdBeginRendering the primary executes it in
+      VkCommandBufferInheritanceRenderingInfoKHR inheritanceRenderingInfo{
+          .sType =
+              VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR,
+          .colorAttachmentCount = 1,
+          .pColorAttachmentFormats = &colorFormat,
+          .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+      };
+      VkCommandBufferInheritanceInfo inheritanceInfo{
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+          .pNext = &inheritanceRenderingInfo,
+      };
+      VkCommandBufferBeginInfo commandBufferBeginInfo{
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+          .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                   VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+          .pInheritanceInfo = &inheritanceInfo,
+      };
+      VK_CHECK(vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo));
+      // Secondary command buffers inherit no state from the primary
+      bind(commandBuffer);
+      // The viewport spans the whole image so every tile sees the same
+      // gl_FragCoord it would without tiling
+      VkViewport viewport{
+          .x = 0.0f,
+          .y = 0.0f,
+          .width = static_cast<float>(extent.width),
+          .height = static_cast<float>(extent.height),
+          .minDepth = 0.0f,
+          .maxDepth = 1.0f,
+      };
+      vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+      for (size_t tile = first; tile < last; tile++) {
+        vkCmdSetScissor(commandBuffer, 0, 1, &tiles[tile]);
+        vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+      }
+      VK_CHECK(vkEndCommandBuffer(commandBuffer));
+    });
+  }
+  jobs.wait();
+  return recorded;
+}
+
+void TileRecorder::destroy() {
+  // Destroying a pool frees its command buffers
+  for (auto &commandPool : commandPools)
+    vkDestroyCommandPool(device, commandPool, nullptr);
+  commandPools.clear();
+  commandBuffers.clear();
+}
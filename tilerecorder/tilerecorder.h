@@ -0,0 +1,47 @@
+/**
+ * Records the draws of many viewport tiles in parallel. The tiles are split
+ * into one contiguous run per job system worker, every run is recorded into
+ * a secondary command buffer from its own command pool per frame in flight,
+ * and the primary command buffer executes them inside dynamic rendering.
+ **/
+#pragma once
+#include "../jobs/jobs.h"
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Splits extent into a tilesPerSide x tilesPerSide grid, row major
+std::vector<VkRect2D> splitTiles(const VkExtent2D &extent,
+                                 const uint32_t &tilesPerSide);
+
+class TileRecorder {
+public:
+  // Binds the pipeline, descriptor sets and push constants of the tiles.
+  // Called from several worker threads at once.
+  using Bind = std::function<void(const VkCommandBuffer &commandBuffer)>;
+
+private:
+  VkDevice device;
+  JobSystem &jobs;
+  uint32_t framesInFlight;
+  // One per worker and frame in flight, run major, with one secondary
+  // command buffer each
+  std::vector<VkCommandPool> commandPools;
+  std::vector<VkCommandBuffer> commandBuffers;
+
+public:
+  TileRecorder(const VkDevice &device, const uint32_t &queueFamilyIndex,
+               JobSystem &jobs, const uint32_t &framesInFlight);
+  // Records a viewport covering extent and one scissored fullscreen
+  // triangle per tile, for rendering into a single colorFormat attachment.
+  // The GPU has to be done with slot's previous buffers. Returns the
+  // secondary command buffers to execute, in tile order.
+  std::vector<VkCommandBuffer> record(const uint32_t &slot,
+                                      const VkFormat &colorFormat,
+                                      const VkExtent2D &extent,
+                                      const std::vector<VkRect2D> &tiles,
+                                      const Bind &bind);
+  // Only call once the device is idle
+  void destroy();
+};
@@ -0,0 +1,142 @@
+#include "trace.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <spdlog/spdlog.h>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+// A seqlock per slot: sequence is invalidated before the payload is written
+// and set to the slot's index after. A dump copies the payload between two
+// reads of sequence and drops the copy unless both saw the same index. The
+// payload is relaxed atomics so a concurrent overwrite is not a data race.
+struct Event {
+  std::atomic<uint64_t> sequence{UINT64_MAX};
+  std::atomic<const char *> name{nullptr};
+  std::atomic<uint32_t> track{0};
+  std::atomic<int64_t> startNs{0};
+  std::atomic<int64_t> durationNs{0};
+};
+
+constexpr size_t ringSize = 1 << 16;
+std::array<Event, ringSize> ring;
+std::atomic<uint64_t> head{0};
+std::atomic<bool> enabled{false};
+std::atomic<uint32_t> nextThreadId{0};
+const auto epoch = std::chrono::steady_clock::now();
+
+uint32_t threadTrack() {
+  thread_local uint32_t id = nextThreadId.fetch_add(1);
+  return id;
+}
+
+struct Snapshot {
+  const char *name;
+  uint32_t track;
+  int64_t startNs;
+  int64_t durationNs;
+};
+
+// Events currently in the ring, oldest first
+std::vector<Snapshot> snapshot() {
+  uint64_t end = head.load(std::memory_order_acquire);
+  uint64_t begin = end > ringSize ? end - ringSize : 0;
+  std::vector<Snapshot> events;
+  events.reserve(end - begin);
+  for (uint64_t i = begin; i < end; i++) {
+    const Event &event = ring[i & (ringSize - 1)];
+    if (event.sequence.load(std::memory_order_acquire) != i)
+      continue;
+    Snapshot copy{event.name.load(std::memory_order_relaxed),
+                  event.track.load(std::memory_order_relaxed),
+                  event.startNs.load(std::memory_order_relaxed),
+                  event.durationNs.load(std::memory_order_relaxed)};
+    // Keeps the payload loads before the second sequence load, a writer
+    // that lapped the ring meanwhile has changed it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (event.sequence.load(std::memory_order_relaxed) != i)
+      continue;
+    events.push_back(copy);
+  }
+  return events;
+}
+
+} // namespace
+
+void setEnabled(bool value) {
+  enabled.store(value, std::memory_order_relaxed);
+}
+
+bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - epoch)
+      .count();
+}
+
+void record(const char *name, int64_t startNs, int64_t durationNs) {
+  record(name, startNs, durationNs, threadTrack());
+}
+
+void record(const char *name, int64_t startNs, int64_t durationNs,
+            uint32_t track) {
+  if (!isEnabled())
+    return;
+  uint64_t index = head.fetch_add(1, std::memory_order_relaxed);
+  Event &event = ring[index & (ringSize - 1)];
+  event.sequence.store(UINT64_MAX, std::memory_order_relaxed);
+  // Keeps the invalidation visible before any of the payload stores
+  std::atomic_thread_fence(std::memory_order_release);
+  event.name.store(name, std::memory_order_relaxed);
+  event.track.store(track, std::memory_order_relaxed);
+  event.startNs.store(startNs, std::memory_order_relaxed);
+  event.durationNs.store(durationNs, std::memory_order_relaxed);
+  event.sequence.store(index, std::memory_order_release);
+}
+
+bool dumpChromeTrace(const std::string &path) {
+  std::ofstream file(path);
+  if (!file) {
+    spdlog::error("Failed to open {}", path);
+    return false;
+  }
+  file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  file << fmt::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                      "\"tid\":{},\"args\":{{\"name\":\"GPU\"}}}}",
+                      gpuTrack);
+  for (const auto &event : snapshot()) {
+    file << fmt::format(",\n{{\"name\":\"{}\",\"cat\":\"frame\",\"ph\":\"X\","
+                        "\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+                        event.name, event.track, event.startNs * 1e-3,
+                        event.durationNs * 1e-3);
+  }
+  file << "\n]}\n";
+  return true;
+}
+
+bool dumpCsv(const std::string &path) {
+  std::ofstream file(path);
+  if (!file) {
+    spdlog::error("Failed to open {}", path);
+    return false;
+  }
+  file << "name,track,start_us,duration_us\n";
+  for (const auto &event : snapshot()) {
+    file << fmt::format("{},{},{:.3f},{:.3f}\n", event.name, event.track,
+                        event.startNs * 1e-3, event.durationNs * 1e-3);
+  }
+  return true;
+}
+
+void dump(const std::string &prefix) {
+  if (dumpChromeTrace(prefix + ".json") && dumpCsv(prefix + ".csv")) {
+    spdlog::info("Wrote trace to {}.json and {}.csv", prefix, prefix);
+  }
+}
+
+} // namespace trace
@@ -0,0 +1,62 @@
+/**
+ * Frame phase tracing into a preallocated lock-free ring buffer that can be
+ * dumped as Chrome trace JSON (chrome://tracing, Perfetto) or CSV.
+ * Build with -DPLANET_TRACE=OFF to compile the instrumentation out entirely,
+ * otherwise a disabled tracer costs one relaxed atomic load per scope.
+ **/
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace trace {
+
+// Track id used for GPU intervals from the timestamp query pool
+constexpr uint32_t gpuTrack = 1000;
+
+void setEnabled(bool enabled);
+bool isEnabled();
+int64_t nowNs();
+// Track defaults to a small per thread id
+void record(const char *name, int64_t startNs, int64_t durationNs);
+void record(const char *name, int64_t startNs, int64_t durationNs,
+            uint32_t track);
+
+bool dumpChromeTrace(const std::string &path);
+bool dumpCsv(const std::string &path);
+// Writes <prefix>.json and <prefix>.csv
+void dump(const std::string &prefix);
+
+class Scope {
+private:
+  const char *name;
+  int64_t startNs;
+
+public:
+  explicit Scope(const char *name)
+      : name{name}, startNs{isEnabled() ? nowNs() : -1} {}
+  ~Scope() {
+    if (startNs >= 0)
+      record(name, startNs, nowNs() - startNs);
+  }
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+};
+
+} // namespace trace
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifdef PLANET_TRACE_ENABLED
+// Records the enclosing scope, name must be a string literal
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_GPU(name, startNs, durationNs)                                  \
+  trace::record(name, startNs, durationNs, trace::gpuTrack)
+#else
+#define TRACE_SCOPE(name)                                                      \
+  do {                                                                         \
+  } while (0)
+#define TRACE_GPU(name, startNs, durationNs)                                  \
+  do {                                                                         \
+  } while (0)
+#endif
@@ -0,0 +1,933 @@
+#include "vkcommon.h"
+#include "../trace/trace.h"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <spdlog/spdlog.h>
+
+std::vector<char> readFile(const std::string &filename) {
+  std::ifstream file(filename, std::ios::ate | std::ios::binary);
+  size_t fileSize = (size_t)file.tellg();
+  std::vector<char> buffer(fileSize);
+  file.seekg(0);
+  file.read(buffer.data(), fileSize);
+  file.close();
+  return buffer;
+}
+
+VkShaderModule loadShaderModule(const VkDevice &device,
+                                const std::vector<uint32_t> &code) {
+  VkShaderModule shaderModule;
+  VkShaderModuleCreateInfo createInfo = {
+      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+      .pNext = nullptr,
+      .flags = 0,
+      .codeSize = code.size() * sizeof(uint32_t),
+      .pCode = code.data(),
+  };
+  spdlog::info("Creating shader module");
+  VK_CHECK(vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule));
+  return shaderModule;
+}
+
+VkShaderModule loadShaderModule(const VkDevice &device, const char *path) {
+  spdlog::info("Loading shader module {}", path);
+  std::vector<char> bytes = readFile(path);
+  std::vector<uint32_t> code(bytes.size() / sizeof(uint32_t));
+  memcpy(code.data(), bytes.data(), code.size() * sizeof(uint32_t));
+  return loadShaderModule(device, code);
+}
+
+bool hasInstanceExtension(const char *name) {
+  uint32_t count;
+  vkEnumerateInstanceExtensionProperties(nullptr, &count, nullptr);
+  std::vector<VkExtensionProperties> available(count);
+  vkEnumerateInstanceExtensionProperties(nullptr, &count, available.data());
+  return std::any_of(available.begin(), available.end(),
+                     [name](const VkExtensionProperties &extension) {
+                       return strcmp(extension.extensionName, name) == 0;
+                     });
+}
+
+bool hasDeviceExtension(const VkPhysicalDevice &physicalDevice,
+                        const char *name) {
+  uint32_t count;
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count,
+                                       nullptr);
+  std::vector<VkExtensionProperties> available(count);
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count,
+                                       available.data());
+  return std::any_of(available.begin(), available.end(),
+                     [name](const VkExtensionProperties &extension) {
+                       return strcmp(extension.extensionName, name) == 0;
+                     });
+}
+
+VkInstance setupVulkanInstance(const bool &headless) {
+  VkApplicationInfo appInfo = {
+      .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+      .pNext = nullptr,
+      .pApplicationName = "Planet",
+      .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
+      .pEngineName = "Planet Engine",
+      .engineVersion = VK_MAKE_VERSION(1, 0, 0),
+      .apiVersion = VK_API_VERSION_1_2,
+  };
+  // Headless mode never initialises GLFW so needs no surface extensions
+  uint32_t extensionCount = 0;
+  const char **reqExtensions =
+      headless ? nullptr : glfwGetRequiredInstanceExtensions(&extensionCount);
+  spdlog::info("Required extensions count: {}", extensionCount);
+  for (uint32_t i = 0; i < extensionCount; i++) {
+    spdlog::info("{}", reqExtensions[i]);
+  }
+
+  // Create an array of extensions which include
+  // VK_KHR_portability_enumeration and VK_MVK_MACOS_SURFACE_EXTENSION_NAME
+  std::vector<const char *> extensions;
+  for (uint32_t i = 0; i < extensionCount; i++) {
+    extensions.emplace_back(reqExtensions[i]);
+  }
+  // Only needed (and only available) on portability drivers like MoltenVK
+  VkInstanceCreateFlags instanceFlags = 0;
+  if (hasInstanceExtension("VK_KHR_portability_enumeration")) {
+    extensions.emplace_back("VK_KHR_portability_enumeration");
+    instanceFlags |= VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
+  }
+
+  spdlog::info("Using the following extensions");
+  for (const auto &extension : extensions) {
+    spdlog::info("{}", extension);
+  }
+
+  spdlog::info("Creating vk instance");
+
+  // Enable validation layers
+  // as a c++ std::array with the basic validation layer
+  static constexpr std::array<const char *, 0> validationLayers = {
+      // VK_LAYER_KHRONOS_validation seems to have a bug in dynamic rendering
+      // (at least through moltenvk) so can't seem to enable it
+      // "VK_LAYER_KHRONOS_validation",
+      // api dump
+      // "VK_LAYER_LUNARG_api_dump",
+      // "VK_LAYER_LUNARG_parameter_validation",
+      // "VK_LAYER_LUNARG_screenshot",
+      // "VK_LAYER_LUNARG_core_validation",
+      // "VK_LAYER_LUNARG_device_limits",
+      // "VK_LAYER_LUNARG_object_tracker",
+  };
+
+  VkInstanceCreateInfo createInfo = {
+      .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+      .pNext = nullptr,
+      .flags = instanceFlags,
+      .pApplicationInfo = &appInfo,
+      .enabledLayerCount = static_cast<uint32_t>(validationLayers.size()),
+      .ppEnabledLayerNames = validationLayers.data(),
+      .enabledExtensionCount = static_cast<uint32_t>(extensions.size()),
+      .ppEnabledExtensionNames = extensions.data(),
+  };
+
+  VkInstance instance;
+  VK_CHECK(vkCreateInstance(&createInfo, nullptr, &instance));
+  return instance;
+}
+
+VkPhysicalDevice findGPU(const VkInstance &instance) {
+  // Find all GPU Devices
+  uint32_t deviceCount = 0;
+  spdlog::info("Enumerating devices...");
+  vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+  spdlog::info("Found {} devices", deviceCount);
+
+  // Save devices to vector
+  std::vector<VkPhysicalDevice> devices{deviceCount};
+  vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+
+  // Print all devices
+  for (uint32_t i = 0; i < deviceCount; i++) {
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(devices[i], &deviceProperties);
+    spdlog::info("Device {} has Vulkan version {}", i,
+                 deviceProperties.apiVersion);
+    spdlog::info("Device {} has driver version {}", i,
+                 deviceProperties.driverVersion);
+    spdlog::info("Device {} has vendor ID {}", i, deviceProperties.vendorID);
+    spdlog::info("Device {} has device ID {}", i, deviceProperties.deviceID);
+    spdlog::info("Device {} has device type {}", i,
+                 static_cast<uint32_t>(deviceProperties.deviceType));
+    spdlog::info("Device {} has device name {}", i,
+                 deviceProperties.deviceName);
+  }
+
+  // just return 1st device (assume 1 GPU and use 1 GPU)
+  return devices[0];
+}
+
+uint32_t getVulkanGraphicsQueueIndex(const VkPhysicalDevice &physicalDevice,
+                                     const VkSurfaceKHR &surface) {
+  int32_t graphicsQueueIndex = -1;
+
+  // https://github.com/KhronosGroup/Vulkan-Samples/blob/cc7b29696011e7499379695947b9e634ed61ea10/samples/api/hello_triangle/hello_triangle.cpp#L293
+  // Just use GPU 0 for now
+
+  uint32_t queueFamilyCount;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+                                           nullptr);
+
+  spdlog::info("Found {} queue families", queueFamilyCount);
+
+  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+                                           queueFamilies.data());
+
+  // Print debug info for all queue families
+  for (uint32_t i = 0; i < queueFamilyCount; i++) {
+    spdlog::info("Queue family {} has {} queues", i,
+                 queueFamilies[i].queueCount);
+    spdlog::info("Queue family {} supports graphics: {} ", i,
+                 queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT);
+    spdlog::info("Queue family {} supports compute: {} ", i,
+                 queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT);
+    spdlog::info("Queue family {} supports transfer: {} ", i,
+                 queueFamilies[i].queueFlags & VK_QUEUE_TRANSFER_BIT);
+    spdlog::info("Queue family {} supports sparse binding: {} ", i,
+                 queueFamilies[i].queueFlags & VK_QUEUE_SPARSE_BINDING_BIT);
+    spdlog::info("Queue family {} supports protected: {} ", i,
+                 queueFamilies[i].queueFlags & VK_QUEUE_PROTECTED_BIT);
+
+    // Without a surface (headless) any graphics queue will do
+    VkBool32 supportsPresent = VK_TRUE;
+    if (surface != VK_NULL_HANDLE) {
+      vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface,
+                                           &supportsPresent);
+    }
+    spdlog::info("Queue family {} supports present: {} ", i, supportsPresent);
+
+    if (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT &&
+        supportsPresent) {
+      graphicsQueueIndex = i;
+    }
+  }
+
+  if (graphicsQueueIndex == -1) {
+    throw std::runtime_error("Failed to find graphics queue");
+  }
+  return static_cast<uint32_t>(graphicsQueueIndex);
+}
+
+VkDevice createVulkanLogicalDevice(const VkPhysicalDevice &physicalDevice,
+                                   const uint32_t &graphicsQueueIndex,
+                                   const bool &headless) {
+  float queuePriority = 1.0f;
+  // Create one queue
+  VkDeviceQueueCreateInfo queueInfo = {
+      .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+      .queueFamilyIndex = static_cast<uint32_t>(graphicsQueueIndex),
+      .queueCount = 1,
+      .pQueuePriorities = &queuePriority,
+  };
+
+  std::vector<const char *> requiredExtensions = {"VK_KHR_dynamic_rendering"};
+  if (!headless) {
+    requiredExtensions.emplace_back("VK_KHR_swapchain");
+  }
+  // Must be enabled when the implementation exposes it (MoltenVK)
+  if (hasDeviceExtension(physicalDevice, "VK_KHR_portability_subset")) {
+    requiredExtensions.emplace_back("VK_KHR_portability_subset");
+  }
+  // Only the pass graph needs it, enabled whenever it is there
+  bool synchronization2 =
+      hasDeviceExtension(physicalDevice, "VK_KHR_synchronization2");
+  if (synchronization2) {
+    requiredExtensions.emplace_back("VK_KHR_synchronization2");
+  }
+
+  // Create a logical device
+  spdlog::info("Create a logical device...");
+  VkDevice device;
+
+  VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR,
+      .synchronization2 = VK_TRUE,
+  };
+  VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
+      .pNext = synchronization2 ? &synchronization2Features : nullptr,
+      .dynamicRendering = VK_TRUE,
+  };
+
+  VkDeviceCreateInfo deviceCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+      .pNext = &dynamicRenderingFeatures,
+      .queueCreateInfoCount = 1,
+      .pQueueCreateInfos = &queueInfo,
+      .enabledExtensionCount =
+          static_cast<uint32_t>(requiredExtensions.size()),
+      .ppEnabledExtensionNames = requiredExtensions.data(),
+  };
+
+  VK_CHECK(vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device));
+  spdlog::info("Created logical device");
+
+  // auto &requested_dynamic_rendering            =
+  // gpu.request_extension_features<VkPhysicalDeviceDynamicRenderingFeaturesKHR>(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR);
+  // requested_dynamic_rendering.dynamicRendering = VK_TRUE;
+
+  return device;
+}
+
+PFN_vkCmdBeginRenderingKHR cmdBeginRenderingKHR;
+PFN_vkCmdEndRenderingKHR cmdEndRenderingKHR;
+
+void loadDeviceFunctions(const VkDevice &device) {
+  cmdBeginRenderingKHR = reinterpret_cast<PFN_vkCmdBeginRenderingKHR>(
+      vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR"));
+  cmdEndRenderingKHR = reinterpret_cast<PFN_vkCmdEndRenderingKHR>(
+      vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR"));
+  if (!cmdBeginRenderingKHR || !cmdEndRenderingKHR) {
+    throw std::runtime_error("Failed to load VK_KHR_dynamic_rendering");
+  }
+}
+
+uint32_t findMemoryType(const VkPhysicalDevice &physicalDevice,
+                        const uint32_t &typeBits,
+                        const VkMemoryPropertyFlags &properties,
+                        const VkMemoryPropertyFlags &preferred) {
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+  for (VkMemoryPropertyFlags wanted : {properties | preferred, properties}) {
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+      if ((typeBits & (1u << i)) &&
+          (memoryProperties.memoryTypes[i].propertyFlags & wanted) == wanted) {
+        return i;
+      }
+    }
+  }
+  throw std::runtime_error("Failed to find a suitable memory type");
+}
+
+OffscreenImage createOffscreenImage(const VkPhysicalDevice &physicalDevice,
+                                    const VkDevice &device,
+                                    const VkExtent2D &extent,
+                                    const VkFormat &format,
+                                    const VkImageUsageFlags &usage) {
+  OffscreenImage offscreenImage;
+  VkImageCreateInfo imageCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = format,
+      .extent = {extent.width, extent.height, 1},
+      .mipLevels = 1,
+      .arrayLayers = 1,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      .usage = usage,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+  VK_CHECK(vkCreateImage(device, &imageCreateInfo, nullptr,
+                         &offscreenImage.image));
+
+  VkMemoryRequirements memoryRequirements;
+  vkGetImageMemoryRequirements(device, offscreenImage.image,
+                               &memoryRequirements);
+  VkMemoryAllocateInfo allocateInfo{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .allocationSize = memoryRequirements.size,
+      .memoryTypeIndex =
+          findMemoryType(physicalDevice, memoryRequirements.memoryTypeBits,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+  };
+  VK_CHECK(vkAllocateMemory(device, &allocateInfo, nullptr,
+                            &offscreenImage.memory));
+  VK_CHECK(vkBindImageMemory(device, offscreenImage.image,
+                             offscreenImage.memory, 0));
+
+  VkImageViewCreateInfo imageViewCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      .image = offscreenImage.image,
+      .viewType = VK_IMAGE_VIEW_TYPE_2D,
+      .format = format,
+      .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .subresourceRange.baseMipLevel = 0,
+      .subresourceRange.levelCount = 1,
+      .subresourceRange.baseArrayLayer = 0,
+      .subresourceRange.layerCount = 1,
+  };
+  VK_CHECK(vkCreateImageView(device, &imageViewCreateInfo, nullptr,
+                             &offscreenImage.view));
+  return offscreenImage;
+}
+
+void destroyOffscreenImage(const VkDevice &device,
+                           const OffscreenImage &offscreenImage) {
+  vkDestroyImageView(device, offscreenImage.view, nullptr);
+  vkDestroyImage(device, offscreenImage.image, nullptr);
+  vkFreeMemory(device, offscreenImage.memory, nullptr);
+}
+
+UniformRing createUniformRing(const VkPhysicalDevice &physicalDevice,
+                              const VkDevice &device,
+                              const VkDeviceSize &slotSize,
+                              const uint32_t &count) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+
+  UniformRing ring;
+  ring.stride = (slotSize + alignment - 1) / alignment * alignment;
+  VkBufferCreateInfo bufferCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .size = ring.stride * count,
+      .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+  };
+  VK_CHECK(vkCreateBuffer(device, &bufferCreateInfo, nullptr, &ring.buffer));
+
+  VkMemoryRequirements memoryRequirements;
+  vkGetBufferMemoryRequirements(device, ring.buffer, &memoryRequirements);
+  VkMemoryAllocateInfo allocateInfo{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .allocationSize = memoryRequirements.size,
+      .memoryTypeIndex =
+          findMemoryType(physicalDevice, memoryRequirements.memoryTypeBits,
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+  };
+  VK_CHECK(vkAllocateMemory(device, &allocateInfo, nullptr, &ring.memory));
+  VK_CHECK(vkBindBufferMemory(device, ring.buffer, ring.memory, 0));
+  void *mapped;
+  VK_CHECK(vkMapMemory(device, ring.memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+  ring.mapped = static_cast<char *>(mapped);
+  return ring;
+}
+
+void destroyUniformRing(const VkDevice &device, const UniformRing &ring) {
+  vkUnmapMemory(device, ring.memory);
+  vkDestroyBuffer(device, ring.buffer, nullptr);
+  vkFreeMemory(device, ring.memory, nullptr);
+}
+
+uint32_t writeUniformRing(const UniformRing &ring, const uint32_t &slot,
+                          const ShaderToyUniforms &uniforms) {
+  VkDeviceSize offset = ring.stride * slot;
+  std::memcpy(ring.mapped + offset, &uniforms, sizeof(uniforms));
+  return static_cast<uint32_t>(offset);
+}
+
+VkCommandPool createCommandPool(const VkDevice &logicalDevice,
+                                const uint32_t &graphicsQueueIndex) {
+  spdlog::info("Create command pool");
+  VkCommandPoolCreateInfo commandPoolCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+      .queueFamilyIndex = graphicsQueueIndex,
+  };
+  VkCommandPool commandPool;
+
+  VK_CHECK(vkCreateCommandPool(logicalDevice, &commandPoolCreateInfo, nullptr,
+                               &commandPool));
+  return commandPool;
+}
+
+std::vector<VkCommandBuffer>
+createCommandBuffers(const VkDevice &logicalDevice,
+                     const VkCommandPool &commandPool,
+                     const uint32_t &commandBufferCount) {
+  std::vector<VkCommandBuffer> commandBuffers(commandBufferCount);
+  spdlog::info("Create command buffer");
+  VkCommandBufferAllocateInfo commandBufferAllocateInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .pNext = nullptr,
+      .commandPool = commandPool,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = commandBufferCount,
+  };
+  VK_CHECK(vkAllocateCommandBuffers(logicalDevice, &commandBufferAllocateInfo,
+                                    commandBuffers.data()));
+  return commandBuffers;
+}
+
+void transitionImage(const VkCommandBuffer &commandBuffer, const VkImage &image,
+                     const VkImageLayout &oldLayout,
+                     const VkImageLayout &newLayout,
+                     const VkPipelineStageFlags &srcStage,
+                     const VkPipelineStageFlags &dstStage,
+                     const VkAccessFlags &srcAccess,
+                     const VkAccessFlags &dstAccess) {
+  VkImageMemoryBarrier imageMemoryBarrier{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+      .srcAccessMask = srcAccess,
+      .dstAccessMask = dstAccess,
+      .oldLayout = oldLayout,
+      .newLayout = newLayout,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .image = image,
+      .subresourceRange =
+          {
+              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+              .baseMipLevel = 0,
+              .levelCount = 1,
+              .baseArrayLayer = 0,
+              .layerCount = 1,
+          },
+  };
+
+  vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0,
+                       nullptr, 1, &imageMemoryBarrier);
+}
+
+void bindScene(const VkCommandBuffer &commandBuffer,
+               const VkPipeline &pipeline,
+               const VkPipelineLayout &pipelineLayout,
+               const VkDescriptorSet &descriptorSet,
+               const FrameUniforms &frameUniforms,
+               const PushConstants &pushConstants) {
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  if (descriptorSet != VK_NULL_HANDLE) {
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+  }
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          pipelineLayout, 1, 1, &frameUniforms.descriptorSet,
+                          1, &frameUniforms.offset);
+
+  vkCmdPushConstants(commandBuffer, pipelineLayout,
+                     VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstants),
+                     &pushConstants);
+}
+
+void finishSceneImage(const VkCommandBuffer &commandBuffer,
+                      const VkImage &image, const VkImageLayout &finalLayout) {
+  if (finalLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
+    transitionImage(commandBuffer, image,
+                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, finalLayout,
+                    VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                    VK_ACCESS_TRANSFER_READ_BIT);
+  } else if (finalLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+    transitionImage(commandBuffer, image,
+                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, finalLayout,
+                    VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                    VK_ACCESS_SHADER_READ_BIT);
+  } else {
+    transitionImage(commandBuffer, image,
+                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, finalLayout,
+                    VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                    VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                    VK_ACCESS_MEMORY_READ_BIT);
+  }
+}
+
+void beginSceneRendering(const VkCommandBuffer &commandBuffer,
+                         const VkImage &image, const VkImageView &imageView,
+                         const VkExtent2D &extent,
+                         const VkRenderingFlags &flags) {
+  VkRenderingAttachmentInfo colorAttachmentInfo{
+      .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+      .imageView = imageView,
+      .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+      .clearValue.color = {1.0f, 1.0f, 1.0f, 1.0f}};
+
+  VkRenderingInfo renderingInfo{
+      .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+      .flags = flags,
+      .renderArea =
+          {
+              .offset = {0, 0},
+              .extent = extent,
+          },
+      .layerCount = 1,
+      .colorAttachmentCount = 1,
+      .pColorAttachments = &colorAttachmentInfo,
+  };
+
+  // Layout transitions are not allowed inside a dynamic rendering instance
+  // so they happen before begin / after end rendering
+  transitionImage(commandBuffer, image, VK_IMAGE_LAYOUT_UNDEFINED,
+                  VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                  VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                  VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+                  VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+
+  cmdBeginRenderingKHR(commandBuffer, &renderingInfo);
+}
+
+void renderScene(const VkImage &image, const VkImageView &imageView,
+                 const VkExtent2D &extent,
+                 const VkCommandBuffer &commandBuffer,
+                 const VkPipeline &pipeline,
+                 const VkPipelineLayout &pipelineLayout,
+                 const VkDescriptorSet &descriptorSet,
+                 const FrameUniforms &frameUniforms,
+                 const PushConstants &pushConstants,
+                 const VkImageLayout &finalLayout) {
+  // spdlog::info("Check swapchain image view [0]");
+  // spdlog::info("Swapchain image view handle: {}",
+  //              reinterpret_cast<uint64_t>(swapchainImageViews[0]));
+
+  beginSceneRendering(commandBuffer, image, imageView, extent, 0);
+
+  bindScene(commandBuffer, pipeline, pipelineLayout, descriptorSet,
+            frameUniforms, pushConstants);
+
+  VkRect2D scissor{
+      .offset = {0, 0},
+      .extent = extent,
+  };
+
+  VkViewport viewport{
+      .x = 0.0f,
+      .y = 0.0f,
+      .width = static_cast<float>(extent.width),
+      .height = static_cast<float>(extent.height),
+      .minDepth = 0.0f,
+      .maxDepth = 1.0f,
+  };
+
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+  vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+
+  cmdEndRenderingKHR(commandBuffer);
+
+  finishSceneImage(commandBuffer, image, finalLayout);
+}
+
+std::vector<VkDescriptorSet>
+createDescriptorSets(const VkDevice &device,
+                     const VkDescriptorSetLayout &setLayout,
+                     const std::vector<VkDescriptorPoolSize> &setSizes,
+                     const uint32_t &count, VkDescriptorPool &pool) {
+  std::vector<VkDescriptorPoolSize> poolSizes = setSizes;
+  for (auto &poolSize : poolSizes)
+    poolSize.descriptorCount *= count;
+  VkDescriptorPoolCreateInfo poolCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+      .maxSets = count,
+      .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
+      .pPoolSizes = poolSizes.data(),
+  };
+  VK_CHECK(vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &pool));
+
+  std::vector<VkDescriptorSetLayout> setLayouts(count, setLayout);
+  VkDescriptorSetAllocateInfo allocateInfo{
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .descriptorPool = pool,
+      .descriptorSetCount = count,
+      .pSetLayouts = setLayouts.data(),
+  };
+  std::vector<VkDescriptorSet> descriptorSets(count);
+  VK_CHECK(
+      vkAllocateDescriptorSets(device, &allocateInfo, descriptorSets.data()));
+  return descriptorSets;
+}
+
+VkDescriptorSetLayout createSceneSetLayout(const VkDevice &device) {
+  VkDescriptorSetLayoutBinding binding{
+      .binding = 0,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+  };
+  VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .bindingCount = 1,
+      .pBindings = &binding,
+  };
+  VkDescriptorSetLayout setLayout;
+  VK_CHECK(vkCreateDescriptorSetLayout(device, &setLayoutCreateInfo, nullptr,
+                                       &setLayout));
+  return setLayout;
+}
+
+VkDescriptorSetLayout createFrameSetLayout(const VkDevice &device) {
+  VkDescriptorSetLayoutBinding binding{
+      .binding = 0,
+      .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
+  };
+  VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .bindingCount = 1,
+      .pBindings = &binding,
+  };
+  VkDescriptorSetLayout setLayout;
+  VK_CHECK(vkCreateDescriptorSetLayout(device, &setLayoutCreateInfo, nullptr,
+                                       &setLayout));
+  return setLayout;
+}
+
+void writeUniformRingDescriptor(const VkDevice &device,
+                                const VkDescriptorSet &descriptorSet,
+                                const UniformRing &ring) {
+  VkDescriptorBufferInfo bufferInfo{
+      .buffer = ring.buffer,
+      .offset = 0,
+      .range = sizeof(ShaderToyUniforms),
+  };
+  VkWriteDescriptorSet write{
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = descriptorSet,
+      .dstBinding = 0,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+      .pBufferInfo = &bufferInfo,
+  };
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+VkPipelineLayout
+createPipelineLayout(const VkDevice &logicalDevice,
+                     const VkDescriptorSetLayout &setLayout,
+                     const VkDescriptorSetLayout &frameSetLayout) {
+  // https://www.saschawillems.de/blog/2016/08/13/vulkan-tutorial-on-rendering-a-fullscreen-quad-without-buffers/
+
+  VkPushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof(PushConstants);
+
+  std::array<VkDescriptorSetLayout, 2> setLayouts{setLayout, frameSetLayout};
+  VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .setLayoutCount = static_cast<uint32_t>(setLayouts.size()),
+      .pSetLayouts = setLayouts.data(),
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &pushConstantRange,
+  };
+  VkPipelineLayout pipelineLayout;
+  VK_CHECK(vkCreatePipelineLayout(logicalDevice, &pipelineLayoutCreateInfo,
+                                  nullptr, &pipelineLayout));
+  return pipelineLayout;
+}
+
+VkPipeline
+createPipeline(const VkDevice &logicalDevice,
+               const VkPipelineLayout &pipelineLayout,
+               const VkFormat &colorFormat,
+               const VkPipelineCache &pipelineCache,
+               ShaderCompiler &shaderCompiler, const char *fragmentPath,
+               const VkSpecializationInfo *specialization) {
+  spdlog::info("Create pipeline for {}", fragmentPath);
+  VkPipelineVertexInputStateCreateInfo emptyVertexInputStateCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+      .vertexBindingDescriptionCount = 0,
+      .pVertexBindingDescriptions = nullptr,
+      .vertexAttributeDescriptionCount = 0,
+      .pVertexAttributeDescriptions = nullptr,
+  };
+
+  std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages{};
+
+  // Vertex shader stage of the pipeline
+  shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+  shaderStages[0].module = loadShaderModule(
+      logicalDevice, shaderCompiler.spirv("shaders/fullscreenquad.vert"));
+  shaderStages[0].pName = "main";
+
+  // Fragment shader stage of the pipeline
+  shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  shaderStages[1].module =
+      loadShaderModule(logicalDevice, shaderCompiler.spirv(fragmentPath));
+  shaderStages[1].pName = "main";
+  shaderStages[1].pSpecializationInfo = specialization;
+
+  VkPipelineRasterizationStateCreateInfo rasterizationStateCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+      .cullMode = VK_CULL_MODE_FRONT_BIT,
+      .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+      .lineWidth = 1.0f,
+  };
+
+  VkPipelineViewportStateCreateInfo viewportStateCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+      .viewportCount = 1,
+      .scissorCount = 1,
+  };
+
+  VkPipelineMultisampleStateCreateInfo multisampleStateCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+      .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT, // no multisampling
+  };
+
+  VkPipelineInputAssemblyStateCreateInfo assemblyStateCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+      .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+  };
+
+  VkPipelineColorBlendAttachmentState blendAttachment{};
+  blendAttachment.colorWriteMask =
+      VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  blendAttachment.blendEnable = VK_FALSE;
+
+  VkPipelineColorBlendStateCreateInfo blend{
+      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO};
+  blend.attachmentCount = 1;
+  blend.pAttachments = &blendAttachment;
+
+  // Disable all depth testing
+  VkPipelineDepthStencilStateCreateInfo depthStencil{
+      VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
+
+  VkDynamicState dynamicStates[] = {
+      VK_DYNAMIC_STATE_VIEWPORT,
+      VK_DYNAMIC_STATE_SCISSOR,
+  };
+  VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+      .dynamicStateCount = 2,
+      .pDynamicStates = dynamicStates,
+  };
+
+  // for dynamic rendering
+  VkPipelineRenderingCreateInfoKHR dynamicPipelineCreate{
+      VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR};
+  dynamicPipelineCreate.colorAttachmentCount = 1;
+  dynamicPipelineCreate.pColorAttachmentFormats = &colorFormat;
+  dynamicPipelineCreate.depthAttachmentFormat = VK_FORMAT_D16_UNORM;
+  // dynamicPipelineCreate.pNext = &dynamicStateCreateInfo;
+
+  VkGraphicsPipelineCreateInfo pipelineCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+      .pNext = &dynamicPipelineCreate,
+      .stageCount = static_cast<uint32_t>(shaderStages.size()),
+      .pStages = shaderStages.data(),
+      .pVertexInputState = &emptyVertexInputStateCreateInfo,
+      .pInputAssemblyState = &assemblyStateCreateInfo,
+      .pViewportState = &viewportStateCreateInfo,
+      .pRasterizationState = &rasterizationStateCreateInfo,
+      .pMultisampleState = &multisampleStateCreateInfo,
+      .pDepthStencilState = &depthStencil,
+      .pColorBlendState = &blend,
+      .pDynamicState = &dynamicStateCreateInfo,
+      .layout = pipelineLayout,
+  };
+  spdlog::info("Create the graphics pipeline");
+  VkPipeline pipeline;
+  auto startT = std::chrono::high_resolution_clock::now();
+  VkResult result = vkCreateGraphicsPipelines(
+      logicalDevice, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline);
+  spdlog::info("vkCreateGraphicsPipelines took {:.3f}ms",
+               std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::high_resolution_clock::now() - startT)
+                       .count() *
+                   1e-3);
+  // Modules are only needed while creating the pipeline
+  for (auto &shaderStage : shaderStages) {
+    vkDestroyShaderModule(logicalDevice, shaderStage.module, nullptr);
+  }
+  VK_CHECK(result);
+  spdlog::info("Created the pipeline");
+  return pipeline;
+}
+
+std::vector<VkFence> createFences(const VkDevice &logicalDevice,
+                                  const uint32_t &count) {
+  std::vector<VkFence> fences(count);
+  for (uint32_t i = 0; i < count; i++) {
+    VkFenceCreateInfo fenceCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        .flags = VK_FENCE_CREATE_SIGNALED_BIT,
+    };
+    VK_CHECK(
+        vkCreateFence(logicalDevice, &fenceCreateInfo, nullptr, &fences[i]));
+  }
+  return fences;
+}
+
+VkSampler createNearestSampler(const VkDevice &device) {
+  VkSamplerCreateInfo samplerCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+      .magFilter = VK_FILTER_NEAREST,
+      .minFilter = VK_FILTER_NEAREST,
+      .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+      .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .maxLod = 0.0f,
+  };
+  VkSampler sampler;
+  VK_CHECK(vkCreateSampler(device, &samplerCreateInfo, nullptr, &sampler));
+  return sampler;
+}
+
+VkExtent2D prepassExtent(const VkExtent2D &extent) {
+  return VkExtent2D{(extent.width + prepassScale - 1) / prepassScale,
+                    (extent.height + prepassScale - 1) / prepassScale};
+}
+
+std::vector<OffscreenImage>
+createPrepassTargets(const VkPhysicalDevice &physicalDevice,
+                     const VkDevice &device, const VkExtent2D &extent,
+                     const uint32_t &count) {
+  std::vector<OffscreenImage> targets(count);
+  for (auto &target : targets) {
+    target = createOffscreenImage(physicalDevice, device,
+                                  prepassExtent(extent), prepassFormat,
+                                  VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                      VK_IMAGE_USAGE_SAMPLED_BIT);
+  }
+  return targets;
+}
+
+void writeStartDistance(const VkDevice &device,
+                        const VkDescriptorSet &descriptorSet,
+                        const uint32_t &binding, const VkSampler &sampler,
+                        const OffscreenImage &target) {
+  VkDescriptorImageInfo imageInfo{
+      .sampler = sampler,
+      .imageView = target.view,
+      .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+  };
+  VkWriteDescriptorSet write{
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = descriptorSet,
+      .dstBinding = binding,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .pImageInfo = &imageInfo,
+  };
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+void recordPrepass(const VkCommandBuffer &commandBuffer,
+                   const OffscreenImage &target, const VkExtent2D &extent,
+                   const VkPipeline &pipeline,
+                   const VkPipelineLayout &pipelineLayout,
+                   const FrameUniforms &frameUniforms,
+                   PushConstants pushConstants, const bool &enabled) {
+  if (!enabled) {
+    transitionImage(commandBuffer, target.image, VK_IMAGE_LAYOUT_UNDEFINED,
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    0, VK_ACCESS_SHADER_READ_BIT);
+    return;
+  }
+  TRACE_SCOPE("recordPrepass");
+  // iResolution stays the full resolution extent, the prepass shader
+  // derives its own size from it
+  pushConstants.checkerboard = 0;
+  renderScene(target.image, target.view, prepassExtent(extent), commandBuffer,
+              pipeline, pipelineLayout, VK_NULL_HANDLE, frameUniforms,
+              pushConstants, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+}
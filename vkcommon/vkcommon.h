@@ -0,0 +1,257 @@
+/**
+ * Vulkan setup and scene rendering shared by the Planet executable and the
+ * planet_bench microbenchmarks: instance, device and queue creation, shader
+ * modules, the scene pipeline with its layouts and the recording of a
+ * fullscreen scene draw into a device owned or swapchain image.
+ **/
+#pragma once
+#include "../shadercompiler/shadercompiler.h"
+#include <cstddef>
+#include <cstdint>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#define VK_CHECK(x)                                                            \
+  do {                                                                         \
+    VkResult err = x;                                                          \
+    /*spdlog::info("VkResult: {}", static_cast<int>(err));*/                   \
+    if (err) {                                                                 \
+      spdlog::error("Detected Vulkan error: {}", static_cast<int>(err));       \
+      throw std::runtime_error("Got a runtime_error");                         \
+    }                                                                          \
+  } while (0);
+
+// Matches the std140 ShaderToy block of shaders/shadertoy.glsl, written to a
+// uniform ring slot once per frame
+struct ShaderToyUniforms {
+  // Render extent, z is the pixel aspect ratio
+  glm::vec3 iResolution;
+  float iTime;
+  // xy while the left button is down, zw where it was pressed, z negative
+  // once released and w negative after the press frame
+  glm::vec4 iMouse;
+  glm::vec4 iDate;
+  // vec3 array in std140, each element padded to 16 bytes
+  glm::vec4 iChannelResolution[4];
+  float iTimeDelta;
+  float iFrameRate;
+  int iFrame;
+};
+static_assert(offsetof(ShaderToyUniforms, iTimeDelta) == 112,
+              "ShaderToyUniforms must match the std140 layout");
+
+// Per pass flags, the frame wide inputs live in ShaderToyUniforms
+struct PushConstants {
+  // Non zero when planet.frag traces half width for the checkerboard resolve
+  int checkerboard;
+  // Non zero when the start distance prepass ran this frame
+  int prepass;
+};
+
+// Device owned image used as a render target instead of a swapchain image
+struct OffscreenImage {
+  VkImage image;
+  VkDeviceMemory memory;
+  VkImageView view;
+};
+
+// Host coherent uniform buffer with one slot per frame in flight, mapped for
+// its whole lifetime. A slot is only rewritten after the fence of the frame
+// that last read it has signaled, so writes need no flush or barrier.
+struct UniformRing {
+  VkBuffer buffer;
+  VkDeviceMemory memory;
+  char *mapped;
+  // Slot size rounded up to minUniformBufferOffsetAlignment
+  VkDeviceSize stride;
+};
+
+// The ring's descriptor set and the offset of this frame's slot in it
+struct FrameUniforms {
+  VkDescriptorSet descriptorSet;
+  uint32_t offset;
+};
+
+std::vector<char> readFile(const std::string &filename);
+
+VkShaderModule loadShaderModule(const VkDevice &device,
+                                const std::vector<uint32_t> &code);
+// Loads a SPIR-V file
+VkShaderModule loadShaderModule(const VkDevice &device, const char *path);
+
+bool hasInstanceExtension(const char *name);
+bool hasDeviceExtension(const VkPhysicalDevice &physicalDevice,
+                        const char *name);
+
+// Headless instances never ask GLFW for the surface extensions
+VkInstance setupVulkanInstance(const bool &headless);
+// Logs every device and returns the first one
+VkPhysicalDevice findGPU(const VkInstance &instance);
+// Without a surface (VK_NULL_HANDLE) any graphics queue family will do
+uint32_t getVulkanGraphicsQueueIndex(const VkPhysicalDevice &physicalDevice,
+                                     const VkSurfaceKHR &surface);
+// One queue of graphicsQueueIndex with dynamic rendering, headless devices
+// do not enable VK_KHR_swapchain
+VkDevice createVulkanLogicalDevice(const VkPhysicalDevice &physicalDevice,
+                                   const uint32_t &graphicsQueueIndex,
+                                   const bool &headless);
+
+// Extension entry points are not exported by the Vulkan loader on every
+// platform (only MoltenVK when linked directly) so fetch them from the device
+extern PFN_vkCmdBeginRenderingKHR cmdBeginRenderingKHR;
+extern PFN_vkCmdEndRenderingKHR cmdEndRenderingKHR;
+
+void loadDeviceFunctions(const VkDevice &device);
+
+// A memory type allowed by typeBits with all of properties, one that also
+// has all of preferred if there is one. Throws when none qualifies.
+uint32_t findMemoryType(const VkPhysicalDevice &physicalDevice,
+                        const uint32_t &typeBits,
+                        const VkMemoryPropertyFlags &properties,
+                        const VkMemoryPropertyFlags &preferred = 0);
+
+OffscreenImage createOffscreenImage(const VkPhysicalDevice &physicalDevice,
+                                    const VkDevice &device,
+                                    const VkExtent2D &extent,
+                                    const VkFormat &format,
+                                    const VkImageUsageFlags &usage);
+void destroyOffscreenImage(const VkDevice &device,
+                           const OffscreenImage &offscreenImage);
+
+UniformRing createUniformRing(const VkPhysicalDevice &physicalDevice,
+                              const VkDevice &device,
+                              const VkDeviceSize &slotSize,
+                              const uint32_t &count);
+void destroyUniformRing(const VkDevice &device, const UniformRing &ring);
+// Copies uniforms into slot and returns the dynamic offset to bind it at
+uint32_t writeUniformRing(const UniformRing &ring, const uint32_t &slot,
+                          const ShaderToyUniforms &uniforms);
+
+VkCommandPool createCommandPool(const VkDevice &logicalDevice,
+                                const uint32_t &graphicsQueueIndex);
+std::vector<VkCommandBuffer>
+createCommandBuffers(const VkDevice &logicalDevice,
+                     const VkCommandPool &commandPool,
+                     const uint32_t &commandBufferCount);
+// Created signaled so the first wait on each frame in flight returns
+std::vector<VkFence> createFences(const VkDevice &logicalDevice,
+                                  const uint32_t &count);
+
+void transitionImage(const VkCommandBuffer &commandBuffer, const VkImage &image,
+                     const VkImageLayout &oldLayout,
+                     const VkImageLayout &newLayout,
+                     const VkPipelineStageFlags &srcStage,
+                     const VkPipelineStageFlags &dstStage,
+                     const VkAccessFlags &srcAccess,
+                     const VkAccessFlags &dstAccess);
+
+// Everything a scene draw needs bound, descriptorSet is bound to set 0
+// unless it is VK_NULL_HANDLE
+void bindScene(const VkCommandBuffer &commandBuffer,
+               const VkPipeline &pipeline,
+               const VkPipelineLayout &pipelineLayout,
+               const VkDescriptorSet &descriptorSet,
+               const FrameUniforms &frameUniforms,
+               const PushConstants &pushConstants);
+
+// Moves a rendered image from COLOR_ATTACHMENT to finalLayout, see
+// renderScene
+void finishSceneImage(const VkCommandBuffer &commandBuffer,
+                      const VkImage &image, const VkImageLayout &finalLayout);
+
+// Clears image and begins rendering to it, flags are VkRenderingFlags
+void beginSceneRendering(const VkCommandBuffer &commandBuffer,
+                         const VkImage &image, const VkImageView &imageView,
+                         const VkExtent2D &extent,
+                         const VkRenderingFlags &flags);
+
+/**
+ * Draws the fullscreen triangle into image and leaves it in finalLayout.
+ * finalLayout is PRESENT_SRC for the swapchain, TRANSFER_SRC for offscreen
+ * images that are read back / blitted afterwards or SHADER_READ_ONLY for
+ * images sampled by a later pass. descriptorSet is bound to set 0 unless it
+ * is VK_NULL_HANDLE, the frame uniforms always to set 1.
+ **/
+void renderScene(const VkImage &image, const VkImageView &imageView,
+                 const VkExtent2D &extent,
+                 const VkCommandBuffer &commandBuffer,
+                 const VkPipeline &pipeline,
+                 const VkPipelineLayout &pipelineLayout,
+                 const VkDescriptorSet &descriptorSet,
+                 const FrameUniforms &frameUniforms,
+                 const PushConstants &pushConstants,
+                 const VkImageLayout &finalLayout);
+
+// count sets holding setSizes descriptors each, allocated from and freed
+// with pool
+std::vector<VkDescriptorSet>
+createDescriptorSets(const VkDevice &device,
+                     const VkDescriptorSetLayout &setLayout,
+                     const std::vector<VkDescriptorPoolSize> &setSizes,
+                     const uint32_t &count, VkDescriptorPool &pool);
+
+// Binding 0 the prepass start distances sampled by planet.frag
+VkDescriptorSetLayout createSceneSetLayout(const VkDevice &device);
+// Binding 0 the ShaderToy uniform block, one dynamic offset per frame slot
+VkDescriptorSetLayout createFrameSetLayout(const VkDevice &device);
+
+// Points the set's dynamic uniform buffer at the ring, done once since the
+// slot is picked with the offset at bind time
+void writeUniformRingDescriptor(const VkDevice &device,
+                                const VkDescriptorSet &descriptorSet,
+                                const UniformRing &ring);
+
+// Set 0 the pass's own descriptors, set 1 the frame uniforms
+VkPipelineLayout
+createPipelineLayout(const VkDevice &logicalDevice,
+                     const VkDescriptorSetLayout &setLayout,
+                     const VkDescriptorSetLayout &frameSetLayout);
+
+// specialization applies to the fragment stage, nullptr keeps the defaults
+VkPipeline
+createPipeline(const VkDevice &logicalDevice,
+               const VkPipelineLayout &pipelineLayout,
+               const VkFormat &colorFormat,
+               const VkPipelineCache &pipelineCache,
+               ShaderCompiler &shaderCompiler, const char *fragmentPath,
+               const VkSpecializationInfo *specialization = nullptr);
+
+VkSampler createNearestSampler(const VkDevice &device);
+
+// The start distance prepass (shaders/prepass.frag) renders 1/prepassScale
+// of the resolution in each direction, keep in sync with planet.glsl
+static constexpr uint32_t prepassScale = 8;
+static constexpr VkFormat prepassFormat = VK_FORMAT_R32_SFLOAT;
+
+VkExtent2D prepassExtent(const VkExtent2D &extent);
+
+// One per frame in flight, sized for a full resolution render of extent
+std::vector<OffscreenImage>
+createPrepassTargets(const VkPhysicalDevice &physicalDevice,
+                     const VkDevice &device, const VkExtent2D &extent,
+                     const uint32_t &count);
+
+// Points binding of descriptorSet at a prepass target, the set must not be
+// in use by the GPU
+void writeStartDistance(const VkDevice &device,
+                        const VkDescriptorSet &descriptorSet,
+                        const uint32_t &binding, const VkSampler &sampler,
+                        const OffscreenImage &target);
+
+/**
+ * Renders the start distances for a full resolution render of extent into
+ * target, ready to be sampled by the scene pass. When disabled only the
+ * layout is set up, the scene pass keeps the descriptor bound regardless
+ * and pushConstants.prepass tells it to ignore the contents.
+ **/
+void recordPrepass(const VkCommandBuffer &commandBuffer,
+                   const OffscreenImage &target, const VkExtent2D &extent,
+                   const VkPipeline &pipeline,
+                   const VkPipelineLayout &pipelineLayout,
+                   const FrameUniforms &frameUniforms,
+                   PushConstants pushConstants, const bool &enabled);
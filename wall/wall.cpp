@@ -0,0 +1,319 @@
+#include "wall.h"
+#include "../vkcommon/vkcommon.h"
+#include <algorithm>
+#include <array>
+#include <boost/filesystem.hpp>
+#include <cmath>
+#include <numeric>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+const VkImageSubresourceRange colorRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0,
+                                         1};
+
+} // namespace
+
+std::vector<std::string> findWallShaders(const std::string &directory) {
+  std::vector<std::string> paths;
+  for (auto &entry : fs::directory_iterator(directory)) {
+    if (fs::is_regular_file(entry.path()) &&
+        entry.path().extension() == ".frag") {
+      paths.push_back(entry.path().generic_string());
+    }
+  }
+  std::sort(paths.begin(), paths.end());
+  return paths;
+}
+
+uint32_t ShaderWall::queryCount(const uint32_t &shaderCount,
+                                const uint32_t &framesInFlight) {
+  return (shaderCount + 1) * framesInFlight;
+}
+
+ShaderWall::ShaderWall(const VkPhysicalDevice &physicalDevice,
+                       const VkDevice &device, const VkQueryPool &queryPool,
+                       const VkPhysicalDeviceProperties &deviceProperties,
+                       const std::vector<std::string> &names,
+                       const uint32_t &framesInFlight,
+                       const VkDescriptorSetLayout &frameSetLayout)
+    : device{device}, queryPool{queryPool},
+      timestampPeriodMs{deviceProperties.limits.timestampPeriod * 1e-6},
+      names{names}, queriesPerSlot{static_cast<uint32_t>(names.size()) + 1},
+      pending(framesInFlight, false), tileStats(names.size(), RollingStats(64)),
+      wallStats(64) {
+  if (names.empty())
+    throw std::runtime_error("Shader wall has no shaders");
+  // Closest to square, filled row by row
+  columns = static_cast<uint32_t>(
+      std::ceil(std::sqrt(static_cast<double>(names.size()))));
+  rows = (names.size() + columns - 1) / columns;
+
+  // A single black texel stands in for every iChannel
+  VkImageCreateInfo imageCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = VK_FORMAT_R8G8B8A8_UNORM,
+      .extent = {1, 1, 1},
+      .mipLevels = 1,
+      .arrayLayers = 1,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+  VK_CHECK(vkCreateImage(device, &imageCreateInfo, nullptr, &channelImage));
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(device, channelImage, &requirements);
+  uint32_t typeIndex =
+      findMemoryType(physicalDevice, requirements.memoryTypeBits,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  VkMemoryAllocateInfo allocateInfo{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .allocationSize = requirements.size,
+      .memoryTypeIndex = typeIndex,
+  };
+  VK_CHECK(vkAllocateMemory(device, &allocateInfo, nullptr, &channelMemory));
+  VK_CHECK(vkBindImageMemory(device, channelImage, channelMemory, 0));
+  VkImageViewCreateInfo viewCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      .image = channelImage,
+      .viewType = VK_IMAGE_VIEW_TYPE_2D,
+      .format = VK_FORMAT_R8G8B8A8_UNORM,
+      .subresourceRange = colorRange,
+  };
+  VK_CHECK(vkCreateImageView(device, &viewCreateInfo, nullptr, &channelView));
+
+  VkSamplerCreateInfo samplerCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+      .magFilter = VK_FILTER_NEAREST,
+      .minFilter = VK_FILTER_NEAREST,
+      .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+      .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .maxLod = 0.0f,
+  };
+  VK_CHECK(vkCreateSampler(device, &samplerCreateInfo, nullptr, &sampler));
+
+  std::array<VkDescriptorSetLayoutBinding, channelCount> bindings{};
+  std::array<VkDescriptorImageInfo, channelCount> imageInfos{};
+  for (uint32_t i = 0; i < channelCount; i++) {
+    bindings[i] = {
+        .binding = i,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+    };
+    imageInfos[i] = {
+        .sampler = sampler,
+        .imageView = channelView,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+  }
+  VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .bindingCount = channelCount,
+      .pBindings = bindings.data(),
+  };
+  VK_CHECK(vkCreateDescriptorSetLayout(device, &setLayoutCreateInfo, nullptr,
+                                       &setLayout));
+  VkDescriptorPoolSize poolSize{
+      .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .descriptorCount = channelCount,
+  };
+  VkDescriptorPoolCreateInfo poolCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+      .maxSets = 1,
+      .poolSizeCount = 1,
+      .pPoolSizes = &poolSize,
+  };
+  VK_CHECK(vkCreateDescriptorPool(device, &poolCreateInfo, nullptr,
+                                  &descriptorPool));
+  VkDescriptorSetAllocateInfo setAllocateInfo{
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .descriptorPool = descriptorPool,
+      .descriptorSetCount = 1,
+      .pSetLayouts = &setLayout,
+  };
+  VK_CHECK(vkAllocateDescriptorSets(device, &setAllocateInfo, &descriptorSet));
+  // Written once, the set never changes afterwards
+  VkWriteDescriptorSet write{
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = descriptorSet,
+      .dstBinding = 0,
+      .descriptorCount = channelCount,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .pImageInfo = imageInfos.data(),
+  };
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+  VkPushConstantRange pushConstantRange{
+      .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+      .offset = 0,
+      .size = pushConstantSize,
+  };
+  std::array<VkDescriptorSetLayout, 2> setLayouts{setLayout, frameSetLayout};
+  VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .setLayoutCount = static_cast<uint32_t>(setLayouts.size()),
+      .pSetLayouts = setLayouts.data(),
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &pushConstantRange,
+  };
+  VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr,
+                                  &layout));
+  spdlog::info("Shader wall: {} shaders in {}x{} tiles", names.size(),
+               columns, rows);
+}
+
+VkPipelineLayout ShaderWall::pipelineLayout() const { return layout; }
+
+VkRect2D ShaderWall::tile(const uint32_t &index,
+                          const VkExtent2D &extent) const {
+  uint32_t column = index % columns;
+  uint32_t row = index / columns;
+  uint32_t x0 = extent.width * column / columns;
+  uint32_t x1 = extent.width * (column + 1) / columns;
+  uint32_t y0 = extent.height * row / rows;
+  uint32_t y1 = extent.height * (row + 1) / rows;
+  return VkRect2D{
+      .offset = {static_cast<int32_t>(x0), static_cast<int32_t>(y0)},
+      .extent = {std::max(x1 - x0, 1u), std::max(y1 - y0, 1u)},
+  };
+}
+
+VkExtent2D ShaderWall::tileExtent(const VkExtent2D &extent) const {
+  return VkExtent2D{std::max(extent.width / columns, 1u),
+                    std::max(extent.height / rows, 1u)};
+}
+
+void ShaderWall::collect(const uint32_t &slot) {
+  if (!pending[slot])
+    return;
+  pending[slot] = false;
+  // Pairs of (timestamp, availability)
+  std::vector<uint64_t> results(queriesPerSlot * 2, 0);
+  VkResult result = vkGetQueryPoolResults(
+      device, queryPool, slot * queriesPerSlot, queriesPerSlot,
+      results.size() * sizeof(uint64_t), results.data(), sizeof(uint64_t) * 2,
+      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+  if (result != VK_SUCCESS && result != VK_NOT_READY)
+    return;
+  for (uint32_t q = 0; q < queriesPerSlot; q++) {
+    if (results[q * 2 + 1] == 0)
+      return;
+  }
+  // Bottom of pipe timestamps complete in order, so the time between two
+  // is when the GPU was busy finishing that tile. Tiles overlap a little
+  // at their edges, fine for ranking shaders.
+  for (uint32_t i = 0; i < names.size(); i++) {
+    tileStats[i].push((results[(i + 1) * 2] - results[i * 2]) *
+                      timestampPeriodMs);
+  }
+  wallStats.push((results[names.size() * 2] - results[0]) *
+                 timestampPeriodMs);
+}
+
+void ShaderWall::reset(const VkCommandBuffer &commandBuffer,
+                       const uint32_t &slot) {
+  vkCmdResetQueryPool(commandBuffer, queryPool, slot * queriesPerSlot,
+                      queriesPerSlot);
+  if (channelCleared)
+    return;
+  VkImageMemoryBarrier toTransfer{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+      .srcAccessMask = 0,
+      .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .image = channelImage,
+      .subresourceRange = colorRange,
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &toTransfer);
+  VkClearColorValue black{};
+  vkCmdClearColorImage(commandBuffer, channelImage,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &black, 1,
+                       &colorRange);
+  VkImageMemoryBarrier toSampled = toTransfer;
+  toSampled.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  toSampled.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  toSampled.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  toSampled.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
+                       0, nullptr, 1, &toSampled);
+  channelCleared = true;
+}
+
+void ShaderWall::draw(const VkCommandBuffer &commandBuffer,
+                      const uint32_t &slot, const VkExtent2D &extent,
+                      const std::vector<VkPipeline> &pipelines,
+                      const VkDescriptorSet &frameSet,
+                      const uint32_t &frameOffset) {
+  std::array<VkDescriptorSet, 2> descriptorSets{descriptorSet, frameSet};
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          layout, 0, descriptorSets.size(),
+                          descriptorSets.data(), 1, &frameOffset);
+  std::array<uint8_t, pushConstantSize> pushConstants{};
+  vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                     pushConstants.size(), pushConstants.data());
+
+  uint32_t query = slot * queriesPerSlot;
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      queryPool, query);
+  for (uint32_t i = 0; i < names.size(); i++) {
+    // Each shader sees its tile as a whole fullscreen triangle
+    VkRect2D rect = tile(i, extent);
+    VkViewport viewport{
+        .x = static_cast<float>(rect.offset.x),
+        .y = static_cast<float>(rect.offset.y),
+        .width = static_cast<float>(rect.extent.width),
+        .height = static_cast<float>(rect.extent.height),
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f,
+    };
+    if (i < pipelines.size() && pipelines[i] != VK_NULL_HANDLE) {
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                        pipelines[i]);
+      vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+      vkCmdSetScissor(commandBuffer, 0, 1, &rect);
+      vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+    }
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        queryPool, query + i + 1);
+  }
+  pending[slot] = true;
+}
+
+void ShaderWall::report() const {
+  std::vector<size_t> order(names.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::vector<StatsSummary> summaries(names.size());
+  for (size_t i = 0; i < names.size(); i++)
+    summaries[i] = tileStats[i].summary();
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return summaries[a].avg > summaries[b].avg;
+  });
+  spdlog::info("Shader wall GPU: {}", formatStats(wallStats.summary()));
+  for (auto &i : order)
+    spdlog::info("  {:<32} {}", names[i], formatStats(summaries[i]));
+}
+
+void ShaderWall::destroy() {
+  vkDestroyPipelineLayout(device, layout, nullptr);
+  vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+  vkDestroySampler(device, sampler, nullptr);
+  vkDestroyImageView(device, channelView, nullptr);
+  vkDestroyImage(device, channelImage, nullptr);
+  vkFreeMemory(device, channelMemory, nullptr);
+}
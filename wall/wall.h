@@ -0,0 +1,80 @@
+/**
+ * Shader wall benchmark: every fragment shader of a directory drawn side by
+ * side as a grid of viewports in one frame. A timestamp after every tile's
+ * draw gives each shader's GPU time, so frame cost can be compared against
+ * shader count and the expensive shaders found.
+ **/
+#pragma once
+#include "../frametiming/frametiming.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Every *.frag directly inside directory, sorted by name
+std::vector<std::string> findWallShaders(const std::string &directory);
+
+class ShaderWall {
+public:
+  // Every shader gets zeroed push constants of this size, enough for any
+  // block the shaders here declare
+  static constexpr uint32_t pushConstantSize = 128;
+  // sampler2D iChannel0-3 at set 0, all a black texel
+  static constexpr uint32_t channelCount = 4;
+
+private:
+  VkDevice device;
+  VkQueryPool queryPool;
+  double timestampPeriodMs;
+  std::vector<std::string> names;
+  uint32_t columns;
+  uint32_t rows;
+  // Per slot one timestamp before the first tile and one after each tile
+  uint32_t queriesPerSlot;
+  std::vector<bool> pending;
+  std::vector<RollingStats> tileStats;
+  RollingStats wallStats;
+
+  VkImage channelImage;
+  VkDeviceMemory channelMemory;
+  VkImageView channelView;
+  VkSampler sampler;
+  VkDescriptorSetLayout setLayout;
+  VkDescriptorPool descriptorPool;
+  VkDescriptorSet descriptorSet;
+  VkPipelineLayout layout;
+  // The channel image is cleared by the first reset()
+  bool channelCleared = false;
+
+  VkRect2D tile(const uint32_t &index, const VkExtent2D &extent) const;
+
+public:
+  // Timestamp queries the pool passed to the constructor needs
+  static uint32_t queryCount(const uint32_t &shaderCount,
+                             const uint32_t &framesInFlight);
+  // names are shown in report(), frameSetLayout is set 1 of every pipeline
+  ShaderWall(const VkPhysicalDevice &physicalDevice, const VkDevice &device,
+             const VkQueryPool &queryPool,
+             const VkPhysicalDeviceProperties &deviceProperties,
+             const std::vector<std::string> &names,
+             const uint32_t &framesInFlight,
+             const VkDescriptorSetLayout &frameSetLayout);
+  // Layout to build every wall pipeline with
+  VkPipelineLayout pipelineLayout() const;
+  // Size of one tile when the wall covers extent, the shaders' iResolution
+  VkExtent2D tileExtent(const VkExtent2D &extent) const;
+  // Reads back the tile times slot recorded frames ago if the GPU has
+  // written them. Never waits, call before reset().
+  void collect(const uint32_t &slot);
+  // Resets slot's queries, record outside of rendering
+  void reset(const VkCommandBuffer &commandBuffer, const uint32_t &slot);
+  // Draws pipelines[i] into tile i inside the current rendering instance,
+  // skipping VK_NULL_HANDLE (shaders that failed to build)
+  void draw(const VkCommandBuffer &commandBuffer, const uint32_t &slot,
+            const VkExtent2D &extent, const std::vector<VkPipeline> &pipelines,
+            const VkDescriptorSet &frameSet, const uint32_t &frameOffset);
+  // Logs the GPU time of every tile, most expensive first
+  void report() const;
+  // Only call once the device is idle, the query pool is not destroyed
+  void destroy();
+};